@@ -0,0 +1,100 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+// getrusage
+#include <sys/resource.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Minimal helpers shared by the benchmarks. Results are printed one line
+// per case as "name key=value ..." so they are easy to grep and diff.
+namespace bench {
+
+inline uint64_t NowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+inline long EnvOr(const char* name, long fallback) {
+	const char* value = getenv(name);
+	return value ? std::atol(value) : fallback;
+}
+
+class Samples {
+ public:
+	void Add(uint64_t value) { values_.push_back(value); }
+	void Merge(const Samples& other) {
+		values_.insert(values_.end(), other.values_.begin(), other.values_.end());
+	}
+	double Mean() const {
+		if (values_.empty())
+			return 0.0;
+		double sum = 0.0;
+		for (auto value : values_)
+			sum += value;
+		return sum / values_.size();
+	}
+	uint64_t Percentile(double p) {
+		if (values_.empty())
+			return 0;
+		std::sort(values_.begin(), values_.end());
+		std::size_t idx = (std::size_t)(p * (values_.size() - 1));
+		return values_[idx];
+	}
+	std::size_t Count() const { return values_.size(); }
+ private:
+	std::vector<uint64_t> values_;
+};
+
+// Common tail of throughput cases: "ns_per_event=... events_per_s=..."
+inline void PrintRate(uint64_t events, uint64_t elapsed_ns) {
+	std::printf(" ns_per_event=%.2f events_per_s=%.0f\n",
+			events ? (double)elapsed_ns / events : 0.0,
+			elapsed_ns ? events * 1e9 / elapsed_ns : 0.0);
+}
+
+struct ContextSwitches {
+	long voluntary;
+	long involuntary;
+};
+
+inline ContextSwitches GetContextSwitches() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	ContextSwitches result = { usage.ru_nvcsw, usage.ru_nivcsw };
+	return result;
+}
+
+} // namespace bench
+
+#endif // __BENCH_H__
@@ -0,0 +1,122 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Channel::Send from one or more producer threads, each with its own
+// channel, drained by one consumer thread the way a Writer drains its
+// shard. The listener only counts records, so this is the channel cost
+// without encoding or I/O.
+//
+// Producers spin on overflow (kOverflowSpin) so every case moves the same
+// records - drops are printed and should stay 0. ns_per_event is wall
+// time over all records of all producers.
+//
+// BENCH_EVENTS (default 10000000) records per producer,
+// BENCH_THREADS (default 4) most producers.
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "channel.h"
+#include "format.h"
+
+namespace {
+
+template<class TestChannel> class CountingListener
+	: public TestChannel::ChannelListener {
+ public:
+	explicit CountingListener(std::atomic<uint64_t>& received) : received_(received) {}
+	void OnMessageBucket(typename TestChannel::MessageBucket& bucket) override {
+		received_.fetch_add(bucket.size(), std::memory_order_relaxed);
+	}
+ private:
+	std::atomic<uint64_t>& received_;
+};
+
+template<std::size_t SIZE, std::size_t BUCKET> void RunCase(long threads, long events) {
+	using TestChannel = Channel<snoop::format::Record, SIZE, BUCKET>;
+	std::atomic<uint64_t> received(0);
+	std::vector<std::unique_ptr<TestChannel>> channels;
+	for (long t = 0; t < threads; t++) {
+		channels.emplace_back(new TestChannel);
+		channels.back()->SetOverflow({ snoop::kOverflowSpin, 1000000000ull, 0 });
+		channels.back()->RegisterListener(
+				std::unique_ptr<typename TestChannel::ChannelListener>(
+					new CountingListener<TestChannel>(received)));
+	}
+	std::atomic<long> running(threads);
+	const uint64_t begin = bench::NowNs();
+	std::thread consumer([&]() {
+		while (running.load(std::memory_order_acquire) > 0) {
+			std::size_t count = 0;
+			for (auto& channel : channels)
+				count += channel->TryReceive();
+			if (count == 0)
+				std::this_thread::yield();
+		}
+	});
+	std::vector<std::thread> producers;
+	for (long t = 0; t < threads; t++) {
+		producers.emplace_back([&, t]() {
+			TestChannel& channel = *channels[t];
+			snoop::format::Record record = { 0, 0x1000, snoop::format::kEnter, 0 };
+			for (long idx = 0; idx < events; idx++) {
+				record.timestamp = idx;
+				record.depth = idx & 7;
+				channel.Send(record);
+			}
+			running--;
+		});
+	}
+	for (auto& producer : producers)
+		producer.join();
+	consumer.join();
+	uint64_t drops = 0;
+	for (auto& channel : channels) {
+		channel->Finalize();
+		drops += channel->DropCount();
+	}
+	const uint64_t elapsed = bench::NowNs() - begin;
+	std::printf("send threads=%ld queue=%zu bucket=%zu received=%lu drops=%lu",
+			threads, SIZE, BUCKET, (unsigned long)received.load(), (unsigned long)drops);
+	bench::PrintRate(received.load(), elapsed);
+}
+
+template<std::size_t SIZE, std::size_t BUCKET> void RunThreads(long max_threads,
+		long events) {
+	for (long threads = 1; threads <= max_threads; threads *= 2)
+		RunCase<SIZE, BUCKET>(threads, events);
+}
+
+} // namespace
+
+int main() {
+	const long events = bench::EnvOr("BENCH_EVENTS", 10000000);
+	const long threads = bench::EnvOr("BENCH_THREADS", 4);
+	RunThreads<64, 1024>(threads, events);
+	RunThreads<2048, 256>(threads, events);
+	RunThreads<512, 1024>(threads, events);
+	RunThreads<128, 4096>(threads, events);
+	return 0;
+}
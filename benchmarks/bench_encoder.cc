@@ -0,0 +1,86 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Writer side cost of block encoding. Buckets follow the testapps/test_2
+// shape: a five call loop, enter and exit, rdtsc-like timestamps.
+//
+// BENCH_BUCKETS (default 20000) buckets per case.
+#include <vector>
+
+#include "bench.h"
+#include "constants.h"
+#include "encoder.h"
+
+namespace {
+
+// Odd functions live in a shared library, module ids are 1 and 2
+uintptr_t Address(uintptr_t fn, bool module) {
+	const uintptr_t offset = 0x1200 + fn * 0x42;
+	if (module)
+		return snoop::format::PackModuleAddress(1 + fn % 2, offset);
+	return (fn % 2 ? 0x7f3a9c5e1000 : 0x55d261ec2000) + offset;
+}
+
+std::vector<snoop::format::Record> MakeBucket(uint64_t& timestamp, bool module) {
+	std::vector<snoop::format::Record> records;
+	while (records.size() < constants::kDefaultChannelBucketSize) {
+		for (uintptr_t fn = 0; fn < 5; fn++) {
+			timestamp += 180 + (timestamp % 7);
+			records.push_back({ timestamp, Address(fn, module), snoop::format::kEnter, 1 });
+			timestamp += 60 + (timestamp % 5);
+			records.push_back({ timestamp, Address(fn, module), snoop::format::kExit, 1 });
+		}
+	}
+	records.resize(constants::kDefaultChannelBucketSize);
+	return records;
+}
+
+void RunCase(const char* name, snoop::format::Compression compression,
+		bool module, long buckets) {
+	uint64_t timestamp = 1000;
+	const std::vector<snoop::format::Record> records = MakeBucket(timestamp, module);
+	snoop::format::BlockEncoder encoder(compression);
+	uint64_t encoded = 0;
+	const uint64_t begin = bench::NowNs();
+	for (long idx = 0; idx < buckets; idx++) {
+		encoder.Encode(records.data(), records.size());
+		encoded += encoder.Size();
+	}
+	const uint64_t elapsed = bench::NowNs() - begin;
+	const double raw = (double)buckets * records.size() * sizeof(records[0]);
+	std::printf("%s ns_per_record=%.2f raw_mb_per_s=%.1f ratio=%.1f\n", name,
+			(double)elapsed / (buckets * records.size()),
+			(raw / 1048576.0) / (elapsed / 1e9), raw / encoded);
+}
+
+} // namespace
+
+int main() {
+	const long buckets = bench::EnvOr("BENCH_BUCKETS", 20000);
+	RunCase("delta", snoop::format::kCompressionDelta, false, buckets);
+	RunCase("zlib", snoop::format::kCompressionZlib, false, buckets);
+	// Same calls with SNOOP_ADDRESS=module
+	RunCase("delta_module", snoop::format::kCompressionDelta, true, buckets);
+	RunCase("zlib_module", snoop::format::kCompressionZlib, true, buckets);
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// BufferQueue alone: the producer fills a bucket record by record and
+// publishes it, the consumer walks the published ones.
+//
+// "inline" runs both sides on one thread, Process after every SIZE / 2
+// buckets. "spsc" runs the consumer on its own thread, the producer
+// spins on a full queue. Cases cover several queue and bucket sizes.
+//
+// BENCH_EVENTS (default 20000000) records per case.
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "bench.h"
+#include "bufferqueue.h"
+#include "format.h"
+
+namespace {
+
+template<std::size_t SIZE, std::size_t BUCKET> void RunCase(long events) {
+	using Bucket = FixedBuffer<snoop::format::Record, BUCKET>;
+	using Queue = BufferQueue<Bucket, SIZE>;
+	const long buckets = events / BUCKET;
+	const snoop::format::Record record = { 1, 0x1000, snoop::format::kEnter, 1 };
+
+	// Buckets stay untouched until used, as in Channel
+	std::unique_ptr<Queue> queue(new Queue);
+	uint64_t consumed = 0;
+	uint64_t begin = bench::NowNs();
+	for (long idx = 0; idx < buckets; idx++) {
+		Bucket* bucket = queue->Get();
+		bucket->clear();
+		while (!bucket->full())
+			bucket->push_back(record);
+		queue->Push();
+		if ((idx + 1) % (SIZE / 2) == 0)
+			consumed += queue->Process([](Bucket&) {}) * BUCKET;
+	}
+	consumed += queue->Process([](Bucket&) {}) * BUCKET;
+	std::printf("inline queue=%zu bucket=%zu", SIZE, BUCKET);
+	bench::PrintRate(consumed, bench::NowNs() - begin);
+
+	queue.reset(new Queue);
+	std::atomic<bool> done(false);
+	uint64_t received = 0;
+	begin = bench::NowNs();
+	std::thread consumer([&]() {
+		while (true) {
+			const bool last = done.load(std::memory_order_acquire);
+			const std::size_t count = queue->Process([&](Bucket& bucket) {
+				received += bucket.size();
+			});
+			if (last && count == 0)
+				break;
+			if (count == 0)
+				std::this_thread::yield();
+		}
+	});
+	for (long idx = 0; idx < buckets; idx++) {
+		Bucket* bucket;
+		while (!(bucket = queue->Get()))
+			std::this_thread::yield();
+		bucket->clear();
+		while (!bucket->full())
+			bucket->push_back(record);
+		queue->Push();
+	}
+	done.store(true, std::memory_order_release);
+	consumer.join();
+	std::printf("spsc queue=%zu bucket=%zu", SIZE, BUCKET);
+	bench::PrintRate(received, bench::NowNs() - begin);
+}
+
+} // namespace
+
+int main() {
+	const long events = bench::EnvOr("BENCH_EVENTS", 20000000);
+	RunCase<64, 1024>(events);
+	RunCase<512, 256>(events);
+	RunCase<512, 1024>(events);
+	RunCase<512, 4096>(events);
+	RunCase<2048, 1024>(events);
+	return 0;
+}
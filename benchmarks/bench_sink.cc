@@ -0,0 +1,101 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Writer side throughput of trace sinks: a stream of bucket sized blocks
+// written through StreamSink (ofstream), MappedSink (mmap windows) and
+// AsyncSink (io_uring and thread pool, O_DIRECT).
+//
+// BENCH_MB (default 512) per sink, files go to BENCH_DIR (default .) and
+// are removed afterwards.
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "asyncsink.h"
+#include "constants.h"
+#include "format.h"
+#include "sink.h"
+
+namespace {
+
+template<class MakeSink> void RunCase(const char* name, const std::string& path,
+		uint64_t total, MakeSink make_sink) {
+	const std::size_t block_size = sizeof(snoop::format::BlockHeader) +
+		constants::kDefaultChannelBucketSize * sizeof(snoop::format::Record);
+	std::vector<char> block(block_size);
+	for (std::size_t idx = 0; idx < block.size(); idx++)
+		block[idx] = (char)idx;
+	unlink(path.c_str());
+
+	bench::Samples latency;
+	const uint64_t begin = bench::NowNs();
+	{
+		std::unique_ptr<snoop::Sink> sink = make_sink(path.c_str());
+		for (uint64_t written = 0; written < total; written += block_size) {
+			const uint64_t before = bench::NowNs();
+			sink->Write(block.data(), block.size());
+			latency.Add(bench::NowNs() - before);
+		}
+	}
+	const uint64_t elapsed = bench::NowNs() - begin;
+	std::printf("%s mb=%lu mb_per_s=%.1f write_mean_ns=%.0f write_p99_ns=%lu "
+			"write_max_ns=%lu\n", name, (unsigned long)(total >> 20),
+			(total / 1048576.0) / (elapsed / 1e9), latency.Mean(),
+			(unsigned long)latency.Percentile(0.99),
+			(unsigned long)latency.Percentile(1.0));
+	unlink(path.c_str());
+}
+
+} // namespace
+
+int main() {
+	const uint64_t total = (uint64_t)bench::EnvOr("BENCH_MB", 512) << 20;
+	const char* dir = getenv("BENCH_DIR");
+	const std::string path = std::string(dir ? dir : ".") + "/bench_sink.snoop";
+	RunCase("stream", path, total, [](const char* name) {
+		return std::unique_ptr<snoop::Sink>(new snoop::StreamSink(name));
+	});
+	RunCase("mmap", path, total, [](const char* name) {
+		return std::unique_ptr<snoop::Sink>(
+				new snoop::MappedSink(name, constants::kMappedWindowSize));
+	});
+	RunCase("async_uring", path, total, [](const char* name) {
+		std::unique_ptr<snoop::IoQueue> queue =
+			snoop::UringQueue::Create(constants::kAsyncBufferCount);
+		if (!queue)
+			return std::unique_ptr<snoop::Sink>(new snoop::StreamSink(name));
+		return std::unique_ptr<snoop::Sink>(new snoop::AsyncSink(name,
+					std::make_shared<snoop::AsyncIo>(std::move(queue)), true));
+	});
+	RunCase("async_threads", path, total, [](const char* name) {
+		std::unique_ptr<snoop::IoQueue> queue(
+				new snoop::ThreadPoolQueue(constants::kAsyncPoolThreads));
+		return std::unique_ptr<snoop::Sink>(new snoop::AsyncSink(name,
+					std::make_shared<snoop::AsyncIo>(std::move(queue)), true));
+	});
+	return 0;
+}
@@ -0,0 +1,128 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// libsnoop end to end, linked against the library:
+//
+//   "hook"     __cyg_profile_func_enter/exit pairs, as instrumented code
+//              calls them, through the thread_local observer
+//   "observer" ThreadObserver::Enter/Exit without the hook's reentry guard
+//   "handler"  StreamingBucketHandler encoding and writing full buckets
+//
+// hook and observer run 1..BENCH_THREADS producer threads. Records go
+// through the real writers, so SNOOP_* variables apply and trace files are
+// written to the working directory - run it from a scratch directory.
+// Records lost when the writers fall behind are reported per channel at
+// exit, SNOOP_OVERFLOW=spin keeps all of them.
+//
+// BENCH_EVENTS (default 2000000) records per thread, BENCH_THREADS
+// (default 4), BENCH_BUCKETS (default 5000) buckets per handler case.
+#include <unistd.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "encoder.h"
+#include "sink.h"
+#include "snoop.h"
+
+extern "C" {
+void __cyg_profile_func_enter(void* func, void* caller);
+void __cyg_profile_func_exit(void* func, void* caller);
+}
+
+namespace {
+
+void Leaf() {}
+
+template<class Body> void RunThreads(const char* name, long threads, long events,
+		Body body) {
+	const uint64_t begin = bench::NowNs();
+	std::vector<std::thread> producers;
+	for (long t = 0; t < threads; t++)
+		producers.emplace_back([&]() { body(events / 2); });
+	for (auto& producer : producers)
+		producer.join();
+	std::printf("%s threads=%ld", name, threads);
+	bench::PrintRate((uint64_t)threads * (events / 2) * 2, bench::NowNs() - begin);
+}
+
+void RunHandler(const char* name, snoop::format::Compression compression,
+		bool fold_repeats, long buckets) {
+	const char* file = "bench_handler.snoop";
+	snoop::format::FileHeader header =
+		snoop::format::MakeFileHeader(getpid(), getpid(), snoop::clock::Calibrate());
+	std::unique_ptr<snoop::MessageBucket> bucket(new snoop::MessageBucket);
+	bucket->clear();
+	uint64_t timestamp = 1000;
+	for (uint32_t idx = 0; !bucket->full(); idx++) {
+		// Five call loop, see bench_encoder
+		const uintptr_t address = 0x55d261ec2000 + (idx / 2 % 5) * 0x42;
+		timestamp += 120 + timestamp % 7;
+		bucket->push_back({ timestamp, address,
+				idx % 2 ? snoop::format::kExit : snoop::format::kEnter, 1 });
+	}
+	const uint64_t begin = bench::NowNs();
+	{
+		snoop::StreamingBucketHandler handler(
+				std::unique_ptr<snoop::Sink>(new snoop::StreamSink(file)), header,
+				compression, snoop::kAddressAbsolute, fold_repeats);
+		for (long idx = 0; idx < buckets; idx++)
+			handler.OnMessageBucket(*bucket);
+	}
+	const uint64_t elapsed = bench::NowNs() - begin;
+	unlink(file);
+	std::printf("handler %s", name);
+	bench::PrintRate((uint64_t)buckets * bucket->size(), elapsed);
+}
+
+} // namespace
+
+int main() {
+	const long events = bench::EnvOr("BENCH_EVENTS", 2000000);
+	const long max_threads = bench::EnvOr("BENCH_THREADS", 4);
+	const long buckets = bench::EnvOr("BENCH_BUCKETS", 5000);
+	for (long threads = 1; threads <= max_threads; threads *= 2) {
+		RunThreads("hook", threads, events, [](long pairs) {
+			for (long idx = 0; idx < pairs; idx++) {
+				__cyg_profile_func_enter((void*)&Leaf, nullptr);
+				__cyg_profile_func_exit((void*)&Leaf, nullptr);
+			}
+		});
+	}
+	for (long threads = 1; threads <= max_threads; threads *= 2) {
+		RunThreads("observer", threads, events, [](long pairs) {
+			snoop::ThreadObserver observer;
+			for (long idx = 0; idx < pairs; idx++) {
+				observer.Enter((uintptr_t)&Leaf);
+				observer.Exit((uintptr_t)&Leaf);
+			}
+		});
+	}
+	RunHandler("none", snoop::format::kCompressionNone, false, buckets);
+	RunHandler("delta", snoop::format::kCompressionDelta, false, buckets);
+	RunHandler("zlib", snoop::format::kCompressionZlib, false, buckets);
+	RunHandler("delta_fold", snoop::format::kCompressionDelta, true, buckets);
+	return 0;
+}
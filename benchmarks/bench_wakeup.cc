@@ -0,0 +1,141 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Producer side cost of waking the processing thread with many hot threads.
+//
+// "mutex" replays the original scheme: lock + condition_variable::notify_one
+// per sealed bucket, with the consumer holding the same mutex while it drains.
+// "wakeup" is snoop::WakeupEvent.
+//
+// BENCH_THREADS (default 32) producers each seal BENCH_SIGNALS buckets.
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+#include "bench.h"
+#include "wakeup.h"
+
+namespace {
+
+// Stand-in for filling a bucket between two signals
+void Work(long iterations) {
+	for (volatile long i = 0; i < iterations; i++) {}
+}
+
+// Stand-in for draining channels
+void Drain() {
+	Work(2000);
+}
+
+class MutexNotifier {
+ public:
+	void Signal() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		condition_.notify_one();
+	}
+	template<class Done> uint64_t Run(Done done) {
+		uint64_t wakeups = 0;
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (!done()) {
+			condition_.wait_for(lock, std::chrono::milliseconds(1));
+			Drain();
+			wakeups++;
+		}
+		return wakeups;
+	}
+ private:
+	std::mutex mutex_;
+	std::condition_variable condition_;
+};
+
+class WakeupNotifier {
+ public:
+	void Signal() {
+		event_.Signal();
+	}
+	template<class Done> uint64_t Run(Done done) {
+		uint64_t wakeups = 0;
+		while (!done()) {
+			Drain();
+			event_.Wait(1000000);
+			wakeups++;
+		}
+		return wakeups;
+	}
+ private:
+	snoop::WakeupEvent event_;
+};
+
+template<class Notifier> void RunCase(const char* name, long threads,
+		long signals, long work) {
+	Notifier notifier;
+	std::atomic<long> running(threads);
+	std::vector<bench::Samples> samples(threads);
+	std::vector<std::thread> producers;
+
+	const bench::ContextSwitches cs_begin = bench::GetContextSwitches();
+	const uint64_t begin = bench::NowNs();
+	uint64_t wakeups = 0;
+	std::thread consumer([&]() {
+		wakeups = notifier.Run([&]() { return running.load() == 0; });
+	});
+	for (long t = 0; t < threads; t++) {
+		producers.emplace_back([&, t]() {
+			for (long s = 0; s < signals; s++) {
+				Work(work);
+				const uint64_t before = bench::NowNs();
+				notifier.Signal();
+				samples[t].Add(bench::NowNs() - before);
+			}
+			running--;
+		});
+	}
+	for (auto& producer : producers)
+		producer.join();
+	consumer.join();
+	const uint64_t elapsed = bench::NowNs() - begin;
+	const bench::ContextSwitches cs_end = bench::GetContextSwitches();
+
+	bench::Samples all;
+	for (auto& sample : samples)
+		all.Merge(sample);
+	std::printf("%s threads=%ld signals=%zu signal_mean_ns=%.1f signal_p99_ns=%lu "
+			"signal_max_ns=%lu wakeups=%lu wall_ms=%.1f vcsw=%ld ivcsw=%ld\n",
+			name, threads, all.Count(), all.Mean(),
+			(unsigned long)all.Percentile(0.99), (unsigned long)all.Percentile(1.0),
+			(unsigned long)wakeups, elapsed / 1e6,
+			cs_end.voluntary - cs_begin.voluntary,
+			cs_end.involuntary - cs_begin.involuntary);
+}
+
+} // namespace
+
+int main() {
+	const long threads = bench::EnvOr("BENCH_THREADS", 32);
+	const long signals = bench::EnvOr("BENCH_SIGNALS", 2000);
+	const long work = bench::EnvOr("BENCH_WORK", 20000);
+	RunCase<MutexNotifier>("mutex", threads, signals, work);
+	RunCase<WakeupNotifier>("wakeup", threads, signals, work);
+	return 0;
+}
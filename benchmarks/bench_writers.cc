@@ -0,0 +1,113 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Writer shards draining channels whose listener blocks like a sink
+// waiting for the disk (BENCH_WRITE_US per bucket, default 200):
+//
+//   "balanced" channels spread over the writers round robin
+//   "skewed"   all channels on writer 0 - the others only get work by
+//              stealing while writer 0 is busy writing
+//
+// BENCH_CHANNELS (default 8) channels are filled with BENCH_BUCKETS
+// (default 256) buckets each before the writers start, for 1..BENCH_WRITERS
+// (default 4) writers. Throughput should grow with the writer count in
+// both cases, as it does with SNOOP_WRITERS for blocking sinks.
+#include <time.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "snoop.h"
+
+namespace {
+
+class BlockingListener : public snoop::ChannelListener {
+ public:
+	BlockingListener(std::atomic<uint64_t>& received, long write_us)
+		: received_(received), write_us_(write_us) {}
+	void OnMessageBucket(snoop::MessageBucket& bucket) override {
+		const struct timespec delay = { 0, write_us_ * 1000 };
+		nanosleep(&delay, nullptr);
+		received_.fetch_add(bucket.size(), std::memory_order_relaxed);
+	}
+ private:
+	std::atomic<uint64_t>& received_;
+	long write_us_;
+};
+
+void RunCase(const char* name, bool skewed, long writer_count, long channels,
+		long buckets, long write_us) {
+	std::atomic<uint64_t> received(0);
+	std::vector<std::unique_ptr<snoop::Writer>> writers;
+	for (long idx = 0; idx < writer_count; idx++)
+		writers.emplace_back(new snoop::Writer(idx));
+	const snoop::format::Record record = { 1, 0x1000, snoop::format::kEnter, 1 };
+	const uint64_t total = (uint64_t)channels * buckets * snoop::MessageBucket::capacity();
+	for (long idx = 0; idx < channels; idx++) {
+		std::shared_ptr<snoop::Channel> channel(new snoop::Channel());
+		channel->RegisterListener(std::unique_ptr<snoop::ChannelListener>(
+					new BlockingListener(received, write_us)));
+		for (uint64_t sent = 0; sent < buckets * snoop::MessageBucket::capacity(); sent++)
+			channel->Send(record);
+		writers[skewed ? 0 : idx % writer_count]->AddChannel(channel);
+	}
+	const uint64_t begin = bench::NowNs();
+	std::vector<std::thread> threads;
+	for (auto& writer : writers) {
+		snoop::Writer* self = writer.get();
+		threads.emplace_back([&, self]() {
+			// ThreadManager::process without the waits
+			while (received.load(std::memory_order_relaxed) < total) {
+				std::size_t count = self->Receive();
+				for (auto& victim : writers) {
+					if (victim.get() != self)
+						count += self->Steal(*victim);
+				}
+				if (count == 0)
+					std::this_thread::yield();
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	std::printf("%s writers=%ld channels=%ld", name, writer_count, channels);
+	bench::PrintRate(total, bench::NowNs() - begin);
+}
+
+} // namespace
+
+int main() {
+	const long channels = bench::EnvOr("BENCH_CHANNELS", 8);
+	// Below the queue size, the producer never waits
+	const long buckets = bench::EnvOr("BENCH_BUCKETS", 256);
+	const long max_writers = bench::EnvOr("BENCH_WRITERS", 4);
+	const long write_us = bench::EnvOr("BENCH_WRITE_US", 200);
+	for (long writers = 1; writers <= max_writers; writers *= 2)
+		RunCase("balanced", false, writers, channels, buckets, write_us);
+	for (long writers = 1; writers <= max_writers; writers *= 2)
+		RunCase("skewed", true, writers, channels, buckets, write_us);
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// snoop-collector [socket] [output directory]
+//
+// Serves processes traced with SNOOP_MODE=collector. The socket defaults to
+// SNOOP_COLLECTOR or constants::kCollectorSocket in XDG_RUNTIME_DIR, traces
+// and memory maps are written to the output directory (default: working
+// directory). Stops on SIGINT or SIGTERM after draining every ring.
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+
+#include "collector.h"
+#include "log.h"
+#include "sharedring.h"
+
+namespace {
+
+snoop::Collector* g_collector = nullptr;
+
+void OnSignal(int) {
+	if (g_collector)
+		g_collector->Stop();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const std::string path = argc > 1 ? argv[1] : snoop::CollectorSocketFromEnv();
+	if (argc > 2 && chdir(argv[2]) != 0) {
+		LOG(ERROR, "Failed to enter output directory dir=%s: %s", argv[2],
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
+	snoop::Collector collector;
+	if (!collector.Listen(path))
+		return EXIT_FAILURE;
+	g_collector = &collector;
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = &OnSignal;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	collector.Run();
+	g_collector = nullptr;
+	return EXIT_SUCCESS;
+}
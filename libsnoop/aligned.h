@@ -0,0 +1,52 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __ALIGNED_H__
+#define __ALIGNED_H__
+
+#include <stdlib.h>
+
+#include <cstddef>
+#include <new>
+
+#include "constants.h"
+
+/**
+ * Base of types holding alignas(kCacheLineSize) members that are created
+ * with new. Plain operator new only guarantees alignof(max_align_t) before
+ * C++17, so the members would share cache lines whenever the allocation
+ * happens to be misaligned.
+ */
+struct CacheAligned {
+	static void* operator new(std::size_t size) {
+		void* memory = nullptr;
+		if (posix_memalign(&memory, constants::kCacheLineSize, size) != 0)
+			throw std::bad_alloc();
+		return memory;
+	}
+	static void operator delete(void* memory) {
+		free(memory);
+	}
+};
+
+#endif // __ALIGNED_H__
@@ -0,0 +1,494 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// io_uring
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+// open, pwrite, mmap
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+// getenv, posix_memalign
+#include <stdlib.h>
+// strcmp, strerror
+#include <string.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "asyncsink.h"
+#include "constants.h"
+#include "log.h"
+
+namespace {
+
+template<class T> T* RingField(void* ring, uint32_t offset) {
+	return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+int IoUringSetup(unsigned entries, struct io_uring_params* params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int IoUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+		unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			flags, nullptr, 0);
+}
+
+} // namespace
+
+namespace snoop {
+
+UringQueue::UringQueue()
+	: ring_fd_(-1), sq_ring_(MAP_FAILED), sq_ring_size_(0),
+	  cq_ring_(MAP_FAILED), cq_ring_size_(0), sqes_(MAP_FAILED), sqes_size_(0) {
+}
+
+//static
+std::unique_ptr<IoQueue> UringQueue::Create(unsigned entries) {
+	std::unique_ptr<UringQueue> queue(new UringQueue());
+	if (!queue->setup(entries))
+		return nullptr;
+	return queue;
+}
+
+bool UringQueue::setup(unsigned entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring_fd_ = IoUringSetup(entries, &params);
+	if (ring_fd_ < 0) {
+		LOG(WARNING, "io_uring_setup failed err=%s", strerror(errno));
+		return false;
+	}
+	sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_ring_size_ = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_mmap)
+		sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+	sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+	if (sq_ring_ == MAP_FAILED)
+		return false;
+	if (single_mmap) {
+		cq_ring_ = sq_ring_;
+	} else {
+		cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+		if (cq_ring_ == MAP_FAILED)
+			return false;
+	}
+	sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+	if (sqes_ == MAP_FAILED)
+		return false;
+	sq_head_ = RingField<unsigned>(sq_ring_, params.sq_off.head);
+	sq_tail_ = RingField<unsigned>(sq_ring_, params.sq_off.tail);
+	sq_mask_ = RingField<unsigned>(sq_ring_, params.sq_off.ring_mask);
+	sq_array_ = RingField<unsigned>(sq_ring_, params.sq_off.array);
+	cq_head_ = RingField<unsigned>(cq_ring_, params.cq_off.head);
+	cq_tail_ = RingField<unsigned>(cq_ring_, params.cq_off.tail);
+	cq_mask_ = RingField<unsigned>(cq_ring_, params.cq_off.ring_mask);
+	cqes_ = RingField<void>(cq_ring_, params.cq_off.cqes);
+	LOG(INFO, "io_uring ready entries=%u", params.sq_entries);
+	return true;
+}
+
+UringQueue::~UringQueue() {
+	if (sqes_ != MAP_FAILED)
+		munmap(sqes_, sqes_size_);
+	if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+		munmap(cq_ring_, cq_ring_size_);
+	if (sq_ring_ != MAP_FAILED)
+		munmap(sq_ring_, sq_ring_size_);
+	if (ring_fd_ >= 0)
+		close(ring_fd_);
+}
+
+bool UringQueue::Submit(int fd, const void* data, std::size_t size,
+		uint64_t offset, uint64_t cookie) {
+	// Single submitter - tail is ours, kernel only reads it
+	const unsigned tail = *sq_tail_;
+	const unsigned idx = tail & *sq_mask_;
+	struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_) + idx;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t>(data);
+	sqe->len = size;
+	sqe->off = offset;
+	sqe->user_data = cookie;
+	sq_array_[idx] = idx;
+	__atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+	int ret;
+	while ((ret = IoUringEnter(ring_fd_, 1, 0, 0)) < 0 && errno == EINTR) {}
+	if (ret == 1)
+		return true;
+	// The kernel consumes SQEs from head - taken means it will complete
+	if (__atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) != tail) {
+		LOG(WARNING, "io_uring_enter ret=%d, entry was submitted", ret);
+		return true;
+	}
+	// Not taken, retract it so a later enter does not submit a write the
+	// caller treats as failed
+	__atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+	LOG(ERROR, "io_uring_enter submit failed ret=%d err=%s", ret,
+			ret < 0 ? strerror(errno) : "none");
+	return false;
+}
+
+void UringQueue::Reap(std::vector<Completion>& completions, bool wait) {
+	unsigned head = *cq_head_;
+	if (wait && head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+		while (IoUringEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+				errno == EINTR) {}
+	}
+	const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		const struct io_uring_cqe* cqe =
+			static_cast<struct io_uring_cqe*>(cqes_) + (head & *cq_mask_);
+		completions.push_back({ cqe->user_data, cqe->res });
+	}
+	__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+ThreadPoolQueue::ThreadPoolQueue(std::size_t threads) : exit_(false) {
+	for (std::size_t idx = 0; idx < threads; idx++)
+		threads_.emplace_back([this]() { run(); });
+}
+
+ThreadPoolQueue::~ThreadPoolQueue() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		exit_ = true;
+	}
+	job_condition_.notify_all();
+	for (auto& thread : threads_)
+		thread.join();
+}
+
+bool ThreadPoolQueue::Submit(int fd, const void* data, std::size_t size,
+		uint64_t offset, uint64_t cookie) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		jobs_.push_back({ fd, data, size, offset, cookie });
+	}
+	job_condition_.notify_one();
+	return true;
+}
+
+void ThreadPoolQueue::Reap(std::vector<Completion>& completions, bool wait) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (wait) {
+		completion_condition_.wait(lock, [this]() {
+			return !completions_.empty();
+		});
+	}
+	completions.insert(completions.end(), completions_.begin(), completions_.end());
+	completions_.clear();
+}
+
+void ThreadPoolQueue::run() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		job_condition_.wait(lock, [this]() { return exit_ || !jobs_.empty(); });
+		if (jobs_.empty())
+			return;
+		const Job job = jobs_.front();
+		jobs_.pop_front();
+		lock.unlock();
+		std::size_t done = 0;
+		long result = 0;
+		while (done < job.size) {
+			const ssize_t ret = pwrite(job.fd,
+					static_cast<const char*>(job.data) + done, job.size - done,
+					job.offset + done);
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				result = -errno;
+				break;
+			}
+			done += ret;
+		}
+		if (result == 0)
+			result = done;
+		lock.lock();
+		completions_.push_back({ job.cookie, result });
+		completion_condition_.notify_one();
+	}
+}
+
+AsyncIo::AsyncIo(std::unique_ptr<IoQueue> queue)
+	: queue_(std::move(queue)), allocated_(0), sinks_(0), in_flight_(0) {
+}
+
+AsyncIo::~AsyncIo() {
+	// Sinks hold a reference and drain on destruction - nothing in flight
+	for (Buffer* buffer : free_) {
+		free(buffer->data);
+		delete buffer;
+	}
+}
+
+//static
+std::shared_ptr<AsyncIo> AsyncIo::Shared() {
+	static std::mutex mutex;
+	static std::shared_ptr<AsyncIo> instance;
+	std::lock_guard<std::mutex> lock(mutex);
+	if (instance)
+		return instance;
+	const char* backend = getenv("SNOOP_ASYNC_BACKEND");
+	std::unique_ptr<IoQueue> queue;
+	if (!backend || strcmp(backend, "uring") == 0)
+		queue = UringQueue::Create(constants::kAsyncBufferCount);
+	if (!queue) {
+		LOG(INFO, "Using thread pool async backend");
+		queue.reset(new ThreadPoolQueue(constants::kAsyncPoolThreads));
+	}
+	instance = std::make_shared<AsyncIo>(std::move(queue));
+	return instance;
+}
+
+void AsyncIo::AddSink() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	sinks_++;
+}
+
+void AsyncIo::RemoveSink() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	sinks_--;
+	// Give back buffers above the new limit
+	while (!free_.empty() && allocated_ > sinks_ + constants::kAsyncBufferCount) {
+		free(free_.back()->data);
+		delete free_.back();
+		free_.pop_back();
+		allocated_--;
+	}
+}
+
+AsyncIo::Buffer* AsyncIo::Acquire() {
+	while (true) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!free_.empty()) {
+				Buffer* buffer = free_.back();
+				free_.pop_back();
+				buffer->size = 0;
+				return buffer;
+			}
+			if (allocated_ < sinks_ + constants::kAsyncBufferCount) {
+				void* data = nullptr;
+				if (posix_memalign(&data, constants::kDirectIoAlignment,
+							constants::kAsyncBufferSize) != 0) {
+					LOG(ERROR, "Failed to allocate async sink buffer");
+					return nullptr;
+				}
+				allocated_++;
+				return new Buffer{ static_cast<char*>(data), 0, 0, nullptr };
+			}
+		}
+		// Pool exhausted - every other buffer is in flight or partly filled
+		// by another sink, the caller holds none, so something is in flight
+		std::lock_guard<std::mutex> lock(reap_mutex_);
+		{
+			std::lock_guard<std::mutex> pool_lock(mutex_);
+			if (!free_.empty())
+				continue;
+		}
+		reap_locked(true);
+	}
+}
+
+void AsyncIo::Release(Buffer* buffer) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	free_.push_back(buffer);
+}
+
+bool AsyncIo::Submit(int fd, Buffer* buffer) {
+	{
+		// Bounded by the queue depth, completions can not overflow the ring
+		std::lock_guard<std::mutex> lock(reap_mutex_);
+		while (in_flight_ >= constants::kAsyncBufferCount)
+			reap_locked(true);
+		in_flight_++;
+	}
+	bool submitted;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		submitted = queue_->Submit(fd, buffer->data, buffer->size, buffer->offset,
+				reinterpret_cast<uint64_t>(buffer));
+	}
+	if (!submitted) {
+		std::lock_guard<std::mutex> lock(reap_mutex_);
+		in_flight_--;
+	}
+	return submitted;
+}
+
+void AsyncIo::Reap() {
+	std::unique_lock<std::mutex> lock(reap_mutex_, std::try_to_lock);
+	if (lock.owns_lock())
+		reap_locked(false);
+}
+
+void AsyncIo::Drain(AsyncSink* owner) {
+	std::lock_guard<std::mutex> lock(reap_mutex_);
+	while (owner->in_flight_ > 0)
+		reap_locked(true);
+}
+
+void AsyncIo::reap_locked(bool wait) {
+	completions_.clear();
+	queue_->Reap(completions_, wait);
+	for (auto& completion : completions_) {
+		Buffer* buffer = reinterpret_cast<Buffer*>(completion.cookie);
+		AsyncSink* owner = buffer->owner;
+		if (completion.result != (long)buffer->size) {
+			LOG(ERROR, "Async write failed offset=%lu result=%ld",
+					(unsigned long)buffer->offset, completion.result);
+			owner->failed_ = true;
+		}
+		in_flight_--;
+		Release(buffer);
+		owner->in_flight_--;
+	}
+}
+
+AsyncSink::AsyncSink(const char* name, std::shared_ptr<AsyncIo> io,
+		bool direct)
+	: fd_(-1), direct_(direct), io_(std::move(io)), current_(nullptr),
+	  offset_(0), size_(0), in_flight_(0), failed_(false) {
+	io_->AddSink();
+	const int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+	if (direct_) {
+		// Not every filesystem supports O_DIRECT (tmpfs)
+		fd_ = open(name, flags | O_DIRECT, 0644);
+		if (fd_ < 0) {
+			LOG(WARNING, "O_DIRECT unavailable name=%s err=%s", name, strerror(errno));
+			direct_ = false;
+		}
+	}
+	if (fd_ < 0)
+		fd_ = open(name, flags, 0644);
+	if (fd_ < 0) {
+		LOG(ERROR, "Failed to open async sink name=%s err=%s", name, strerror(errno));
+		failed_ = true;
+		return;
+	}
+	struct stat st;
+	if (fstat(fd_, &st) == 0)
+		size_ = st.st_size;
+	// Appending to existing file - restart at aligned offset with its tail
+	offset_ = size_ / constants::kDirectIoAlignment * constants::kDirectIoAlignment;
+	if (size_ != offset_) {
+		const int read_fd = open(name, O_RDONLY | O_CLOEXEC);
+		current_ = io_->Acquire();
+		if (!current_ || read_fd < 0 || pread(read_fd, current_->data,
+					size_ - offset_, offset_) != (ssize_t)(size_ - offset_)) {
+			LOG(ERROR, "Failed to read tail of async sink name=%s", name);
+			failed_ = true;
+		}
+		if (current_)
+			current_->size = size_ - offset_;
+		if (read_fd >= 0)
+			close(read_fd);
+	}
+	LOG(INFO, "AsyncSink name=%s direct=%d", name, direct_);
+}
+
+AsyncSink::~AsyncSink() {
+	if (current_ && current_->size > 0 && !failed_) {
+		// O_DIRECT needs aligned length - pad, truncated below
+		const std::size_t padded = (current_->size + constants::kDirectIoAlignment - 1)
+			/ constants::kDirectIoAlignment * constants::kDirectIoAlignment;
+		memset(current_->data + current_->size, 0, padded - current_->size);
+		current_->size = padded;
+		submit_current();
+	}
+	if (current_)
+		io_->Release(current_);
+	io_->Drain(this);
+	if (fd_ >= 0) {
+		if (ftruncate(fd_, size_) != 0)
+			LOG(ERROR, "Failed to truncate async sink err=%s", strerror(errno));
+		close(fd_);
+	}
+	io_->RemoveSink();
+}
+
+bool AsyncSink::submit_current() {
+	AsyncIo::Buffer* buffer = current_;
+	current_ = nullptr;
+	buffer->offset = offset_;
+	buffer->owner = this;
+	in_flight_++;
+	offset_ += buffer->size;
+	if (!io_->Submit(fd_, buffer)) {
+		in_flight_--;
+		io_->Release(buffer);
+		failed_ = true;
+		return false;
+	}
+	return true;
+}
+
+bool AsyncSink::Write(const void* data, std::size_t size) {
+	if (failed_)
+		return false;
+	if (in_flight_ > 0)
+		io_->Reap();
+	const char* src = static_cast<const char*>(data);
+	while (size > 0) {
+		if (!current_ && !(current_ = io_->Acquire())) {
+			failed_ = true;
+			return false;
+		}
+		const std::size_t chunk =
+			std::min(size, constants::kAsyncBufferSize - current_->size);
+		memcpy(current_->data + current_->size, src, chunk);
+		current_->size += chunk;
+		size_ += chunk;
+		src += chunk;
+		size -= chunk;
+		if (current_->size == constants::kAsyncBufferSize && !submit_current())
+			return false;
+	}
+	return true;
+}
+
+uint64_t AsyncSink::Size() const {
+	return size_;
+}
+
+std::unique_ptr<Sink> MakeAsyncSink(const char* name) {
+	const char* direct_env = getenv("SNOOP_ASYNC_DIRECT");
+	const bool direct = !direct_env || strcmp(direct_env, "0") != 0;
+	return std::unique_ptr<Sink>(new AsyncSink(name, AsyncIo::Shared(), direct));
+}
+
+} // namespace snoop
@@ -0,0 +1,203 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __ASYNCSINK_H__
+#define __ASYNCSINK_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sink.h"
+
+namespace snoop {
+
+// Asynchronous positional writes. Completions are identified by cookie.
+class IoQueue {
+ public:
+	struct Completion {
+		uint64_t cookie;
+		// Bytes written or -errno
+		long result;
+	};
+	virtual ~IoQueue() {};
+	virtual bool Submit(int fd, const void* data, std::size_t size,
+			uint64_t offset, uint64_t cookie) = 0;
+	// Appends finished writes, blocks for at least one if wait is set
+	virtual void Reap(std::vector<Completion>& completions, bool wait) = 0;
+};
+
+// Raw io_uring (no liburing dependency), IORING_OP_WRITE - Linux 5.6+
+class UringQueue : public IoQueue {
+ public:
+	static std::unique_ptr<IoQueue> Create(unsigned entries);
+	~UringQueue();
+	// IoQueue
+	bool Submit(int fd, const void* data, std::size_t size,
+			uint64_t offset, uint64_t cookie) override;
+	void Reap(std::vector<Completion>& completions, bool wait) override;
+ private:
+	UringQueue();
+	bool setup(unsigned entries);
+ private:
+	int ring_fd_;
+	void* sq_ring_;
+	std::size_t sq_ring_size_;
+	void* cq_ring_;
+	std::size_t cq_ring_size_;
+	void* sqes_;
+	std::size_t sqes_size_;
+	unsigned* sq_head_;
+	unsigned* sq_tail_;
+	unsigned* sq_mask_;
+	unsigned* sq_array_;
+	unsigned* cq_head_;
+	unsigned* cq_tail_;
+	unsigned* cq_mask_;
+	void* cqes_;
+};
+
+// Fallback when io_uring is missing or disabled: pwrite on helper threads
+class ThreadPoolQueue : public IoQueue {
+ public:
+	explicit ThreadPoolQueue(std::size_t threads);
+	~ThreadPoolQueue();
+	// IoQueue
+	bool Submit(int fd, const void* data, std::size_t size,
+			uint64_t offset, uint64_t cookie) override;
+	void Reap(std::vector<Completion>& completions, bool wait) override;
+ private:
+	struct Job {
+		int fd;
+		const void* data;
+		std::size_t size;
+		uint64_t offset;
+		uint64_t cookie;
+	};
+	void run();
+ private:
+	std::mutex mutex_;
+	std::condition_variable job_condition_;
+	std::condition_variable completion_condition_;
+	std::deque<Job> jobs_;
+	std::vector<Completion> completions_;
+	std::vector<std::thread> threads_;
+	bool exit_;
+};
+
+class AsyncSink;
+
+/**
+ * One io queue and one pool of aligned staging buffers shared by every
+ * AsyncSink of the process. A channel is written by whichever writer
+ * drains or steals it, so the pool is not tied to a writer thread - it is
+ * locked once per staged buffer, not per record. Submissions carry the
+ * buffer, which knows its file and owning sink.
+ *
+ * Each live sink may hold one partly filled buffer and at most
+ * kAsyncBufferCount buffers are in flight, so memory is bounded by
+ * (sinks + kAsyncBufferCount) buffers instead of growing per trace file.
+ */
+class AsyncIo {
+ public:
+	struct Buffer {
+		char* data;
+		std::size_t size;
+		uint64_t offset;
+		AsyncSink* owner;
+	};
+	explicit AsyncIo(std::unique_ptr<IoQueue> queue);
+	~AsyncIo();
+	// Process wide instance, SNOOP_ASYNC_BACKEND picks the queue
+	static std::shared_ptr<AsyncIo> Shared();
+	// Interface
+	void AddSink();
+	void RemoveSink();
+	// Empty buffer, reaps when the pool is exhausted
+	Buffer* Acquire();
+	void Release(Buffer* buffer);
+	bool Submit(int fd, Buffer* buffer);
+	// Completes finished writes without blocking
+	void Reap();
+	// Blocks until owner has no write in flight
+	void Drain(AsyncSink* owner);
+ private:
+	// reap_mutex_ held
+	void reap_locked(bool wait);
+ private:
+	std::unique_ptr<IoQueue> queue_;
+	// Pool and submission side
+	std::mutex mutex_;
+	std::vector<Buffer*> free_;
+	std::size_t allocated_;
+	std::size_t sinks_;
+	// Completion side, single consumer of the queue
+	std::mutex reap_mutex_;
+	std::vector<IoQueue::Completion> completions_;
+	std::size_t in_flight_;
+};
+
+/**
+ * Sink that never blocks the writer on storage latency while buffers are
+ * available. Data is staged in aligned buffers (O_DIRECT capable) from the
+ * shared AsyncIo pool which are written asynchronously and recycled on
+ * completion, so many writes are in flight at once. The writer waits only
+ * when every buffer is in flight.
+ *
+ * Buffers are flushed when full - a crash loses at most the staged data.
+ */
+class AsyncSink : public Sink {
+ public:
+	AsyncSink(const char* name, std::shared_ptr<AsyncIo> io, bool direct);
+	~AsyncSink();
+	// Sink
+	bool Write(const void* data, std::size_t size) override;
+	uint64_t Size() const override;
+ private:
+	bool submit_current();
+ private:
+	friend class AsyncIo;
+	int fd_;
+	bool direct_;
+	std::shared_ptr<AsyncIo> io_;
+	AsyncIo::Buffer* current_;
+	// File offset where current buffer starts (aligned)
+	uint64_t offset_;
+	uint64_t size_;
+	// Updated by whichever thread reaps the completion
+	std::atomic<std::size_t> in_flight_;
+	std::atomic<bool> failed_;
+};
+
+// SNOOP_ASYNC_BACKEND=uring (default, falls back to threads) or threads.
+// SNOOP_ASYNC_DIRECT=0 disables O_DIRECT.
+std::unique_ptr<Sink> MakeAsyncSink(const char* name);
+
+} // namespace snoop
+
+#endif // __ASYNCSINK_H__
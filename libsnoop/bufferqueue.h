@@ -25,46 +25,78 @@ SOFTWARE.
 #define __BUFFERQUEUE_H__
 
 #include <atomic>
-#include <functional>
-#include <algorithm>
+#include <array>
+#include <cstddef>
 
-template<class Buffer, std::size_t SIZE> class BufferQueue {
+#include "aligned.h"
+#include "constants.h"
+
+/**
+ * Fixed capacity buffer filled in place by the producer. Deliberately
+ * trivially constructible - allocating a queue of them does not touch
+ * the pages until they are used.
+ */
+template<class T, std::size_t CAPACITY> struct FixedBuffer {
+	std::size_t size_;
+	T data_[CAPACITY];
+
+	T* data() { return data_; }
+	const T* data() const { return data_; }
+	std::size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	bool full() const { return size_ == CAPACITY; }
+	void clear() { size_ = 0; }
+	void push_back(const T& value) { data_[size_++] = value; }
+	static constexpr std::size_t capacity() { return CAPACITY; }
+};
+
+/**
+ * Single producer / single consumer ring of preallocated buffers.
+ *
+ * head_ is written only by the producer and tail_ only by the consumer,
+ * each on its own cache line. The producer keeps a cached copy of tail_
+ * so a full acquire load happens only when the ring looks full. Objects
+ * holding a queue must be allocated cache line aligned (CacheAligned).
+ */
+template<class Buffer, std::size_t SIZE> class BufferQueue : public CacheAligned {
 public:
-	using Callback = std::function<void (Buffer&)>;
-	struct Wrapper {
-		Buffer buffer_;
-		std::atomic_bool public_;
-	};
+	BufferQueue() : head_(0), cached_tail_(0), tail_(0) {}
 	// Producer
 	Buffer* Get() {
-		if (queue_[curr_].public_.load(std::memory_order_acquire))
-			return nullptr;
-		return &(queue_[curr_].buffer_);
+		const std::size_t head = head_.load(std::memory_order_relaxed);
+		if (head - cached_tail_ >= SIZE) {
+			cached_tail_ = tail_.load(std::memory_order_acquire);
+			if (head - cached_tail_ >= SIZE)
+				return nullptr;
+		}
+		return &queue_[head % SIZE];
 	}
 	void Push() {
-		queue_[curr_].public_.store(true, std::memory_order_release);
-		curr_ = (curr_ + 1) % SIZE;
+		head_.store(head_.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
 	}
-	// Consumer
-	void Process(const Callback& callback) {
-		auto process = [this, &callback](Wrapper& wrapper) {
-			if (wrapper.public_.load(std::memory_order_relaxed)) {
-				callback(wrapper.buffer_);
-				wrapper.public_.store(false, std::memory_order_release);
-			}
-		};
-		std::for_each(queue_.begin(), queue_.end(), process);
+	// Consumer - only the published range, oldest first
+	template<class Callback> std::size_t Process(Callback&& callback) {
+		std::size_t tail = tail_.load(std::memory_order_relaxed);
+		const std::size_t head = head_.load(std::memory_order_acquire);
+		const std::size_t count = head - tail;
+		for (; tail != head; ++tail) {
+			callback(queue_[tail % SIZE]);
+			tail_.store(tail + 1, std::memory_order_release);
+		}
+		return count;
 	}
-	void Consume(const Callback& callback) {
-		auto consume = [this, &callback](Wrapper& wrapper) {
-			callback(wrapper.buffer_);
-			wrapper.public_.store(false, std::memory_order_release);
-		};
-		std::for_each(queue_.begin(), queue_.end(), consume);
+	std::size_t Size() const {
+		return head_.load(std::memory_order_acquire) -
+			tail_.load(std::memory_order_acquire);
 	}
 private:
-	std::array<Wrapper, SIZE> queue_;
-	std::size_t curr_ = 0;
+	// Producer line
+	alignas(constants::kCacheLineSize) std::atomic<std::size_t> head_;
+	std::size_t cached_tail_;
+	// Consumer line
+	alignas(constants::kCacheLineSize) std::atomic<std::size_t> tail_;
+	alignas(constants::kCacheLineSize) std::array<Buffer, SIZE> queue_;
 };
 
-#endif //__BUFFER_H__
+#endif //__BUFFERQUEUE_H__
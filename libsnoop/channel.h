@@ -26,49 +26,73 @@ SOFTWARE.
 
 #include <cstring>
 
-#include <functional>
+#include <atomic>
+#include <deque>
 #include <memory>
+#include <thread>
 #include <vector>
 
+#include "aligned.h"
 #include "bufferqueue.h"
+#include "clock.h"
 #include "constants.h"
+#include "log.h"
+#include "overflow.h"
+#include "stats.h"
 
-template<class Message, std::size_t SIZE = constants::kDefaultChannelSize>
-class Channel {
+/**
+ * Records of one producer thread, handed to a consumer in buckets.
+ *
+ * When the consumer falls behind and every bucket is published, Send
+ * applies the OverflowPolicy. Records that are lost are replaced in the
+ * stream by one marker, MakeDropMarker(first lost, count) found by ADL, at
+ * the position of the gap. Overflow handling only runs when no bucket is
+ * being filled, the common path of Send is unchanged.
+ *
+ * Counters for the stats page are updated per bucket. Message needs a
+ * timestamp member (clock::Now ticks). Create with new, not make_shared,
+ * to keep the queue indices on their own cache lines.
+ */
+template<class Message, std::size_t SIZE = constants::kDefaultChannelSize,
+	std::size_t BUCKET = constants::kDefaultChannelBucketSize>
+class Channel : public CacheAligned {
  public:
-	using MessageBucket = std::vector<Message>;
+	using MessageBucket = FixedBuffer<Message, BUCKET>;
 	class ChannelListener {
 	 public:
 		virtual ~ChannelListener() {};
 		virtual void OnMessageBucket(MessageBucket& bucket) = 0;
+		// Readable from any thread
+		virtual uint64_t BytesWritten() const { return 0; }
 	};
 	class ChannelConsumer {
 	 public:
 		virtual void Notify() = 0;
 	};
 	Channel()
-		: consumer_(nullptr)
+		: current_(nullptr), consumer_(nullptr), overflow_({ snoop::kOverflowDrop, 0, 0 }),
+		pending_drops_(0), scratch_written_(0), id_(0),
+		receiving_(false)
 	{}
 	~Channel() {
 		listeners_.clear();
 	}
 	bool SetName(const char* name, pid_t pid) {
+		id_ = pid;
 		const auto ret = std::snprintf(name_, constants::kNameSizeMax, "%s_%d", name, pid);
 		if (ret < 0 || ret >= constants::kNameSizeMax)
 			return false;
 		return true;
 	}
+	// Producer, before the first Send
+	void SetOverflow(const snoop::OverflowConfig& overflow) {
+		overflow_ = overflow;
+	}
+	// Returns false when message is lost
 	bool Send(const Message& message) {
-		MessageBucket* bucket = queue_.Get();
-		if (!bucket) {
-			drop_count_++;
-			return false;
-		}
-		bucket->push_back(message);
-		if (bucket->size() == constants::kDefaultChannelBucketSize) {
-			queue_.Push();
-			maybe_notify_consumer();
-		}
+		if (!current_)
+			return send_slow(message);
+		push(message);
 		return true;
 	}
 	void RegisterListener(std::unique_ptr<ChannelListener> listener) {
@@ -78,30 +102,249 @@ class Channel {
 		consumer_ = consumer;
 	}
 	void NotifyMessageBucket(MessageBucket& bucket) {
+		const uint64_t begin = snoop::clock::ReadClock(CLOCK_MONOTONIC);
 		for (auto& listener : listeners_)
 			listener->OnMessageBucket(bucket);
+		consumer_stats_.write_ns.Add(snoop::clock::ReadClock(CLOCK_MONOTONIC) - begin);
+		consumer_stats_.blocks.Add(1);
+		if (!bucket.empty())
+			consumer_stats_.timestamp.Max(bucket.data()[bucket.size() - 1].timestamp);
 	}
-	void Receive() {
-		queue_.Process(std::bind(&Channel::NotifyMessageBucket, this,
-					std::placeholders::_1));
+	std::size_t Receive() {
+		const std::size_t count = queue_.Process([this](MessageBucket& bucket) {
+			NotifyMessageBucket(bucket);
+		});
+		consumer_stats_.backlog_max.Max(count);
+		return count;
 	}
+	// Consumer side is single threaded - several writers may try to drain
+	// the same channel, only one gets it.
+	std::size_t TryReceive() {
+		if (receiving_.exchange(true, std::memory_order_acquire))
+			return 0;
+		const std::size_t count = Receive();
+		receiving_.store(false, std::memory_order_release);
+		return count;
+	}
+	// Producer must be done - flushes the partially filled bucket and
+	// records held back by overflow as well
 	void Finalize() {
-		queue_.Consume(std::bind(&Channel::NotifyMessageBucket, this,
-					std::placeholders::_1));
+		while (receiving_.exchange(true, std::memory_order_acquire))
+			std::this_thread::yield();
+		Receive();
+		while (!recover())
+			Receive();
+		Receive();
+		if (current_ && !current_->empty()) {
+			producer_stats_.events.Add(current_->size());
+			NotifyMessageBucket(*current_);
+		}
+		current_ = nullptr;
+		receiving_.store(false, std::memory_order_release);
+		const uint64_t dropped = DropCount();
+		if (dropped > 0)
+			LOG(ERROR, "Channel %s lost %llu records to overflow", name_,
+					(unsigned long long)dropped);
+	}
+	// Records lost so far, safe to read from any thread
+	uint64_t DropCount() const {
+		return producer_stats_.drops.Get();
+	}
+	// Stats - safe to read from any thread
+	const snoop::ProducerStats& GetProducerStats() const {
+		return producer_stats_;
+	}
+	const snoop::ConsumerStats& GetConsumerStats() const {
+		return consumer_stats_;
+	}
+	uint64_t BytesWritten() const {
+		uint64_t bytes = 0;
+		for (auto& listener : listeners_)
+			bytes += listener->BytesWritten();
+		return bytes;
+	}
+	// Published buckets waiting for the consumer
+	std::size_t Backlog() const {
+		return queue_.Size();
 	}
 	const char* GetName() const {
 		return name_;
 	}
+	pid_t GetId() const {
+		return id_;
+	}
  protected:
 	void maybe_notify_consumer() {
 		if (consumer_)
 			consumer_->Notify();
 	}
  private:
+	// Producer - current_ is set and has room
+	void push(const Message& message) {
+		MessageBucket* bucket = current_;
+		bucket->push_back(message);
+		if (bucket->full()) {
+			current_ = nullptr;
+			publish(*bucket);
+		}
+	}
+	void publish(const MessageBucket& bucket) {
+		producer_stats_.events.Add(bucket.size());
+		producer_stats_.buckets.Add(1);
+		queue_.Push();
+		maybe_notify_consumer();
+	}
+	// Runs once per bucket, or per Send while overflowing
+	bool send_slow(const Message& message) {
+		const uint64_t begin = snoop::clock::ReadClock(CLOCK_MONOTONIC);
+		const bool kept = acquire_and_send(message);
+		producer_stats_.send_ns.Add(snoop::clock::ReadClock(CLOCK_MONOTONIC) - begin);
+		return kept;
+	}
+	bool acquire_and_send(const Message& message) {
+		// Records held back by an earlier overflow go first
+		if (backlog() && !recover())
+			return overflow(message);
+		if (!current_) {
+			MessageBucket* bucket = queue_.Get();
+			// Spin once per gap, a stalled consumer must not stall every Send
+			if (!bucket && overflow_.policy == snoop::kOverflowSpin && pending_drops_ == 0)
+				bucket = spin_get();
+			if (!bucket)
+				return overflow(message);
+			bucket->clear();
+			current_ = bucket;
+		}
+		push(message);
+		return true;
+	}
+	MessageBucket* spin_get() {
+		maybe_notify_consumer();
+		const uint64_t deadline =
+			snoop::clock::ReadClock(CLOCK_MONOTONIC) + overflow_.spin_ns;
+		do {
+			std::this_thread::yield();
+			if (MessageBucket* bucket = queue_.Get())
+				return bucket;
+		} while (snoop::clock::ReadClock(CLOCK_MONOTONIC) < deadline);
+		return nullptr;
+	}
+	// Returns true when message is kept for later
+	bool overflow(const Message& message) {
+		switch (overflow_.policy) {
+		case snoop::kOverflowSpill:
+			if (pending_drops_ > 0) {
+				if (!spill(MakeDropMarker(first_lost_, pending_drops_)))
+					break;
+				pending_drops_ = 0;
+			}
+			if (spill(message))
+				return true;
+			break;
+		case snoop::kOverflowOverwrite: {
+			if (!scratch_) {
+				scratch_.reset(new MessageBucket);
+				scratch_->clear();
+			}
+			Message& slot = scratch_->data()[scratch_written_ % kScratchSize];
+			if (scratch_written_ >= kScratchSize)
+				lose(slot);
+			slot = message;
+			scratch_written_++;
+			return true;
+		}
+		default:
+			break;
+		}
+		lose(message);
+		return false;
+	}
+	void lose(const Message& message) {
+		if (pending_drops_ == 0)
+			first_lost_ = message;
+		pending_drops_++;
+		producer_stats_.drops.Add(1);
+	}
+	bool spill(const Message& message) {
+		if (spill_.empty() || spill_.back()->full()) {
+			if (spill_.size() >= overflow_.spill_buckets)
+				return false;
+			if (spill_free_.empty()) {
+				spill_.emplace_back(new MessageBucket);
+			} else {
+				spill_.push_back(std::move(spill_free_.back()));
+				spill_free_.pop_back();
+			}
+			spill_.back()->clear();
+		}
+		spill_.back()->push_back(message);
+		return true;
+	}
+	bool backlog() const {
+		return !spill_.empty() || pending_drops_ > 0 || scratch_written_ > 0;
+	}
+	// Moves held back records into the queue, oldest first. Returns true
+	// when nothing is held back anymore.
+	bool recover() {
+		while (!spill_.empty()) {
+			MessageBucket* bucket = queue_.Get();
+			if (!bucket)
+				return false;
+			*bucket = *spill_.front();
+			spill_free_.push_back(std::move(spill_.front()));
+			spill_.pop_front();
+			// Only the last spilled bucket may be partial, keep filling it
+			if (bucket->full())
+				publish(*bucket);
+			else
+				current_ = bucket;
+		}
+		if (pending_drops_ == 0 && scratch_written_ == 0)
+			return true;
+		if (!current_) {
+			MessageBucket* bucket = queue_.Get();
+			if (!bucket)
+				return false;
+			bucket->clear();
+			current_ = bucket;
+		}
+		if (pending_drops_ > 0) {
+			push(MakeDropMarker(first_lost_, pending_drops_));
+			pending_drops_ = 0;
+		}
+		// Overwrite only - current_ is a fresh bucket with room for the
+		// marker and the whole scratch ring
+		const std::size_t kept =
+			scratch_written_ < kScratchSize ? scratch_written_ : kScratchSize;
+		const std::size_t oldest = scratch_written_ - kept;
+		for (std::size_t idx = 0; idx < kept; idx++)
+			push(scratch_->data()[(oldest + idx) % kScratchSize]);
+		scratch_written_ = 0;
+		return true;
+	}
+ private:
+	// One slot of a bucket stays free for the drop marker
+	static const std::size_t kScratchSize = MessageBucket::capacity() - 1;
+
+	// Producer side - bucket being filled, not yet published
+	MessageBucket* current_;
 	BufferQueue<MessageBucket, SIZE> queue_;
 	std::vector<std::unique_ptr<ChannelListener>> listeners_;
 	ChannelConsumer* consumer_;
-	long drop_count_;
+	snoop::OverflowConfig overflow_;
+	// Lost records not yet marked in the stream
+	uint64_t pending_drops_;
+	Message first_lost_;
+	// kOverflowSpill - full buckets first, only back() may be partial
+	std::deque<std::unique_ptr<MessageBucket>> spill_;
+	std::vector<std::unique_ptr<MessageBucket>> spill_free_;
+	// kOverflowOverwrite - ring of the newest records of the gap
+	std::unique_ptr<MessageBucket> scratch_;
+	std::size_t scratch_written_;
+	snoop::ProducerStats producer_stats_;
+	snoop::ConsumerStats consumer_stats_;
+	pid_t id_;
+	std::atomic_bool receiving_;
 	char name_[constants::kNameSizeMax];
 };
 
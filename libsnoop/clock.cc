@@ -0,0 +1,99 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// getenv
+#include <stdlib.h>
+// strcmp
+#include <string.h>
+
+#include "clock.h"
+#include "log.h"
+
+namespace {
+
+static const long kCalibrationPeriodNs = 5000000;
+
+} // namespace
+
+namespace snoop {
+namespace clock {
+
+Source g_source = kNone;
+
+Source Initialize() {
+#if defined(SNOOP_CLOCK_HAS_TSC)
+	Source source = kTsc;
+#else
+	Source source = kMonotonicCoarse;
+#endif
+	const char* env = getenv("SNOOP_CLOCK");
+	if (env) {
+		if (strcmp(env, "tsc") == 0) {
+#if defined(SNOOP_CLOCK_HAS_TSC)
+			source = kTsc;
+#else
+			LOG(WARNING, "TSC not available, using coarse monotonic clock");
+#endif
+		} else if (strcmp(env, "coarse") == 0) {
+			source = kMonotonicCoarse;
+		} else if (strcmp(env, "none") == 0) {
+			source = kNone;
+		} else {
+			LOG(WARNING, "Unknown SNOOP_CLOCK=%s", env);
+		}
+	}
+	g_source = source;
+	LOG(INFO, "Clock source=%u", (unsigned)g_source);
+	return g_source;
+}
+
+Calibration Calibrate() {
+	Calibration calibration = { g_source, 0, 0, 0.0 };
+	switch (g_source) {
+		case kTsc: {
+			const uint64_t ns_begin = ReadClock(CLOCK_MONOTONIC);
+			const uint64_t tick_begin = ReadTsc();
+			struct timespec period = { 0, kCalibrationPeriodNs };
+			while (nanosleep(&period, &period) != 0) {}
+			const uint64_t ns_end = ReadClock(CLOCK_MONOTONIC);
+			const uint64_t tick_end = ReadTsc();
+			calibration.tick_base = tick_end;
+			calibration.ns_base = ns_end;
+			if (tick_end > tick_begin)
+				calibration.ns_per_tick =
+					(double)(ns_end - ns_begin) / (double)(tick_end - tick_begin);
+			break;
+		}
+		case kMonotonicCoarse:
+			// Coarse clock already counts CLOCK_MONOTONIC nanoseconds
+			calibration.ns_per_tick = 1.0;
+			break;
+		default:
+			break;
+	}
+	LOG(INFO, "Clock calibration ns_per_tick=%f", calibration.ns_per_tick);
+	return calibration;
+}
+
+} // namespace clock
+} // namespace snoop
@@ -0,0 +1,97 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+// clock_gettime
+#include <time.h>
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SNOOP_CLOCK_HAS_TSC
+#endif
+
+namespace snoop {
+namespace clock {
+
+// Values are stored in .snoop file header - do not renumber
+enum Source : uint32_t {
+	kNone = 0,
+	kTsc = 1,
+	kMonotonicCoarse = 2,
+};
+
+// Relation between raw timestamps and CLOCK_MONOTONIC nanoseconds:
+// ns = ns_base + (ticks - tick_base) * ns_per_tick
+struct Calibration {
+	Source source;
+	uint64_t tick_base;
+	uint64_t ns_base;
+	double ns_per_tick;
+};
+
+// Selected once at startup (SNOOP_CLOCK=tsc|coarse|none), read on every event
+extern Source g_source;
+
+inline uint64_t ReadTsc() {
+#if defined(SNOOP_CLOCK_HAS_TSC)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+inline uint64_t ReadClock(clockid_t id) {
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Hot path timestamp. rdtsc is ~7ns and unserialised which is fine here -
+ * we only need ordering within a thread. CLOCK_MONOTONIC_COARSE is a vDSO
+ * read with jiffy resolution for platforms without usable TSC.
+ */
+inline uint64_t Now() {
+	switch (g_source) {
+		case kTsc:
+			return ReadTsc();
+		case kMonotonicCoarse:
+			return ReadClock(CLOCK_MONOTONIC_COARSE);
+		default:
+			return 0;
+	}
+}
+
+// Select clock source from environment. Call before first Now().
+Source Initialize();
+// Measure ticks against CLOCK_MONOTONIC. Takes a few milliseconds for TSC.
+Calibration Calibrate();
+
+} // namespace clock
+} // namespace snoop
+
+#endif // __CLOCK_H__
@@ -0,0 +1,288 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// mmap
+#include <sys/mman.h>
+// accept, recvmsg
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+
+#include "collector.h"
+#include "log.h"
+
+namespace snoop {
+
+Collector::Collector()
+	: listen_fd_(-1), bucket_(new MessageBucket()),
+		compression_(format::CompressionFromEnv()),
+		fold_repeats_(format::FoldRepeatsFromEnv()), exit_flag_(false) {
+}
+
+Collector::~Collector() {
+	while (!rings_.empty())
+		remove_ring(rings_.size() - 1);
+	while (!clients_.empty())
+		remove_client(clients_.size() - 1);
+	if (listen_fd_ >= 0) {
+		close(listen_fd_);
+		unlink(path_.c_str());
+	}
+}
+
+bool Collector::Listen(const std::string& path) {
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		LOG(ERROR, "Collector socket path too long path=%s", path.c_str());
+		return false;
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.size());
+	listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (listen_fd_ < 0) {
+		LOG(ERROR, "Failed to create collector socket: %s", strerror(errno));
+		return false;
+	}
+	// Left behind by a collector of ours that did not exit cleanly
+	struct stat status;
+	if (lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode) &&
+			status.st_uid == getuid())
+		unlink(path.c_str());
+	if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+			listen(listen_fd_, SOMAXCONN) != 0) {
+		LOG(ERROR, "Failed to listen path=%s: %s", path.c_str(), strerror(errno));
+		close(listen_fd_);
+		listen_fd_ = -1;
+		return false;
+	}
+	path_ = path;
+	return true;
+}
+
+void Collector::Stop() {
+	exit_flag_.store(true, std::memory_order_release);
+}
+
+void Collector::accept_client() {
+	const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+	if (fd < 0) {
+		LOG(WARNING, "Failed to accept collector client: %s", strerror(errno));
+		return;
+	}
+	// Files are named after the peer, not after what it claims
+	ucred credentials;
+	socklen_t size = sizeof(credentials);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0) {
+		LOG(WARNING, "Failed to get collector client credentials");
+		close(fd);
+		return;
+	}
+	if (credentials.uid != getuid()) {
+		LOG(WARNING, "Refused collector client pid=%d uid=%u", credentials.pid,
+				credentials.uid);
+		close(fd);
+		return;
+	}
+	clients_.push_back(Client{fd, credentials.pid});
+	LOG(INFO, "Collector client pid=%d", credentials.pid);
+}
+
+bool Collector::receive(const Client& client) {
+	CollectorMessage message;
+	iovec iov = { &message, sizeof(message) };
+	char control[CMSG_SPACE(sizeof(int))];
+	msghdr header;
+	std::memset(&header, 0, sizeof(header));
+	header.msg_iov = &iov;
+	header.msg_iovlen = 1;
+	header.msg_control = control;
+	header.msg_controllen = sizeof(control);
+	const ssize_t size = recvmsg(client.fd, &header, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (size < 0)
+		return errno == EAGAIN || errno == EINTR;
+	if (size == 0)
+		return false;
+	int fd = -1;
+	cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	if (size != sizeof(message)) {
+		LOG(WARNING, "Malformed collector message pid=%d", client.pid);
+	} else if (message.type == kCollectorRing && fd >= 0) {
+		add_ring(client, message, fd);
+	} else if (message.type == kCollectorMap) {
+		MemoryMap::Get(client.pid).Update(message.timestamp);
+		const char ack = 0;
+		send(client.fd, &ack, sizeof(ack), MSG_NOSIGNAL);
+	}
+	if (fd >= 0)
+		close(fd);
+	return true;
+}
+
+void Collector::add_ring(const Client& client, const CollectorMessage& message,
+		int fd) {
+	// A ring truncated after mapping would take the collector down with SIGBUS
+	const int seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || (seals & kRingSeals) != kRingSeals) {
+		LOG(WARNING, "Unsealed ring pid=%d", client.pid);
+		return;
+	}
+	struct stat status;
+	if (fstat(fd, &status) != 0 || (std::size_t)status.st_size < sizeof(RingHeader)) {
+		LOG(WARNING, "Invalid ring pid=%d", client.pid);
+		return;
+	}
+	const std::size_t size = status.st_size;
+	void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		LOG(WARNING, "Failed to map ring pid=%d: %s", client.pid, strerror(errno));
+		return;
+	}
+	RingHeader* header = static_cast<RingHeader*>(base);
+	const uint64_t capacity = header->capacity;
+	if (std::memcmp(header->magic, kRingMagic, sizeof(kRingMagic)) != 0 ||
+			capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+			header->header_size < sizeof(RingHeader) ||
+			header->header_size + capacity * sizeof(format::Record) > size) {
+		LOG(WARNING, "Invalid ring pid=%d", client.pid);
+		munmap(base, size);
+		return;
+	}
+	format::FileHeader file_header = message.header;
+	file_header.pid = client.pid;
+	// Module addresses would need the module table of the traced process
+	file_header.flags &= ~format::kFileModuleAddress;
+	char name[constants::kNameSizeMax];
+	const auto ret = std::snprintf(name, constants::kNameSizeMax, "%s_%d_%d.snoop",
+			constants::kEnterChannelName, file_header.tid, client.pid);
+	if (ret < 0 || ret >= constants::kNameSizeMax) {
+		LOG(ERROR, "Failed to construct ring trace name");
+		munmap(base, size);
+		return;
+	}
+	std::unique_ptr<Ring> ring(new Ring());
+	ring->client = client.fd;
+	ring->size = size;
+	ring->header = header;
+	ring->records = reinterpret_cast<const format::Record*>(
+			static_cast<char*>(base) + header->header_size);
+	ring->mask = capacity - 1;
+	ring->handler.reset(new StreamingBucketHandler(MakeSink(name), file_header,
+				compression_, kAddressAbsolute, fold_repeats_));
+	rings_.push_back(std::move(ring));
+	LOG(INFO, "Collector ring name=%s records=%lu", name, (unsigned long)capacity);
+}
+
+std::size_t Collector::drain(Ring& ring) {
+	const uint64_t head = ring.header->head.load(std::memory_order_acquire);
+	uint64_t tail = ring.header->tail.load(std::memory_order_relaxed);
+	// Only a broken producer gets more than a ring ahead
+	if (head - tail > ring.mask + 1) {
+		LOG(WARNING, "Ring overrun tid=%d", ring.header->tid);
+		tail = head - (ring.mask + 1);
+	}
+	const std::size_t count = head - tail;
+	while (tail != head) {
+		bucket_->clear();
+		while (tail != head && bucket_->size() < bucket_->capacity())
+			bucket_->push_back(ring.records[tail++ & ring.mask]);
+		ring.handler->OnMessageBucket(*bucket_);
+		ring.header->tail.store(tail, std::memory_order_release);
+	}
+	return count;
+}
+
+void Collector::remove_ring(std::size_t idx) {
+	Ring& ring = *rings_[idx];
+	drain(ring);
+	munmap(ring.header, ring.size);
+	rings_.erase(rings_.begin() + idx);
+}
+
+void Collector::remove_client(std::size_t idx) {
+	const int fd = clients_[idx].fd;
+	LOG(INFO, "Collector client gone pid=%d", clients_[idx].pid);
+	for (std::size_t ring = rings_.size(); ring > 0; ring--) {
+		if (rings_[ring - 1]->client == fd)
+			remove_ring(ring - 1);
+	}
+	close(fd);
+	clients_.erase(clients_.begin() + idx);
+}
+
+void Collector::Run() {
+	std::vector<pollfd> fds;
+	int period = constants::kCollectorPollPeriodMs;
+	while (!exit_flag_.load(std::memory_order_acquire)) {
+		fds.clear();
+		fds.push_back(pollfd{listen_fd_, POLLIN, 0});
+		for (auto& client : clients_)
+			fds.push_back(pollfd{client.fd, POLLIN, 0});
+		// Sockets wake us up, rings do not - back off while they are idle
+		const int timeout = rings_.empty() ? constants::kCollectorIdlePeriodMs : period;
+		if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+			LOG(ERROR, "Collector poll failed: %s", strerror(errno));
+			break;
+		}
+		// Rings first - a closed connection takes its rings along
+		std::size_t drained = 0;
+		for (std::size_t idx = rings_.size(); idx > 0; idx--) {
+			Ring& ring = *rings_[idx - 1];
+			if (ring.header->closed.load(std::memory_order_acquire))
+				remove_ring(idx - 1);
+			else
+				drained += drain(ring);
+		}
+		if (drained)
+			period = constants::kCollectorPollPeriodMs;
+		else
+			period = std::min(period * 2, constants::kCollectorPollPeriodMaxMs);
+		for (std::size_t idx = fds.size() - 1; idx > 0; idx--) {
+			if (!fds[idx].revents)
+				continue;
+			bool alive = true;
+			while (alive && (fds[idx].revents & POLLIN)) {
+				alive = receive(clients_[idx - 1]);
+				pollfd more = { fds[idx].fd, POLLIN, 0 };
+				if (poll(&more, 1, 0) != 1)
+					break;
+			}
+			if (!alive || (fds[idx].revents & (POLLHUP | POLLERR)))
+				remove_client(idx - 1);
+		}
+		if (fds[0].revents & POLLIN)
+			accept_client();
+	}
+	while (!clients_.empty())
+		remove_client(clients_.size() - 1);
+}
+
+} // namespace snoop
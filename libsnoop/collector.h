@@ -0,0 +1,98 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __COLLECTOR_H__
+#define __COLLECTOR_H__
+
+// pid_t
+#include <sys/types.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sharedring.h"
+#include "snoop.h"
+
+namespace snoop {
+
+/**
+ * snoop-collector: accepts traced processes (SNOOP_MODE=collector) on a
+ * unix socket, maps the rings they register and writes them to .snoop and
+ * .map files in the working directory. One collector serves any number of
+ * processes, the traced processes do no trace I/O.
+ *
+ * Single threaded - polls the socket and drains every ring each
+ * kCollectorPollPeriodMs, backing off to kCollectorPollPeriodMaxMs while the
+ * rings stay empty and to kCollectorIdlePeriodMs without rings. Only
+ * processes of the collector's user are served. SNOOP_COMPRESS,
+ * SNOOP_FOLD_REPEATS and SNOOP_SINK of the collector apply to all traces.
+ */
+class Collector {
+ public:
+	Collector();
+	~Collector();
+	bool Listen(const std::string& path);
+	// Serves until Stop, then drains every ring
+	void Run();
+	// Async signal safe
+	void Stop();
+
+ private:
+	struct Ring {
+		int client;
+		std::size_t size;
+		RingHeader* header;
+		const format::Record* records;
+		uint64_t mask;
+		std::unique_ptr<StreamingBucketHandler> handler;
+	};
+	struct Client {
+		int fd;
+		pid_t pid;
+	};
+
+	Collector(const Collector&) = delete;
+	void accept_client();
+	// Returns false once the client is gone
+	bool receive(const Client& client);
+	void add_ring(const Client& client, const CollectorMessage& message, int fd);
+	std::size_t drain(Ring& ring);
+	void remove_client(std::size_t idx);
+	void remove_ring(std::size_t idx);
+
+ private:
+	int listen_fd_;
+	std::string path_;
+	std::vector<Client> clients_;
+	std::vector<std::unique_ptr<Ring>> rings_;
+	std::unique_ptr<MessageBucket> bucket_;
+	format::Compression compression_;
+	bool fold_repeats_;
+	std::atomic_bool exit_flag_;
+};
+
+} // namespace snoop
+
+#endif // __COLLECTOR_H__
@@ -30,6 +30,60 @@ namespace constants {
 	static const std::size_t kDefaultChannelSize = 512;
 	static const std::size_t kDefaultChannelBucketSize = 1024;
 	static const std::size_t kNameSizeMax = 256;
+	static const std::size_t kCacheLineSize = 64;
+	// Processing thread wakes up at least this often when idle
+	static const long kProcessingPollPeriodNs = 100000000;
+	// Idle writers steal channels with at least this many published buckets
+	static const std::size_t kStealBacklog = kDefaultChannelSize / 4;
+	static const long kWritersMax = 256;
+	static const std::size_t kMappedWindowSize = 64 << 20;
+	// AsyncIo staging - kAsyncBufferCount writes in flight per process
+	static const std::size_t kAsyncBufferCount = 16;
+	static const std::size_t kAsyncBufferSize = 1 << 20;
+	static const std::size_t kAsyncPoolThreads = 2;
+	static const std::size_t kDirectIoAlignment = 4096;
+	// Initial ProfileTable capacity (log2) and shadow stack depth
+	static const unsigned kProfileTableBits = 10;
+	static const std::size_t kProfileStackReserve = 256;
+	// Sampler capacity (log2), allocated once - functions past half of it
+	// are not sampled. Nesting levels a sampling thread pairs exits for,
+	// calls deeper than that are not sampled either.
+	static const unsigned kSamplerTableBits = 12;
+	static const std::size_t kSamplerDepthMax = 1024;
+	// Gaps between modules a ModuleCache remembers as holding no module
+	static const std::size_t kModuleGapsMax = 8;
+	// Calls between loader counter polls of a thread (power of 2), and
+	// module loads and unloads kept for threads that did not see them yet
+	static const uint32_t kModulePollCalls = 1024;
+	static const std::size_t kModuleChangesMax = 1024;
+	// Longest sequence FoldRepeats looks for
+	static const std::size_t kRepeatPeriodMax = 32;
+	// Flight recorder ring size per thread (records, power of 2), rings of
+	// exited threads kept, and how long a fatal signal waits for its dump
+	static const std::size_t kFlightRecords = 1 << 16;
+	static const std::size_t kFlightRetiredMax = 64;
+	static const long kFlightDumpTimeoutNs = 5000000000L;
+	// Overflow defaults - how long kOverflowSpin yields and how much memory
+	// kOverflowSpill may take per thread
+	static const long kOverflowSpinUs = 1000;
+	static const long kOverflowSpillMb = 8;
+	// Stats page update period and threads listed on it
+	static const long kStatsPeriodNs = 100000000;
+	static const std::size_t kStatsThreadsMax = 256;
+	// How long a traced process waits for the tracer to attach
+	static const int kTracerAttachTimeoutMs = 5000;
+	// Collector mode - shared ring size per thread (records, power of 2),
+	// how often the collector drains busy rings, how far it backs off while
+	// they are idle and how long it sleeps without rings, how long a traced
+	// process waits for it to answer and the socket it listens on by default
+	// (in XDG_RUNTIME_DIR, or kCollectorSocketFallback-<uid>.sock)
+	static const std::size_t kCollectorRingRecords = 1 << 16;
+	static const int kCollectorPollPeriodMs = 1;
+	static const int kCollectorPollPeriodMaxMs = 16;
+	static const int kCollectorIdlePeriodMs = 500;
+	static const int kCollectorReplyTimeoutMs = 1000;
+	static const char* kCollectorSocket = "snoop-collector.sock";
+	static const char* kCollectorSocketFallback = "/tmp/snoop-collector";
 	static const char* kEnterChannelName = "funcenter";
 	static const char* kLeaveChannelName = "funcleave";
 }; // constants
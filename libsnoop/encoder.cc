@@ -0,0 +1,173 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// getenv
+#include <stdlib.h>
+// strcmp
+#include <string.h>
+
+#if defined(SNOOP_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#include "constants.h"
+#include "encoder.h"
+#include "log.h"
+
+namespace {
+
+inline uint64_t ZigZag(int64_t value) {
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline uint8_t* PutVarint(uint8_t* out, uint64_t value) {
+	while (value >= 0x80) {
+		*out++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*out++ = (uint8_t)value;
+	return out;
+}
+
+// Three fields of at most 10 bytes each
+static const std::size_t kMaxEncodedRecordSize = 30;
+
+inline bool Same(const snoop::format::Record& lhs, const snoop::format::Record& rhs) {
+	return lhs.address == rhs.address && lhs.type == rhs.type &&
+		lhs.depth == rhs.depth;
+}
+
+} // namespace
+
+namespace snoop {
+namespace format {
+
+BlockEncoder::BlockEncoder(Compression compression)
+	: compression_(compression), use_deflated_(false) {
+#if !defined(SNOOP_HAVE_ZLIB)
+	if (compression_ == kCompressionZlib) {
+		LOG(WARNING, "Built without zlib, using delta encoding only");
+		compression_ = kCompressionDelta;
+	}
+#endif
+}
+
+uint32_t BlockEncoder::Encode(const Record* records, std::size_t count) {
+	use_deflated_ = false;
+	varint_.resize(count * kMaxEncodedRecordSize);
+	uint8_t* out = varint_.data();
+	uint64_t address = 0;
+	uint64_t timestamp = 0;
+	uint32_t depth = 0;
+	for (std::size_t idx = 0; idx < count; idx++) {
+		const Record& record = records[idx];
+		out = PutVarint(out, ZigZag((int64_t)(record.address - address)));
+		out = PutVarint(out, ZigZag((int64_t)(record.timestamp - timestamp)));
+		out = PutVarint(out, ZigZag((int64_t)record.depth - (int64_t)depth)
+				<< kTypeBits | record.type);
+		address = record.address;
+		timestamp = record.timestamp;
+		depth = record.depth;
+	}
+	varint_.resize(out - varint_.data());
+	uint32_t flags = kBlockDelta;
+#if defined(SNOOP_HAVE_ZLIB)
+	if (compression_ == kCompressionZlib) {
+		uLongf deflated_size = compressBound(varint_.size());
+		deflated_.resize(deflated_size);
+		if (compress2(deflated_.data(), &deflated_size, varint_.data(),
+					varint_.size(), Z_BEST_SPEED) == Z_OK) {
+			deflated_.resize(deflated_size);
+			use_deflated_ = true;
+			flags |= kBlockZlib;
+		} else {
+			LOG(ERROR, "Block deflate failed");
+		}
+	}
+#endif
+	return flags;
+}
+
+const uint8_t* BlockEncoder::Data() const {
+	return use_deflated_ ? deflated_.data() : varint_.data();
+}
+
+std::size_t BlockEncoder::Size() const {
+	return use_deflated_ ? deflated_.size() : varint_.size();
+}
+
+Compression CompressionFromEnv() {
+	const char* env = getenv("SNOOP_COMPRESS");
+	if (!env || strcmp(env, "none") == 0)
+		return kCompressionNone;
+	if (strcmp(env, "delta") == 0)
+		return kCompressionDelta;
+	if (strcmp(env, "zlib") == 0)
+		return kCompressionZlib;
+	LOG(WARNING, "Unknown SNOOP_COMPRESS=%s", env);
+	return kCompressionNone;
+}
+
+std::size_t FoldRepeats(const Record* records, std::size_t count,
+		std::vector<Record>& out) {
+	out.clear();
+	std::size_t idx = 0;
+	while (idx < count) {
+		// Longest run of repetitions starting at idx, over all periods
+		std::size_t best_period = 0;
+		std::size_t best_copies = 0;
+		for (std::size_t period = 1;
+				period <= constants::kRepeatPeriodMax && idx + 2 * period <= count;
+				period++) {
+			std::size_t matched = 0;
+			while (idx + period + matched < count &&
+					Same(records[idx + period + matched], records[idx + matched]))
+				matched++;
+			const std::size_t copies = matched / period;
+			if (copies * period > best_copies * best_period) {
+				best_period = period;
+				best_copies = copies;
+			}
+		}
+		// kRepeat costs a record - fold only when it saves at least one
+		if (best_copies * best_period < 2) {
+			out.push_back(records[idx]);
+			idx++;
+			continue;
+		}
+		const std::size_t end = idx + best_period * (best_copies + 1);
+		out.insert(out.end(), records + idx, records + idx + best_period);
+		out.push_back(Record{ records[end - 1].timestamp, best_period, kRepeat,
+				(uint32_t)best_copies });
+		idx = end;
+	}
+	return out.size();
+}
+
+bool FoldRepeatsFromEnv() {
+	const char* env = getenv("SNOOP_FOLD_REPEATS");
+	return env && strcmp(env, "0") != 0;
+}
+
+} // namespace format
+} // namespace snoop
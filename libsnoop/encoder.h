@@ -0,0 +1,104 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __ENCODER_H__
+#define __ENCODER_H__
+
+#include <cstdint>
+#include <vector>
+
+#include "format.h"
+
+namespace snoop {
+namespace format {
+
+// Block flags - stored in BlockHeader::flags, do not renumber
+enum BlockFlags : uint32_t {
+	// Payload is varint encoded deltas (see BlockEncoder) instead of Record[]
+	kBlockDelta = 1 << 0,
+	// Payload is zlib deflated, applied after kBlockDelta
+	kBlockZlib = 1 << 1,
+	// Payload is ModuleEntry list (see format.h), record_count is 0
+	kBlockModules = 1 << 2,
+	// Payload holds kRepeat records. record_count counts records after
+	// expanding them, readers decode until the payload is exhausted.
+	kBlockRepeat = 1 << 3,
+	// Payload is EpochEntry (see format.h), record_count is 0
+	kBlockEpoch = 1 << 4,
+};
+
+enum Compression {
+	kCompressionNone = 0,
+	kCompressionDelta,
+	kCompressionZlib,
+};
+
+/**
+ * Encodes one bucket into a self contained block payload. Each record is
+ *
+ *   varint(zigzag(address - previous address))
+ *   varint(zigzag(timestamp - previous timestamp))
+ *   varint(zigzag(depth - previous depth) << kTypeBits | type)
+ *
+ * with all previous values starting from 0 at block start, so any block
+ * decodes without the ones before it.
+ */
+class BlockEncoder {
+ public:
+	static const unsigned kTypeBits = 4;
+
+	explicit BlockEncoder(Compression compression);
+	// Returns flags for BlockHeader, payload in Data()/Size()
+	uint32_t Encode(const Record* records, std::size_t count);
+	const uint8_t* Data() const;
+	std::size_t Size() const;
+
+ private:
+	Compression compression_;
+	std::vector<uint8_t> varint_;
+	std::vector<uint8_t> deflated_;
+	bool use_deflated_;
+};
+
+// SNOOP_COMPRESS=none (default), delta or zlib
+Compression CompressionFromEnv();
+
+/**
+ * Replaces runs of a repeating sequence with the first instance of the
+ * sequence and one kRepeat record. Records are equal when address, type
+ * and depth match - timestamps of repetitions are dropped, readers
+ * interpolate them from the kRepeat timestamp. Periods up to
+ * constants::kRepeatPeriodMax are detected.
+ *
+ * Returns number of records in out.
+ */
+std::size_t FoldRepeats(const Record* records, std::size_t count,
+		std::vector<Record>& out);
+
+// SNOOP_FOLD_REPEATS=1
+bool FoldRepeatsFromEnv();
+
+} // namespace format
+} // namespace snoop
+
+#endif // __ENCODER_H__
@@ -0,0 +1,256 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// getenv
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "filter.h"
+#include "modules.h"
+#include "log.h"
+
+namespace {
+
+const snoop::AddressFilter::Interval* Find(
+		const snoop::AddressFilter::Table& table, uintptr_t address) {
+	auto interval = std::upper_bound(table.begin(), table.end(), address,
+			[](uintptr_t value, const snoop::AddressFilter::Interval& interval) {
+				return value < interval.begin;
+			});
+	if (interval == table.begin())
+		return nullptr;
+	--interval;
+	return address < interval->end ? &*interval : nullptr;
+}
+
+bool ParseRange(const std::string& text, uintptr_t& begin, uintptr_t& end) {
+	const std::size_t dash = text.find('-');
+	if (dash == std::string::npos)
+		return false;
+	try {
+		begin = std::stoull(text.substr(0, dash), nullptr, 16);
+		end = std::stoull(text.substr(dash + 1), nullptr, 16);
+	} catch (const std::exception&) {
+		return false;
+	}
+	return begin < end;
+}
+
+} // namespace
+
+namespace snoop {
+
+//static
+AddressFilter& AddressFilter::GetInstance() {
+	static AddressFilter instance;
+	return instance;
+}
+
+AddressFilter::AddressFilter() : has_include_(false), table_(nullptr), generation_(0) {
+	add_rules(true, getenv("SNOOP_INCLUDE"));
+	add_rules(false, getenv("SNOOP_EXCLUDE"));
+	if (const char* path = getenv("SNOOP_FILTER_FILE"))
+		load_file(path);
+	if (!Enabled())
+		return;
+	std::lock_guard<std::mutex> lock(mutex_);
+	rebuild();
+}
+
+bool AddressFilter::add_rule(bool include, const std::string& item) {
+	Rule rule{ include, std::string(), false, 0, 0 };
+	const std::size_t at = item.find('@');
+	if (at != std::string::npos) {
+		rule.module = item.substr(0, at);
+		rule.has_range = ParseRange(item.substr(at + 1), rule.begin, rule.end);
+		if (!rule.has_range || rule.module.empty())
+			return false;
+	} else if (item.compare(0, 2, "0x") == 0) {
+		rule.has_range = ParseRange(item, rule.begin, rule.end);
+		if (!rule.has_range)
+			return false;
+	} else {
+		rule.module = item;
+	}
+	LOG(INFO, "Filter %s item=%s", include ? "include" : "exclude", item.c_str());
+	rules_.push_back(rule);
+	has_include_ |= include;
+	return true;
+}
+
+void AddressFilter::add_rules(bool include, const char* list) {
+	if (!list)
+		return;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		if (!item.empty() && !add_rule(include, item))
+			LOG(WARNING, "Ignoring malformed filter item=%s", item.c_str());
+	}
+}
+
+void AddressFilter::load_file(const char* path) {
+	std::ifstream file(path);
+	if (!file) {
+		LOG(ERROR, "Failed to open filter file path=%s", path);
+		return;
+	}
+	std::string line;
+	while (std::getline(file, line)) {
+		line = line.substr(0, line.find('#'));
+		std::stringstream stream(line);
+		std::string action;
+		std::string item;
+		if (!(stream >> action))
+			continue;
+		if (!(stream >> item) || (action != "include" && action != "exclude")) {
+			LOG(WARNING, "Ignoring malformed filter line=%s", line.c_str());
+			continue;
+		}
+		if (!add_rule(action == "include", item))
+			LOG(WARNING, "Ignoring malformed filter item=%s", item.c_str());
+	}
+}
+
+void AddressFilter::rebuild() {
+	ModuleTable& modules = ModuleTable::GetInstance();
+	std::vector<ModuleTable::Range> ranges;
+	const uint32_t generation = modules.Snapshot(ranges, true);
+	std::vector<std::string> names;
+
+	// Every rule and module edge may change the verdict
+	std::vector<uintptr_t> edges = { 0, UINTPTR_MAX };
+	for (const auto& range : ranges) {
+		edges.push_back(range.begin);
+		edges.push_back(range.end);
+		if (names.size() < range.id)
+			names.resize(range.id);
+		names[range.id - 1] = modules.Name(range.id);
+	}
+	for (const auto& rule : rules_) {
+		if (!rule.has_range || !rule.module.empty())
+			continue;
+		edges.push_back(rule.begin);
+		edges.push_back(rule.end);
+	}
+	// Module relative ranges become absolute for every matching module
+	std::vector<Rule> rules;
+	for (const auto& rule : rules_) {
+		if (!rule.has_range || rule.module.empty()) {
+			rules.push_back(rule);
+			continue;
+		}
+		for (const auto& range : ranges) {
+			if (names[range.id - 1].find(rule.module) == std::string::npos)
+				continue;
+			Rule absolute = rule;
+			absolute.module.clear();
+			absolute.begin = range.base + rule.begin;
+			absolute.end = range.base + rule.end;
+			edges.push_back(absolute.begin);
+			edges.push_back(absolute.end);
+			rules.push_back(absolute);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	std::unique_ptr<Table> table(new Table());
+	for (std::size_t idx = 0; idx + 1 < edges.size(); idx++) {
+		const uintptr_t begin = edges[idx];
+		const ModuleTable::Range* module = nullptr;
+		for (const auto& range : ranges) {
+			if (begin >= range.begin && begin < range.end) {
+				module = &range;
+				break;
+			}
+		}
+		bool included = !has_include_;
+		bool excluded = false;
+		for (const auto& rule : rules) {
+			bool match;
+			if (rule.has_range)
+				match = begin >= rule.begin && begin < rule.end;
+			else
+				match = module && names[module->id - 1].find(rule.module) != std::string::npos;
+			if (match && rule.include)
+				included = true;
+			else if (match)
+				excluded = true;
+		}
+		const Interval interval{ begin, edges[idx + 1], included && !excluded,
+			module != nullptr };
+		if (!table->empty() && table->back().allowed == interval.allowed &&
+				table->back().known == interval.known)
+			table->back().end = interval.end;
+		else
+			table->push_back(interval);
+	}
+	LOG(INFO, "Filter table intervals=%zu", table->size());
+	table_.store(table.get(), std::memory_order_release);
+	generation_.store(generation, std::memory_order_release);
+	tables_.push_back(std::move(table));
+}
+
+const AddressFilter::Table* AddressFilter::Refresh(uint32_t& generation) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	// Other refreshes (PollModules, ModuleCache) leave Stale() false
+	ModuleTable& modules = ModuleTable::GetInstance();
+	if (modules.Generation() != generation_.load(std::memory_order_relaxed) ||
+			modules.Stale())
+		rebuild();
+	generation = generation_.load(std::memory_order_relaxed);
+	return table_.load(std::memory_order_acquire);
+}
+
+FilterCache::FilterCache()
+	: enabled_(AddressFilter::GetInstance().Enabled()),
+		modules_(ModuleTable::GetInstance()), last_{0, 0, true, true},
+		generation_(0) {
+}
+
+bool FilterCache::allowed_slow(uintptr_t address) {
+	AddressFilter& filter = AddressFilter::GetInstance();
+	// Generation first - the table read after it is at least that new
+	uint32_t generation = filter.Generation();
+	const AddressFilter::Table* table = filter.GetTable();
+	if (generation != modules_.Generation())
+		table = filter.Refresh(generation);
+	const AddressFilter::Interval* interval = Find(*table, address);
+	// Code outside of known modules may belong to a new dlopen
+	if (interval && !interval->known)
+		interval = Find(*filter.Refresh(generation), address);
+	if (!interval)
+		return true;
+	// Unknown intervals are not cached, a dlopen may land in them
+	if (interval->known) {
+		last_ = *interval;
+		generation_ = generation;
+	}
+	return interval->allowed;
+}
+
+} // namespace snoop
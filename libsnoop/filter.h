@@ -0,0 +1,135 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "modules.h"
+
+namespace snoop {
+
+/**
+ * Include/exclude rules for traced functions. An address passes when it
+ * matches an include rule (or there are none) and no exclude rule.
+ *
+ * SNOOP_INCLUDE and SNOOP_EXCLUDE hold comma separated items,
+ * SNOOP_FILTER_FILE names a file of "include <item>" / "exclude <item>"
+ * lines ('#' starts a comment). An item is one of
+ *
+ *   libstdc++            module whose path contains the text
+ *   0x1000-0x2000        absolute address range
+ *   test_2@0x1000-0x2000 range of ELF virtual addresses in a module
+ *
+ * Rules are compiled into sorted disjoint intervals with a verdict each.
+ * The table is rebuilt once ModuleTable moved past the generation it was
+ * built from, or when an address falls outside of known modules and
+ * objects were loaded since.
+ */
+class AddressFilter {
+ public:
+	struct Interval {
+		uintptr_t begin;
+		uintptr_t end;
+		bool allowed;
+		// Interval lies in a loaded module, verdict is final
+		bool known;
+	};
+	using Table = std::vector<Interval>;
+
+	static AddressFilter& GetInstance();
+
+	bool Enabled() const { return !rules_.empty(); }
+	const Table* GetTable() const { return table_.load(std::memory_order_acquire); }
+	// ModuleTable generation the current table was built from
+	uint32_t Generation() const { return generation_.load(std::memory_order_acquire); }
+	// Rebuilds the table if modules changed, returns the current table
+	// and the generation it was built from
+	const Table* Refresh(uint32_t& generation);
+
+ private:
+	struct Rule {
+		bool include;
+		// Empty matches any module
+		std::string module;
+		bool has_range;
+		uintptr_t begin;
+		uintptr_t end;
+	};
+
+	AddressFilter();
+	AddressFilter(const AddressFilter&) = delete;
+
+	bool add_rule(bool include, const std::string& item);
+	void add_rules(bool include, const char* list);
+	void load_file(const char* path);
+	void rebuild();
+
+ private:
+	std::vector<Rule> rules_;
+	bool has_include_;
+	std::mutex mutex_;
+	std::atomic<const Table*> table_;
+	std::atomic<uint32_t> generation_;
+	// Published tables are never freed, threads may still search them
+	std::vector<std::unique_ptr<Table>> tables_;
+};
+
+/**
+ * Per thread verdict cache in front of AddressFilter. A call inside the
+ * interval of the previous lookup costs two compares and a generation
+ * check - a module unloaded and replaced at the same range gets its own
+ * verdict once the table is refreshed.
+ */
+class FilterCache {
+ public:
+	FilterCache();
+	bool Allowed(uintptr_t address) {
+		if (!enabled_)
+			return true;
+		if (address - last_.begin < last_.end - last_.begin &&
+				modules_.Generation() == generation_)
+			return last_.allowed;
+		return allowed_slow(address);
+	}
+
+ private:
+	bool allowed_slow(uintptr_t address);
+
+ private:
+	bool enabled_;
+	ModuleTable& modules_;
+	AddressFilter::Interval last_;
+	// Generation of the table last_ comes from
+	uint32_t generation_;
+};
+
+} // namespace snoop
+
+#endif // __FILTER_H__
@@ -0,0 +1,236 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// sigaction
+#include <signal.h>
+// futex
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+// getenv
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "constants.h"
+#include "flight.h"
+#include "snoop_api.h"
+#include "log.h"
+
+namespace {
+
+static std::atomic<snoop::FlightRecorder*> g_recorder(nullptr);
+
+static const int kFatalSignals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+// Actions replaced by the recorder, chained to and restored on destruction
+static struct sigaction g_previous[NSIG];
+
+void CallPrevious(int signal, siginfo_t* info, void* context) {
+	const struct sigaction& previous = g_previous[signal];
+	if (previous.sa_flags & SA_SIGINFO)
+		previous.sa_sigaction(signal, info, context);
+	else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+		previous.sa_handler(signal);
+}
+
+void RestorePrevious(int signal) {
+	struct sigaction current;
+	// Leave handlers installed after ours alone
+	if (sigaction(signal, nullptr, &current) == 0 &&
+			(current.sa_flags & SA_SIGINFO) &&
+			current.sa_sigaction == &snoop::FlightRecorder::OnSignal)
+		sigaction(signal, &g_previous[signal], nullptr);
+}
+
+std::size_t RingCapacity() {
+	std::size_t capacity = constants::kFlightRecords;
+	if (const char* env = getenv("SNOOP_FLIGHT_RECORDS")) {
+		const long records = std::atol(env);
+		if (records <= 0) {
+			LOG(WARNING, "Invalid SNOOP_FLIGHT_RECORDS=%s", env);
+			return capacity;
+		}
+		// Round up to a power of 2 for masking
+		capacity = 1;
+		while (capacity < (std::size_t)records)
+			capacity <<= 1;
+	}
+	return capacity;
+}
+
+} // namespace
+
+namespace snoop {
+
+FlightRing::FlightRing(pid_t tid, std::size_t capacity)
+	: tid_(tid), mask_(capacity - 1), records_(new format::Record[capacity]),
+		head_(0) {
+}
+
+void FlightRing::Snapshot(std::vector<format::Record>& out) const {
+	const std::size_t capacity = mask_ + 1;
+	const uint64_t head = head_.load(std::memory_order_acquire);
+	const uint64_t first = head > capacity ? head - capacity : 0;
+	out.resize(head - first);
+	for (uint64_t idx = first; idx < head; idx++)
+		out[idx - first] = records_[idx & mask_];
+	std::atomic_thread_fence(std::memory_order_acquire);
+	// Records the owner wrapped over while copying are torn, and so is the
+	// slot of record after which may be half written
+	const uint64_t after = head_.load(std::memory_order_relaxed);
+	const uint64_t overwritten = after + 1 > capacity ? after + 1 - capacity : 0;
+	if (overwritten > first)
+		out.erase(out.begin(), out.begin() +
+				std::min<uint64_t>(overwritten - first, out.size()));
+}
+
+FlightRecorder::FlightRecorder(DumpCallback dump)
+	: dump_(dump), capacity_(RingCapacity()), requested_(0), completed_(0),
+		exit_flag_(false) {
+	LOG(INFO, "Flight recorder records=%zu", capacity_);
+	thread_ = std::thread([this]() { run(); });
+	g_recorder.store(this, std::memory_order_release);
+	struct sigaction action;
+	sigemptyset(&action.sa_mask);
+	action.sa_sigaction = &FlightRecorder::OnSignal;
+	action.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigaction(SIGUSR2, &action, &g_previous[SIGUSR2]);
+	// Previous action runs when the handler restores it and returns - the
+	// fault repeats or the signal is raised again
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	for (int signal : kFatalSignals)
+		sigaction(signal, &action, &g_previous[signal]);
+}
+
+FlightRecorder::~FlightRecorder() {
+	RestorePrevious(SIGUSR2);
+	for (int signal : kFatalSignals)
+		RestorePrevious(signal);
+	g_recorder.store(nullptr, std::memory_order_release);
+	exit_flag_.store(true, std::memory_order_release);
+	wakeup_.Signal();
+	thread_.join();
+}
+
+std::shared_ptr<FlightRing> FlightRecorder::CreateRing(pid_t tid) {
+	auto ring = std::make_shared<FlightRing>(tid, capacity_);
+	std::lock_guard<std::mutex> lock(rings_mutex_);
+	rings_.push_back(ring);
+	return ring;
+}
+
+void FlightRecorder::ReleaseRing(std::shared_ptr<FlightRing> ring) {
+	std::lock_guard<std::mutex> lock(rings_mutex_);
+	auto ring_iterator = std::find(rings_.begin(), rings_.end(), ring);
+	if (ring_iterator == rings_.end())
+		return;
+	rings_.erase(ring_iterator);
+	retired_.push_back(ring);
+	if (retired_.size() > constants::kFlightRetiredMax)
+		retired_.pop_front();
+}
+
+void FlightRecorder::Trigger() {
+	requested_.fetch_add(1, std::memory_order_seq_cst);
+	wakeup_.Signal();
+}
+
+uint32_t FlightRecorder::Requested() const {
+	return requested_.load(std::memory_order_seq_cst);
+}
+
+bool FlightRecorder::WaitDump(uint32_t requested, long timeout_ns) {
+	const long kSliceNs = 10000000;
+	for (long waited = 0; waited < timeout_ns; waited += kSliceNs) {
+		const uint32_t completed = completed_.load(std::memory_order_acquire);
+		if ((int32_t)(completed - requested) >= 0)
+			return true;
+		struct timespec timeout = { 0, kSliceNs };
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&completed_),
+				FUTEX_WAIT_PRIVATE, completed, &timeout, nullptr, 0);
+	}
+	return false;
+}
+
+void FlightRecorder::run() {
+	uint32_t served = 0;
+	while (!exit_flag_.load(std::memory_order_acquire)) {
+		wakeup_.Wait(constants::kProcessingPollPeriodNs);
+		const uint32_t requested = requested_.load(std::memory_order_acquire);
+		if (requested == served)
+			continue;
+		// Triggers arriving during the dump get a dump of their own
+		dump();
+		served = requested;
+		completed_.store(requested, std::memory_order_release);
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&completed_),
+				FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+	}
+}
+
+void FlightRecorder::dump() {
+	static uint32_t sequence = 0;
+	std::vector<std::shared_ptr<FlightRing>> rings;
+	{
+		std::lock_guard<std::mutex> lock(rings_mutex_);
+		rings.assign(retired_.begin(), retired_.end());
+		rings.insert(rings.end(), rings_.begin(), rings_.end());
+	}
+	LOG(INFO, "Flight dump sequence=%u rings=%zu", sequence, rings.size());
+	dump_(sequence++, rings);
+}
+
+//static
+void FlightRecorder::OnSignal(int signal, siginfo_t* info, void* context) {
+	FlightRecorder* recorder = g_recorder.load(std::memory_order_acquire);
+	if (recorder) {
+		recorder->Trigger();
+		// Thread is dying, the dump must land before the previous action
+		if (signal != SIGUSR2)
+			recorder->WaitDump(recorder->Requested(), constants::kFlightDumpTimeoutNs);
+	}
+	if (signal == SIGUSR2) {
+		// Application handler of the signal, if any, still gets it
+		CallPrevious(signal, info, context);
+		return;
+	}
+	sigaction(signal, &g_previous[signal], nullptr);
+	// A fault repeats on return, signals sent by kill() or abort() have to
+	// be raised again
+	if (info->si_code <= 0)
+		raise(signal);
+}
+
+} // namespace snoop
+
+extern "C" {
+int snoop_flight_dump(void) {
+	snoop::FlightRecorder* recorder = g_recorder.load(std::memory_order_acquire);
+	if (!recorder)
+		return -1;
+	recorder->Trigger();
+	return recorder->WaitDump(recorder->Requested(),
+			constants::kFlightDumpTimeoutNs) ? 0 : -1;
+}
+}
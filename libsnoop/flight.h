@@ -0,0 +1,125 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __FLIGHT_H__
+#define __FLIGHT_H__
+
+// pid_t
+#include <sys/types.h>
+// siginfo_t
+#include <signal.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "format.h"
+#include "wakeup.h"
+
+namespace snoop {
+
+/**
+ * Fixed size per thread ring that overwrites the oldest records. Only the
+ * owning thread pushes. Snapshot may run concurrently: records overwritten
+ * while being copied are detected by re-reading the head afterwards
+ * (seqlock style) and left out.
+ */
+class FlightRing {
+ public:
+	// capacity must be a power of 2
+	FlightRing(pid_t tid, std::size_t capacity);
+	void Push(const format::Record& record) {
+		const uint64_t head = head_.load(std::memory_order_relaxed);
+		records_[head & mask_] = record;
+		head_.store(head + 1, std::memory_order_release);
+	}
+	// Copies records still present, oldest first
+	void Snapshot(std::vector<format::Record>& out) const;
+	pid_t GetTid() const { return tid_; }
+
+ private:
+	pid_t tid_;
+	std::size_t mask_;
+	std::unique_ptr<format::Record[]> records_;
+	// Records ever pushed
+	std::atomic<uint64_t> head_;
+};
+
+/**
+ * Keeps rings of live threads (and of the last exited ones) and dumps them
+ * when triggered by SIGUSR2, a fatal signal or snoop_flight_dump().
+ *
+ * Signal handlers only wake the dump thread, which does the file I/O.
+ * Fatal signal handlers then wait (bounded) for the dump to finish and
+ * reinstall the action that was there before the recorder, so crash
+ * handlers of the application still run. A SIGUSR2 handler of the
+ * application is called after the trigger. Destruction restores the
+ * previous actions.
+ */
+class FlightRecorder {
+ public:
+	using DumpCallback = std::function<void(uint32_t sequence,
+			const std::vector<std::shared_ptr<FlightRing>>& rings)>;
+
+	explicit FlightRecorder(DumpCallback dump);
+	~FlightRecorder();
+
+	std::shared_ptr<FlightRing> CreateRing(pid_t tid);
+	// Thread exited - ring is kept for the next dumps
+	void ReleaseRing(std::shared_ptr<FlightRing> ring);
+
+	// Async signal safe
+	void Trigger();
+	// Async signal safe. Returns false on timeout.
+	bool WaitDump(uint32_t requested, long timeout_ns);
+	uint32_t Requested() const;
+	// sigaction handler
+	static void OnSignal(int signal, siginfo_t* info, void* context);
+
+ private:
+	void run();
+	void dump();
+
+ private:
+	DumpCallback dump_;
+	std::size_t capacity_;
+	std::mutex rings_mutex_;
+	std::vector<std::shared_ptr<FlightRing>> rings_;
+	std::deque<std::shared_ptr<FlightRing>> retired_;
+
+	WakeupEvent wakeup_;
+	std::atomic<uint32_t> requested_;
+	// Futex word, dumps finished
+	std::atomic<uint32_t> completed_;
+	std::atomic_bool exit_flag_;
+	std::thread thread_;
+};
+
+} // namespace snoop
+
+#endif // __FLIGHT_H__
@@ -0,0 +1,188 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __FORMAT_H__
+#define __FORMAT_H__
+
+// pid_t
+#include <sys/types.h>
+
+#include <cstdint>
+#include <cstring>
+
+#include "clock.h"
+
+// .snoop v2 layout (native endianness):
+//
+//   FileHeader
+//   BlockHeader, Record[record_count]
+//   BlockHeader, Record[record_count]
+//   ...
+//
+// Files with kFileModuleAddress carry module table blocks (record_count 0,
+// kBlockModules flag, ModuleEntry list payload) ahead of the first record
+// that refers to a new module. Other files get them ahead of kModuleLoad and
+// kModuleUnload records.
+//
+// Files with absolute addresses carry epoch blocks (record_count 0,
+// kBlockEpoch flag, EpochEntry payload) naming the memory map epoch of the
+// record blocks that follow.
+//
+// v1 files were a bare sequence of addresses with no header. Readers tell
+// them apart by the magic.
+namespace snoop {
+namespace format {
+
+static const char kMagic[8] = { 'S', 'N', 'O', 'O', 'P', '\0', '\0', '\0' };
+static const uint32_t kVersion = 2;
+static const uint32_t kBlockMagic = 0x4b4c4253; // "SBLK"
+
+struct FileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t address_size;
+	uint32_t record_size;
+	int32_t pid;
+	int32_t tid;
+	uint32_t clock_source;
+	// FileFlags
+	uint32_t flags;
+	// See clock::Calibration
+	uint64_t tick_base;
+	uint64_t ns_base;
+	double ns_per_tick;
+};
+
+struct BlockHeader {
+	uint32_t magic;
+	uint32_t record_count;
+	// Bytes following this header up to the next block
+	uint32_t payload_size;
+	uint32_t flags;
+};
+
+// FileHeader flags - do not renumber
+enum FileFlags : uint32_t {
+	// Record::address is PackModuleAddress(module id, offset), or
+	// PackAbsoluteAddress for addresses outside of known modules. Records
+	// keep their size, kBlockDelta blocks get the smaller address deltas.
+	kFileModuleAddress = 1 << 0,
+};
+
+// Values are stored in .snoop files - do not renumber
+enum RecordType : uint32_t {
+	kEnter = 0,
+	kExit = 1,
+	// Calls of address not recorded by sampling since the previous record
+	// of address. depth holds the call count instead of nesting level.
+	kSuppressed = 2,
+	// The address preceding records (one period) repeat depth more times,
+	// the last repetition ending at timestamp. See FoldRepeats.
+	kRepeat = 3,
+	// Records lost to channel overflow right before this one. depth holds
+	// the count (saturated), timestamp is that of the first lost record,
+	// address is 0.
+	kDropped = 4,
+	// Module depth (ModuleEntry id) was loaded or unloaded. address is its
+	// absolute load bias, in kFileModuleAddress files too.
+	kModuleLoad = 5,
+	kModuleUnload = 6,
+};
+
+struct Record {
+	uint64_t timestamp;
+	uintptr_t address;
+	uint32_t type;
+	// Call nesting level. Enter and its matching Exit share the same depth.
+	uint32_t depth;
+};
+
+// Marker for count records lost starting with first_lost, see Channel
+inline Record MakeDropMarker(const Record& first_lost, uint64_t count) {
+	const uint32_t saturated = count > UINT32_MAX ? UINT32_MAX : (uint32_t)count;
+	return { first_lost.timestamp, 0, kDropped, saturated };
+}
+
+// Module ids start at 1, 0 marks an address outside of known modules
+static const uint32_t kModuleUnknown = 0;
+// Escape bit of kFileModuleAddress records - the other bits hold the full
+// absolute address. User space addresses and module ids never set it.
+static const uint64_t kModuleAbsolute = 1ull << 63;
+
+/**
+ * Module table entry, followed by name_size bytes of path padded to 8
+ * bytes. Offsets are relative to base (load bias), so they are ELF virtual
+ * addresses independent of ASLR.
+ */
+struct ModuleEntry {
+	uint32_t id;
+	uint32_t name_size;
+	uint64_t base;
+};
+
+// Epoch of <pid>.map (see MemoryMap) the following blocks resolve with
+struct EpochEntry {
+	uint32_t epoch;
+	uint32_t reserved;
+};
+
+inline uint64_t PackModuleAddress(uint32_t module, uint32_t offset) {
+	return (uint64_t)module << 32 | offset;
+}
+
+inline uint64_t PackAbsoluteAddress(uint64_t address) {
+	return kModuleAbsolute | address;
+}
+
+inline FileHeader MakeFileHeader(pid_t pid, pid_t tid,
+		const clock::Calibration& calibration) {
+	FileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.header_size = sizeof(FileHeader);
+	header.address_size = sizeof(uintptr_t);
+	header.record_size = sizeof(Record);
+	header.pid = pid;
+	header.tid = tid;
+	header.clock_source = calibration.source;
+	header.tick_base = calibration.tick_base;
+	header.ns_base = calibration.ns_base;
+	header.ns_per_tick = calibration.ns_per_tick;
+	return header;
+}
+
+inline BlockHeader MakeBlockHeader(uint32_t record_count) {
+	BlockHeader header;
+	header.magic = kBlockMagic;
+	header.record_count = record_count;
+	header.payload_size = record_count * sizeof(Record);
+	header.flags = 0;
+	return header;
+}
+
+} // namespace format
+} // namespace snoop
+
+#endif // __FORMAT_H__
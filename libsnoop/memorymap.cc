@@ -0,0 +1,157 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "memorymap.h"
+#include "log.h"
+
+namespace {
+
+static const char* kMapExt = ".map";
+static const char* kEpochPrefix = "# epoch ";
+static const char* kRemovedPrefix = "- ";
+
+// Permissions are the second field: "begin-end perms offset dev inode path"
+bool Executable(const std::string& line) {
+	const std::size_t perms = line.find(' ');
+	return perms != std::string::npos && perms + 3 < line.size() &&
+		line[perms + 3] == 'x';
+}
+
+}; // namespace
+
+namespace snoop {
+
+//static
+MemoryMap& MemoryMap::Get(pid_t pid) {
+	// The tracer keeps maps of all traced processes
+	static std::mutex& mutex = *new std::mutex();
+	static std::map<pid_t, MemoryMap*>& maps = *new std::map<pid_t, MemoryMap*>();
+	std::lock_guard<std::mutex> lock(mutex);
+	MemoryMap*& map = maps[pid];
+	if (!map)
+		map = new MemoryMap(pid);
+	return *map;
+}
+
+//static
+std::string MemoryMap::FileName(pid_t pid) {
+	return std::to_string(pid) + kMapExt;
+}
+
+MemoryMap::MemoryMap(pid_t pid) : pid_(pid), loaded_(false) {
+}
+
+void MemoryMap::load() {
+	loaded_ = true;
+	// Pid reused or a tracer and the process both updating the file
+	std::ifstream in(FileName(pid_));
+	std::string line;
+	const std::size_t epoch_size = strlen(kEpochPrefix);
+	const std::size_t removed_size = strlen(kRemovedPrefix);
+	while (std::getline(in, line)) {
+		if (line.compare(0, epoch_size, kEpochPrefix) == 0) {
+			uint32_t epoch = 0;
+			uint64_t timestamp = 0;
+			std::istringstream(line.substr(epoch_size)) >> epoch >> timestamp;
+			if (epoch > epochs_.size())
+				epochs_.resize(epoch, timestamp);
+		} else if (line.compare(0, removed_size, kRemovedPrefix) == 0) {
+			mappings_.erase(line.substr(removed_size));
+		} else if (Executable(line)) {
+			mappings_.insert(line);
+		}
+	}
+}
+
+bool MemoryMap::Update(uint64_t timestamp) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!loaded_)
+		load();
+	std::ifstream in(std::string("/proc/") + std::to_string(pid_) + "/maps");
+	if (!in) {
+		LOG(ERROR, "Failed to open memory map pid=%d", pid_);
+		return false;
+	}
+	std::unordered_set<std::string> current;
+	std::vector<std::string> added;
+	std::string line;
+	while (std::getline(in, line)) {
+		if (!Executable(line))
+			continue;
+		if (!mappings_.count(line))
+			added.push_back(line);
+		current.insert(std::move(line));
+	}
+	std::vector<std::string> removed;
+	for (const auto& mapping : mappings_) {
+		if (!current.count(mapping))
+			removed.push_back(mapping);
+	}
+	if (added.empty() && removed.empty())
+		return true;
+	std::sort(removed.begin(), removed.end());
+	// Epochs start in order even if an earlier timestamp comes late
+	if (!epochs_.empty())
+		timestamp = std::max(timestamp, epochs_.back());
+	epochs_.push_back(timestamp);
+	mappings_.swap(current);
+
+	std::string out = kEpochPrefix + std::to_string(epochs_.size()) + " " +
+		std::to_string(timestamp) + "\n";
+	for (const auto& mapping : removed)
+		out += kRemovedPrefix + mapping + "\n";
+	for (const auto& mapping : added)
+		out += mapping + "\n";
+	std::ofstream file(FileName(pid_), std::ios::app | std::ios::out);
+	file.write(out.data(), out.size());
+	if (!file) {
+		LOG(ERROR, "Failed to write memory map file pid=%d", pid_);
+		return false;
+	}
+	LOG(INFO, "Memory map epoch=%zu added=%zu removed=%zu", epochs_.size(),
+			added.size(), removed.size());
+	return true;
+}
+
+uint32_t MemoryMap::Epoch() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return epochs_.size();
+}
+
+uint32_t MemoryMap::EpochAt(uint64_t timestamp, uint64_t& next) const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto epoch = std::upper_bound(epochs_.begin(), epochs_.end(), timestamp);
+	// Records older than the first epoch use it as well
+	if (epoch == epochs_.begin() && epoch != epochs_.end())
+		++epoch;
+	next = epoch == epochs_.end() ? UINT64_MAX : *epoch;
+	return epoch - epochs_.begin();
+}
+
+} // namespace snoop
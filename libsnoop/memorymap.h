@@ -0,0 +1,83 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __MEMORYMAP_H__
+#define __MEMORYMAP_H__
+
+// pid_t
+#include <sys/types.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace snoop {
+
+/**
+ * Executable mappings of a process kept in <pid>.map as numbered epochs.
+ * Update hashes the r-x lines of /proc/<pid>/maps and appends only what
+ * changed since the previous epoch:
+ *
+ *   # epoch <n> <timestamp>
+ *   <maps line>             mapping added
+ *   - <maps line>           mapping removed
+ *
+ * Timestamps are clock::Now() ticks. Trace files refer to epochs with
+ * kBlockEpoch blocks, so addresses reused after a dlclose decode with the
+ * mappings of the time they were recorded.
+ */
+class MemoryMap {
+ public:
+	// Created on first use and never destroyed
+	static MemoryMap& Get(pid_t pid);
+	static std::string FileName(pid_t pid);
+
+	// Appends a new epoch starting at timestamp when executable mappings
+	// changed. Epochs already in the file are loaded first.
+	bool Update(uint64_t timestamp);
+	// Latest epoch, 0 before any
+	uint32_t Epoch() const;
+	// Epoch in effect at timestamp. next is set to the timestamp the
+	// following epoch starts at, UINT64_MAX for the latest.
+	uint32_t EpochAt(uint64_t timestamp, uint64_t& next) const;
+
+ private:
+	explicit MemoryMap(pid_t pid);
+	MemoryMap(const MemoryMap&) = delete;
+
+	void load();
+
+ private:
+	mutable std::mutex mutex_;
+	pid_t pid_;
+	bool loaded_;
+	std::unordered_set<std::string> mappings_;
+	// Start timestamp of epoch n at n - 1
+	std::vector<uint64_t> epochs_;
+};
+
+} // namespace snoop
+
+#endif // __MEMORYMAP_H__
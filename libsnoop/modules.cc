@@ -0,0 +1,287 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// dl_iterate_phdr
+#include <link.h>
+// PATH_MAX
+#include <limits.h>
+// readlink
+#include <unistd.h>
+// getenv
+#include <stdlib.h>
+// strcmp
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include "constants.h"
+#include "modules.h"
+#include "log.h"
+
+namespace snoop {
+
+AddressMode AddressModeFromEnv() {
+	const char* env = getenv("SNOOP_ADDRESS");
+	if (!env || strcmp(env, "absolute") == 0)
+		return kAddressAbsolute;
+	if (strcmp(env, "module") == 0) {
+		if (sizeof(uintptr_t) < sizeof(uint64_t)) {
+			LOG(WARNING, "Module addresses need 64 bit records");
+			return kAddressAbsolute;
+		}
+		return kAddressModule;
+	}
+	LOG(WARNING, "Unknown SNOOP_ADDRESS=%s", env);
+	return kAddressAbsolute;
+}
+
+//static
+ModuleTable& ModuleTable::GetInstance() {
+	// Never destroyed - writers serialize it while static destructors run
+	static ModuleTable& instance = *new ModuleTable();
+	return instance;
+}
+
+ModuleTable::ModuleTable()
+	: generation_(0), loads_(0), polled_(0), sequence_(0), changes_(0) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	refresh();
+	reported_ = loaded_;
+}
+
+//static
+int ModuleTable::add_ranges(dl_phdr_info* info, std::size_t size, void* data) {
+	ModuleTable* table = static_cast<ModuleTable*>(data);
+	read_loads(info, size, &table->loads_);
+	std::string name = info->dlpi_name ? info->dlpi_name : "";
+	if (name.empty()) {
+		// Main executable
+		char exe[PATH_MAX];
+		const ssize_t exe_size = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+		if (exe_size > 0)
+			name.assign(exe, exe_size);
+	}
+	uint32_t id = format::kModuleUnknown;
+	for (std::size_t idx = 0; idx < table->modules_.size(); idx++) {
+		const Module& module = table->modules_[idx];
+		if (module.base == info->dlpi_addr && module.name == name) {
+			id = idx + 1;
+			break;
+		}
+	}
+	for (int idx = 0; idx < info->dlpi_phnum; idx++) {
+		const ElfW(Phdr)& phdr = info->dlpi_phdr[idx];
+		if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_X))
+			continue;
+		if (id == format::kModuleUnknown) {
+			table->modules_.push_back(Module{name, info->dlpi_addr});
+			id = table->modules_.size();
+			LOG(INFO, "Module id=%u name=%s base=%lx", id, name.c_str(),
+					(unsigned long)info->dlpi_addr);
+		}
+		const uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+		table->ranges_.push_back(
+				Range{begin, begin + phdr.p_memsz, info->dlpi_addr, id});
+	}
+	if (id != format::kModuleUnknown) {
+		if (table->loaded_.size() < id)
+			table->loaded_.resize(id, false);
+		table->loaded_[id - 1] = true;
+	}
+	return 0;
+}
+
+//static
+int ModuleTable::read_loads(dl_phdr_info* info, std::size_t, void* data) {
+	// Counters are the same for every object, first one is enough
+	*static_cast<uint64_t*>(data) = info->dlpi_adds + info->dlpi_subs;
+	return 1;
+}
+
+void ModuleTable::refresh() {
+	ranges_.clear();
+	loaded_.assign(modules_.size(), false);
+	dl_iterate_phdr(&ModuleTable::add_ranges, this);
+	std::sort(ranges_.begin(), ranges_.end(),
+			[](const Range& lhs, const Range& rhs) { return lhs.begin < rhs.begin; });
+	generation_.fetch_add(1, std::memory_order_release);
+}
+
+uint32_t ModuleTable::Snapshot(std::vector<Range>& ranges, bool refresh) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (refresh)
+		this->refresh();
+	ranges = ranges_;
+	return generation_.load(std::memory_order_relaxed);
+}
+
+bool ModuleTable::Stale() {
+	uint64_t loads = 0;
+	dl_iterate_phdr(&ModuleTable::read_loads, &loads);
+	std::lock_guard<std::mutex> lock(mutex_);
+	return loads != loads_;
+}
+
+std::string ModuleTable::Name(uint32_t id) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (id == format::kModuleUnknown || id > modules_.size())
+		return std::string();
+	return modules_[id - 1].name;
+}
+
+uint32_t ModuleTable::Serialize(uint32_t first_id, std::vector<uint8_t>& out) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (uint32_t id = first_id + 1; id <= modules_.size(); id++) {
+		const Module& module = modules_[id - 1];
+		format::ModuleEntry entry;
+		entry.id = id;
+		entry.name_size = module.name.size();
+		entry.base = module.base;
+		const uint8_t* raw = reinterpret_cast<const uint8_t*>(&entry);
+		out.insert(out.end(), raw, raw + sizeof(entry));
+		out.insert(out.end(), module.name.begin(), module.name.end());
+		out.resize((out.size() + 7) & ~(std::size_t)7, 0);
+	}
+	return modules_.size();
+}
+
+bool ModuleTable::Poll(uint64_t now, uint64_t& since, bool& loaded) {
+	uint64_t loads = 0;
+	dl_iterate_phdr(&ModuleTable::read_loads, &loads);
+	std::lock_guard<std::mutex> lock(mutex_);
+	since = polled_;
+	polled_ = now;
+	// Refreshes done for ModuleCache misses are reported here as well
+	if (loads != loads_)
+		refresh();
+	loaded = false;
+	uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+	const uint64_t first = sequence;
+	reported_.resize(loaded_.size(), false);
+	for (std::size_t idx = 0; idx < loaded_.size(); idx++) {
+		if (loaded_[idx] == reported_[idx])
+			continue;
+		reported_[idx] = loaded_[idx];
+		loaded = loaded || loaded_[idx];
+		history_.push_back(
+				Change{(uint32_t)idx + 1, modules_[idx].base, loaded_[idx]});
+		sequence++;
+	}
+	if (sequence == first)
+		return false;
+	while (history_.size() > constants::kModuleChangesMax)
+		history_.pop_front();
+	sequence_.store(sequence, std::memory_order_release);
+	changes_.fetch_add(1, std::memory_order_release);
+	return true;
+}
+
+uint64_t ModuleTable::Changes(uint64_t first, std::vector<Change>& changes) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	const uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+	const uint64_t oldest = sequence - history_.size();
+	for (uint64_t idx = std::max(first, oldest); idx < sequence; idx++)
+		changes.push_back(history_[idx - oldest]);
+	return sequence;
+}
+
+uint64_t ModuleTable::ChangeSequence() const {
+	return sequence_.load(std::memory_order_acquire);
+}
+
+uint32_t ModuleTable::ChangeCount() const {
+	return changes_.load(std::memory_order_acquire);
+}
+
+ModuleCache::ModuleCache() : table_(ModuleTable::GetInstance()) {
+	snapshot(false);
+}
+
+void ModuleCache::snapshot(bool refresh) {
+	generation_ = table_.Snapshot(ranges_, refresh);
+	last_ = ModuleTable::Range{0, 0, 0, format::kModuleUnknown};
+	gaps_.clear();
+}
+
+const ModuleTable::Range* ModuleCache::find(uintptr_t address) const {
+	auto range = std::upper_bound(ranges_.begin(), ranges_.end(), address,
+			[](uintptr_t value, const ModuleTable::Range& range) {
+				return value < range.begin;
+			});
+	if (range == ranges_.begin())
+		return nullptr;
+	--range;
+	return address < range->end ? &*range : nullptr;
+}
+
+bool ModuleCache::in_gap(uintptr_t address) const {
+	for (const Gap& gap : gaps_) {
+		if (address - gap.begin < gap.end - gap.begin)
+			return true;
+	}
+	return false;
+}
+
+void ModuleCache::add_gap(uintptr_t address) {
+	auto next = std::upper_bound(ranges_.begin(), ranges_.end(), address,
+			[](uintptr_t value, const ModuleTable::Range& range) {
+				return value < range.begin;
+			});
+	Gap gap{0, UINTPTR_MAX};
+	if (next != ranges_.end())
+		gap.end = next->begin;
+	// Ranges of different modules do not overlap, the previous one is below
+	if (next != ranges_.begin())
+		gap.begin = std::prev(next)->end;
+	if (gaps_.size() == constants::kModuleGapsMax)
+		gaps_.erase(gaps_.begin());
+	gaps_.push_back(gap);
+	LOG(WARNING, "Address outside of known modules addr=%lx gap=%lx-%lx",
+			(unsigned long)address, (unsigned long)gap.begin,
+			(unsigned long)gap.end);
+}
+
+uint64_t ModuleCache::translate_slow(uintptr_t address) {
+	// Pick up refreshes done by other threads
+	if (table_.Generation() != generation_)
+		snapshot(false);
+	const ModuleTable::Range* range = find(address);
+	if (!range) {
+		// Something may have been loaded into a cached gap since
+		if (table_.Stale()) {
+			snapshot(true);
+			range = find(address);
+		} else if (in_gap(address)) {
+			return format::PackAbsoluteAddress(address);
+		}
+	}
+	if (!range) {
+		add_gap(address);
+		return format::PackAbsoluteAddress(address);
+	}
+	last_ = *range;
+	return format::PackModuleAddress(range->id, address - range->base);
+}
+
+} // namespace snoop
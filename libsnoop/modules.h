@@ -0,0 +1,179 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __MODULES_H__
+#define __MODULES_H__
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "format.h"
+
+// link.h
+struct dl_phdr_info;
+
+namespace snoop {
+
+enum AddressMode {
+	kAddressAbsolute = 0,
+	kAddressModule,
+};
+
+// SNOOP_ADDRESS=absolute (default) or module
+AddressMode AddressModeFromEnv();
+
+/**
+ * Executable segments of loaded objects. Modules get ids in load order and
+ * are never removed, so ids stay valid in files written after a dlclose.
+ * Ranges reflect the mappings seen by the last refresh (dl_iterate_phdr).
+ */
+class ModuleTable {
+ public:
+	struct Range {
+		uintptr_t begin;
+		uintptr_t end;
+		// Load bias of the module
+		uintptr_t base;
+		uint32_t id;
+	};
+	struct Change {
+		uint32_t id;
+		uintptr_t base;
+		bool loaded;
+	};
+
+	static ModuleTable& GetInstance();
+
+	// Copies ranges sorted by begin, rescanning loaded objects first when
+	// refresh is set. Returns generation of the copy.
+	uint32_t Snapshot(std::vector<Range>& ranges, bool refresh);
+	// Incremented by every refresh
+	uint32_t Generation() const {
+		return generation_.load(std::memory_order_acquire);
+	}
+	// True when objects were loaded or unloaded since the last refresh.
+	// Takes the loader lock but does not walk the objects.
+	bool Stale();
+	std::string Name(uint32_t id);
+	// Appends ModuleEntry list of modules with id > first_id, returns
+	// the last id written
+	uint32_t Serialize(uint32_t first_id, std::vector<uint8_t>& out);
+	// Rescans when the loader counters moved and adds modules loaded or
+	// unloaded since the previous poll to the change history. Modules
+	// present when the table was created are not reported. since is set to
+	// the now of the previous poll, loads found happened after it. Returns
+	// true when some were found, loaded tells whether one is a load.
+	bool Poll(uint64_t now, uint64_t& since, bool& loaded);
+	// Appends history entries from sequence first on and returns the
+	// sequence following the last one. Only the last kModuleChangesMax
+	// entries are kept.
+	uint64_t Changes(uint64_t first, std::vector<Change>& changes);
+	uint64_t ChangeSequence() const;
+	// Incremented by every Poll that found some
+	uint32_t ChangeCount() const;
+
+ private:
+	struct Module {
+		std::string name;
+		uintptr_t base;
+	};
+
+	ModuleTable();
+	ModuleTable(const ModuleTable&) = delete;
+
+	void refresh();
+	// dl_iterate_phdr callbacks
+	static int add_ranges(dl_phdr_info* info, std::size_t size, void* data);
+	static int read_loads(dl_phdr_info* info, std::size_t size, void* data);
+
+ private:
+	std::mutex mutex_;
+	std::vector<Module> modules_;
+	std::vector<Range> ranges_;
+	std::atomic<uint32_t> generation_;
+	// dlpi_adds + dlpi_subs seen by the last refresh
+	uint64_t loads_;
+	// Per module id - 1, mapped at the last refresh and at the last Poll
+	std::vector<bool> loaded_;
+	std::vector<bool> reported_;
+	uint64_t polled_;
+	std::deque<Change> history_;
+	std::atomic<uint64_t> sequence_;
+	std::atomic<uint32_t> changes_;
+};
+
+/**
+ * Per thread view of ModuleTable translating addresses into
+ * PackModuleAddress form. Lookups take no lock, only a miss refreshes
+ * the shared table and only when the loader counters moved. Translation
+ * happens when the record is made, so modules unloaded before the writer
+ * runs are still resolved.
+ *
+ * Addresses outside of every module (JIT code, vdso) are recorded with
+ * PackAbsoluteAddress. The gaps between modules they fall in are cached
+ * until the table changes, so repeated calls there skip the search - but
+ * not the loader counter check, a gap may have been filled since.
+ *
+ * Anything cached is dropped once some refresh moved the table generation,
+ * a module unloaded and replaced at the same range is told apart from then
+ * on (the next poll, see PollModules).
+ */
+class ModuleCache {
+ public:
+	ModuleCache();
+	uint64_t Translate(uintptr_t address) {
+		// Consecutive calls mostly stay in one module - until a refresh
+		// finds it unloaded and maybe something else in its place
+		if (address - last_.begin < last_.end - last_.begin &&
+				table_.Generation() == generation_)
+			return format::PackModuleAddress(last_.id, address - last_.base);
+		return translate_slow(address);
+	}
+
+ private:
+	struct Gap {
+		uintptr_t begin;
+		uintptr_t end;
+	};
+	uint64_t translate_slow(uintptr_t address);
+	const ModuleTable::Range* find(uintptr_t address) const;
+	bool in_gap(uintptr_t address) const;
+	// Remembers the space between modules around address
+	void add_gap(uintptr_t address);
+	void snapshot(bool refresh);
+
+ private:
+	ModuleTable& table_;
+	ModuleTable::Range last_;
+	std::vector<ModuleTable::Range> ranges_;
+	std::vector<Gap> gaps_;
+	uint32_t generation_;
+};
+
+} // namespace snoop
+
+#endif // __MODULES_H__
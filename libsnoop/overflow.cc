@@ -0,0 +1,77 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// getenv
+#include <stdlib.h>
+#include <string.h>
+
+#include "channel.h"
+#include "constants.h"
+#include "format.h"
+#include "log.h"
+#include "overflow.h"
+
+namespace {
+
+long EnvOr(const char* name, long fallback) {
+	const char* env = getenv(name);
+	if (!env)
+		return fallback;
+	const long value = std::atol(env);
+	if (value < 0) {
+		LOG(WARNING, "Invalid %s=%s", name, env);
+		return fallback;
+	}
+	return value;
+}
+
+} // namespace
+
+namespace snoop {
+
+OverflowConfig OverflowConfigFromEnv() {
+	OverflowConfig config;
+	config.policy = kOverflowDrop;
+	const char* env = getenv("SNOOP_OVERFLOW");
+	if (!env || strcmp(env, "drop") == 0)
+		config.policy = kOverflowDrop;
+	else if (strcmp(env, "overwrite") == 0)
+		config.policy = kOverflowOverwrite;
+	else if (strcmp(env, "spin") == 0)
+		config.policy = kOverflowSpin;
+	else if (strcmp(env, "spill") == 0)
+		config.policy = kOverflowSpill;
+	else
+		LOG(WARNING, "Unknown SNOOP_OVERFLOW=%s", env);
+	config.spin_ns = (uint64_t)EnvOr("SNOOP_OVERFLOW_SPIN_US",
+			constants::kOverflowSpinUs) * 1000ull;
+	const std::size_t bucket_bytes =
+		sizeof(Channel<format::Record>::MessageBucket);
+	config.spill_buckets = (std::size_t)EnvOr("SNOOP_OVERFLOW_SPILL_MB",
+			constants::kOverflowSpillMb) * (1 << 20) / bucket_bytes;
+	LOG(INFO, "Overflow policy=%d spin_ns=%llu spill_buckets=%zu", config.policy,
+			(unsigned long long)config.spin_ns, config.spill_buckets);
+	return config;
+}
+
+} // namespace snoop
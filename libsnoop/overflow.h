@@ -0,0 +1,57 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __OVERFLOW_H__
+#define __OVERFLOW_H__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace snoop {
+
+// What a producer does when all buckets of its channel are published
+enum OverflowPolicy {
+	// Lose the new records (default)
+	kOverflowDrop,
+	// Keep the newest records of the gap in a one bucket ring, lose the
+	// older ones
+	kOverflowOverwrite,
+	// Wake the consumer and yield for up to spin_ns, then drop
+	kOverflowSpin,
+	// Queue records in heap buckets, up to spill_buckets, then drop
+	kOverflowSpill,
+};
+
+struct OverflowConfig {
+	OverflowPolicy policy;
+	uint64_t spin_ns;
+	std::size_t spill_buckets;
+};
+
+// SNOOP_OVERFLOW=drop|overwrite|spin|spill, SNOOP_OVERFLOW_SPIN_US (1000)
+// and SNOOP_OVERFLOW_SPILL_MB (8)
+OverflowConfig OverflowConfigFromEnv();
+
+} // namespace snoop
+
+#endif // __OVERFLOW_H__
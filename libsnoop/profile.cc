@@ -0,0 +1,185 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// getenv
+#include <stdlib.h>
+// strcmp
+#include <string.h>
+
+#include "constants.h"
+#include "profile.h"
+#include "log.h"
+
+namespace {
+
+inline std::size_t Hash(uintptr_t address, unsigned bits) {
+	// Fibonacci hashing, function addresses are aligned
+	return (std::size_t)(((uint64_t)address * 0x9e3779b97f4a7c15ull) >> (64 - bits));
+}
+
+// Owner side update, no other thread writes the counter
+inline void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+	counter.store(counter.load(std::memory_order_relaxed) + value,
+			std::memory_order_relaxed);
+}
+
+inline uint64_t Load(const std::atomic<uint64_t>& counter) {
+	return counter.load(std::memory_order_relaxed);
+}
+
+} // namespace
+
+namespace snoop {
+
+Mode ModeFromEnv() {
+	const char* env = getenv("SNOOP_MODE");
+	if (!env || strcmp(env, "trace") == 0)
+		return kModeTrace;
+	if (strcmp(env, "profile") == 0)
+		return kModeProfile;
+	if (strcmp(env, "flight") == 0)
+		return kModeFlight;
+	if (strcmp(env, "collector") == 0)
+		return kModeCollector;
+	LOG(WARNING, "Unknown SNOOP_MODE=%s", env);
+	return kModeTrace;
+}
+
+ProfileTable::Table::Table(unsigned bits)
+	: bits(bits), capacity((std::size_t)1 << bits), slots(new Slot[capacity]()) {
+}
+
+ProfileTable::ProfileTable() : table_(nullptr), size_(0) {
+	tables_.emplace_back(new Table(constants::kProfileTableBits));
+	table_.store(tables_.back().get(), std::memory_order_release);
+	stack_.reserve(constants::kProfileStackReserve);
+}
+
+ProfileTable::Slot* ProfileTable::find_or_insert(uintptr_t address) {
+	Table* table = table_.load(std::memory_order_relaxed);
+	const std::size_t mask = table->capacity - 1;
+	for (std::size_t idx = Hash(address, table->bits);; idx = (idx + 1) & mask) {
+		Slot& slot = table->slots[idx];
+		const uintptr_t slot_address = slot.address.load(std::memory_order_relaxed);
+		if (slot_address == address)
+			return &slot;
+		if (slot_address == 0) {
+			// Keep load factor under 1/2
+			if ((size_ + 1) * 2 > table->capacity) {
+				grow();
+				return find_or_insert(address);
+			}
+			slot.address.store(address, std::memory_order_relaxed);
+			size_++;
+			return &slot;
+		}
+	}
+}
+
+void ProfileTable::grow() {
+	Table* old_table = table_.load(std::memory_order_relaxed);
+	std::unique_ptr<Table> table(new Table(old_table->bits + 1));
+	const std::size_t mask = table->capacity - 1;
+	for (std::size_t old_idx = 0; old_idx < old_table->capacity; old_idx++) {
+		Slot& old_slot = old_table->slots[old_idx];
+		const uintptr_t address = old_slot.address.load(std::memory_order_relaxed);
+		if (address == 0)
+			continue;
+		std::size_t idx = Hash(address, table->bits);
+		while (table->slots[idx].address.load(std::memory_order_relaxed) != 0)
+			idx = (idx + 1) & mask;
+		Slot& slot = table->slots[idx];
+		// Not published yet, the release store below orders these
+		slot.address.store(address, std::memory_order_relaxed);
+		slot.calls.store(Load(old_slot.calls), std::memory_order_relaxed);
+		slot.inclusive.store(Load(old_slot.inclusive), std::memory_order_relaxed);
+		slot.exclusive.store(Load(old_slot.exclusive), std::memory_order_relaxed);
+		slot.active = old_slot.active;
+		// Frames point into the old table
+		for (auto& frame : stack_) {
+			if (frame.slot == &old_slot)
+				frame.slot = &slot;
+		}
+	}
+	table_.store(table.get(), std::memory_order_release);
+	tables_.push_back(std::move(table));
+}
+
+void ProfileTable::Enter(uintptr_t address, uint64_t now) {
+	Slot* slot = find_or_insert(address);
+	Add(slot->calls, 1);
+	slot->active++;
+	stack_.push_back(Frame{slot, now, 0});
+}
+
+void ProfileTable::pop(uint64_t now) {
+	const Frame frame = stack_.back();
+	stack_.pop_back();
+	const uint64_t elapsed = now - frame.begin;
+	Add(frame.slot->exclusive, elapsed - frame.children);
+	if (--frame.slot->active == 0)
+		Add(frame.slot->inclusive, elapsed);
+	if (!stack_.empty())
+		stack_.back().children += elapsed;
+}
+
+void ProfileTable::Exit(uintptr_t address, uint64_t now) {
+	// Unbalanced exit (entered before observing started)
+	std::size_t depth = stack_.size();
+	while (depth > 0 &&
+			stack_[depth - 1].slot->address.load(std::memory_order_relaxed) != address)
+		depth--;
+	if (depth == 0)
+		return;
+	// Frames left without exit (longjmp) end together with their caller
+	while (stack_.size() >= depth)
+		pop(now);
+}
+
+void ProfileTable::MergeInto(ProfileTable& merged) const {
+	const Table* table = table_.load(std::memory_order_acquire);
+	for (std::size_t idx = 0; idx < table->capacity; idx++) {
+		const Slot& slot = table->slots[idx];
+		const uintptr_t address = slot.address.load(std::memory_order_relaxed);
+		if (address == 0)
+			continue;
+		Slot* target = merged.find_or_insert(address);
+		Add(target->calls, Load(slot.calls));
+		Add(target->inclusive, Load(slot.inclusive));
+		Add(target->exclusive, Load(slot.exclusive));
+	}
+}
+
+void ProfileTable::Entries(std::vector<format::ProfileEntry>& entries) const {
+	const Table* table = table_.load(std::memory_order_acquire);
+	for (std::size_t idx = 0; idx < table->capacity; idx++) {
+		const Slot& slot = table->slots[idx];
+		const uintptr_t address = slot.address.load(std::memory_order_relaxed);
+		if (address == 0)
+			continue;
+		entries.push_back(format::ProfileEntry{
+				address, Load(slot.calls), Load(slot.inclusive), Load(slot.exclusive)});
+	}
+}
+
+} // namespace snoop
@@ -0,0 +1,144 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "clock.h"
+
+namespace snoop {
+
+enum Mode {
+	// Every enter/exit is streamed to .snoop files
+	kModeTrace = 0,
+	// Per function counters only, written to <pid>.profile at exit
+	kModeProfile,
+	// Events kept in per thread rings, written only on demand (flight.h)
+	kModeFlight,
+	// Events kept in shared memory rings drained by snoop-collector
+	// (sharedring.h), no trace I/O in the process
+	kModeCollector,
+};
+
+// SNOOP_MODE=trace (default), profile, flight or collector
+Mode ModeFromEnv();
+
+namespace format {
+
+// .profile layout (native endianness):
+//
+//   ProfileHeader
+//   ProfileEntry[entry_count], sorted by address
+//
+// Times are in clock ticks, see clock::Calibration for conversion.
+static const char kProfileMagic[8] = { 'S', 'N', 'O', 'O', 'P', 'P', 'R', 'F' };
+static const uint32_t kProfileVersion = 1;
+
+struct ProfileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t entry_size;
+	// Threads merged into this profile
+	uint32_t thread_count;
+	uint64_t entry_count;
+	int32_t pid;
+	uint32_t clock_source;
+	uint64_t tick_base;
+	uint64_t ns_base;
+	double ns_per_tick;
+};
+
+struct ProfileEntry {
+	uint64_t address;
+	uint64_t calls;
+	// Time spent in the function including callees. Recursive calls are
+	// counted once, by the outermost one.
+	uint64_t inclusive;
+	// Time spent in the function body only
+	uint64_t exclusive;
+};
+
+} // namespace format
+
+/**
+ * Per thread open addressing hash table of function counters, updated in
+ * place of sending events. A shadow stack pairs exits with enters to
+ * split time into inclusive and exclusive.
+ *
+ * Only the owning thread writes. MergeInto may run concurrently from
+ * shutdown - replaced tables are kept alive until destruction, so a
+ * concurrent reader sees a stale but valid table. Slot fields are relaxed
+ * atomics for that reader; the owner updates them with plain load and
+ * store, there is no other writer.
+ */
+class ProfileTable {
+ public:
+	ProfileTable();
+	void Enter(uintptr_t address, uint64_t now);
+	void Exit(uintptr_t address, uint64_t now);
+	// Adds counters of this table into merged, which must not be shared
+	void MergeInto(ProfileTable& merged) const;
+	void Entries(std::vector<format::ProfileEntry>& entries) const;
+
+ private:
+	struct Slot {
+		std::atomic<uintptr_t> address;
+		std::atomic<uint64_t> calls;
+		std::atomic<uint64_t> inclusive;
+		std::atomic<uint64_t> exclusive;
+		// Frames of this function on the stack, owner only
+		uint32_t active;
+	};
+	struct Table {
+		explicit Table(unsigned bits);
+		unsigned bits;
+		std::size_t capacity;
+		std::unique_ptr<Slot[]> slots;
+	};
+	struct Frame {
+		Slot* slot;
+		uint64_t begin;
+		// Inclusive time of direct callees
+		uint64_t children;
+	};
+
+	Slot* find_or_insert(uintptr_t address);
+	void grow();
+	void pop(uint64_t now);
+
+ private:
+	std::atomic<Table*> table_;
+	std::vector<std::unique_ptr<Table>> tables_;
+	std::size_t size_;
+	std::vector<Frame> stack_;
+};
+
+} // namespace snoop
+
+#endif // __PROFILE_H__
@@ -0,0 +1,119 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// getenv
+#include <stdlib.h>
+
+#include "clock.h"
+#include "constants.h"
+#include "sampler.h"
+#include "log.h"
+
+namespace {
+
+inline std::size_t Hash(uintptr_t address, unsigned bits) {
+	return (std::size_t)(((uint64_t)address * 0x9e3779b97f4a7c15ull) >> (64 - bits));
+}
+
+uint32_t EnvOr(const char* name, uint32_t fallback) {
+	const char* env = getenv(name);
+	if (!env)
+		return fallback;
+	const long value = std::atol(env);
+	if (value < 0) {
+		LOG(WARNING, "Invalid %s=%s", name, env);
+		return fallback;
+	}
+	return (uint32_t)value;
+}
+
+} // namespace
+
+namespace snoop {
+
+SamplerConfig SamplerConfigFromEnv() {
+	SamplerConfig config;
+	config.rate = EnvOr("SNOOP_SAMPLE_RATE", 1);
+	if (config.rate == 0)
+		config.rate = 1;
+	config.budget = EnvOr("SNOOP_BUDGET", 0);
+	config.window_ns = (uint64_t)EnvOr("SNOOP_BUDGET_WINDOW_MS", 1000) * 1000000ull;
+	if (config.Enabled())
+		LOG(INFO, "Sampling rate=%u budget=%u window_ns=%llu", config.rate,
+				config.budget, (unsigned long long)config.window_ns);
+	return config;
+}
+
+Sampler::Sampler(const SamplerConfig& config)
+	: config_(config), countdown_(1),
+		capacity_((std::size_t)1 << constants::kSamplerTableBits), size_(0),
+		slots_(new Slot[capacity_]()) {
+}
+
+Sampler::Slot* Sampler::find_or_insert(uintptr_t address) {
+	const std::size_t mask = capacity_ - 1;
+	for (std::size_t idx = Hash(address, constants::kSamplerTableBits);;
+			idx = (idx + 1) & mask) {
+		Slot& slot = slots_[idx];
+		if (slot.address == address)
+			return &slot;
+		if (slot.address == 0) {
+			// Keep load factor under 1/2
+			if ((size_ + 1) * 2 > capacity_)
+				return nullptr;
+			slot.address = address;
+			// Budget windows only need jiffy resolution
+			slot.window_begin = clock::ReadClock(CLOCK_MONOTONIC_COARSE);
+			size_++;
+			return &slot;
+		}
+	}
+}
+
+bool Sampler::Admit(uintptr_t address, uint32_t& suppressed) {
+	Slot* slot = find_or_insert(address);
+	if (!slot)
+		return false;
+	bool admitted = --countdown_ == 0;
+	if (admitted)
+		countdown_ = config_.rate;
+	if (admitted && config_.budget > 0 && slot->hits >= config_.budget) {
+		const uint64_t now = clock::ReadClock(CLOCK_MONOTONIC_COARSE);
+		if (now - slot->window_begin >= config_.window_ns) {
+			slot->window_begin = now;
+			slot->hits = 0;
+		} else {
+			admitted = false;
+		}
+	}
+	if (!admitted) {
+		slot->suppressed++;
+		return false;
+	}
+	slot->hits++;
+	suppressed = slot->suppressed;
+	slot->suppressed = 0;
+	return true;
+}
+
+} // namespace snoop
@@ -0,0 +1,93 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include <cstdint>
+#include <memory>
+
+namespace snoop {
+
+struct SamplerConfig {
+	// Record 1 in rate calls, 1 records all
+	uint32_t rate;
+	// Calls of one function recorded per window, 0 is unlimited
+	uint32_t budget;
+	uint64_t window_ns;
+
+	bool Enabled() const { return rate > 1 || budget > 0; }
+};
+
+// SNOOP_SAMPLE_RATE=N, SNOOP_BUDGET=K and SNOOP_BUDGET_WINDOW_MS (1000)
+SamplerConfig SamplerConfigFromEnv();
+
+/**
+ * Per thread admission of calls into the trace. A call is recorded when it
+ * is the Nth call of the thread and its function has budget left in the
+ * current window. Calls not recorded are counted per function, so the
+ * totals can be written into the stream as kSuppressed records.
+ *
+ * The table does not grow, Admit runs in the hooks and must not allocate.
+ * Functions that find it full are not recorded and not counted.
+ */
+class Sampler {
+ public:
+	explicit Sampler(const SamplerConfig& config);
+	// Returns true when the call is recorded. suppressed is set to calls
+	// of address counted since it was last recorded.
+	bool Admit(uintptr_t address, uint32_t& suppressed);
+	// Visits and resets all pending suppressed counts
+	template <typename Callback>
+	void Drain(Callback callback) {
+		for (std::size_t idx = 0; idx < capacity_; idx++) {
+			Slot& slot = slots_[idx];
+			if (slot.address != 0 && slot.suppressed != 0) {
+				callback(slot.address, slot.suppressed);
+				slot.suppressed = 0;
+			}
+		}
+	}
+
+ private:
+	struct Slot {
+		uintptr_t address;
+		uint32_t hits;
+		uint32_t suppressed;
+		uint64_t window_begin;
+	};
+
+	// nullptr when the table is full
+	Slot* find_or_insert(uintptr_t address);
+
+ private:
+	SamplerConfig config_;
+	uint32_t countdown_;
+	std::size_t capacity_;
+	std::size_t size_;
+	std::unique_ptr<Slot[]> slots_;
+};
+
+} // namespace snoop
+
+#endif // __SAMPLER_H__
@@ -0,0 +1,261 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// memfd_create, mmap
+#include <sys/mman.h>
+// sendmsg, socket
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+// ftruncate, close, getuid
+#include <unistd.h>
+// getenv
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <new>
+
+#include "sharedring.h"
+#include "log.h"
+
+namespace snoop {
+
+SharedRing::SharedRing(pid_t pid, pid_t tid, std::size_t capacity)
+	: fd_(-1), size_(0), header_(nullptr), records_(nullptr),
+		capacity_(capacity), mask_(capacity - 1), head_(0), tail_(0),
+		pending_drops_(0), first_lost_(), drops_(0) {
+	const std::size_t header_size =
+		(sizeof(RingHeader) + constants::kCacheLineSize - 1) &
+		~(constants::kCacheLineSize - 1);
+	size_ = header_size + capacity * sizeof(format::Record);
+	fd_ = memfd_create("snoop-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd_ < 0) {
+		LOG(ERROR, "Failed to create ring memfd: %s", strerror(errno));
+		return;
+	}
+	if (ftruncate(fd_, size_) != 0) {
+		LOG(ERROR, "Failed to size ring memfd: %s", strerror(errno));
+		return;
+	}
+	// The collector refuses rings that could shrink under its mapping
+	if (fcntl(fd_, F_ADD_SEALS, kRingSeals) != 0) {
+		LOG(ERROR, "Failed to seal ring memfd: %s", strerror(errno));
+		return;
+	}
+	void* base = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if (base == MAP_FAILED) {
+		LOG(ERROR, "Failed to map ring: %s", strerror(errno));
+		return;
+	}
+	header_ = new (base) RingHeader();
+	std::memcpy(header_->magic, kRingMagic, sizeof(kRingMagic));
+	header_->header_size = header_size;
+	header_->capacity = capacity;
+	header_->pid = pid;
+	header_->tid = tid;
+	header_->closed.store(0, std::memory_order_relaxed);
+	header_->head.store(0, std::memory_order_relaxed);
+	header_->tail.store(0, std::memory_order_relaxed);
+	records_ = reinterpret_cast<format::Record*>(
+			static_cast<char*>(base) + header_size);
+}
+
+SharedRing::~SharedRing() {
+	unmap();
+}
+
+void SharedRing::unmap() {
+	if (header_)
+		munmap(header_, size_);
+	header_ = nullptr;
+	if (fd_ >= 0)
+		close(fd_);
+	fd_ = -1;
+}
+
+void SharedRing::push(const format::Record& record) {
+	records_[head_ & mask_] = record;
+	header_->head.store(++head_, std::memory_order_release);
+}
+
+void SharedRing::send_slow(const format::Record& record) {
+	// Marker and record go in together
+	const uint64_t needed = pending_drops_ ? 2 : 1;
+	if (head_ - tail_ + needed > capacity_)
+		tail_ = header_->tail.load(std::memory_order_acquire);
+	if (head_ - tail_ + needed > capacity_) {
+		if (pending_drops_ == 0)
+			first_lost_ = record;
+		pending_drops_++;
+		drops_++;
+		return;
+	}
+	if (pending_drops_) {
+		push(format::MakeDropMarker(first_lost_, pending_drops_));
+		pending_drops_ = 0;
+	}
+	push(record);
+}
+
+void SharedRing::Close() {
+	if (!header_)
+		return;
+	if (pending_drops_ && head_ - header_->tail.load(std::memory_order_acquire) <
+			capacity_) {
+		push(format::MakeDropMarker(first_lost_, pending_drops_));
+		pending_drops_ = 0;
+	}
+	if (drops_)
+		LOG(ERROR, "Shared ring tid=%d lost records=%lu", header_->tid,
+				(unsigned long)drops_);
+	header_->closed.store(1, std::memory_order_release);
+}
+
+void SharedRing::Abandon() {
+	unmap();
+}
+
+CollectorClient::CollectorClient() : fd_(-1) {
+}
+
+CollectorClient::~CollectorClient() {
+	if (fd_ >= 0)
+		close(fd_);
+}
+
+bool CollectorClient::Connect(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		LOG(ERROR, "Collector socket path too long path=%s", path.c_str());
+		return false;
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.size());
+	fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd_ < 0) {
+		LOG(ERROR, "Failed to create collector socket: %s", strerror(errno));
+		return false;
+	}
+	if (connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+		LOG(ERROR, "Failed to connect collector path=%s: %s", path.c_str(),
+				strerror(errno));
+		close(fd_);
+		fd_ = -1;
+		return false;
+	}
+	// Whoever listens gets the traces and the memory map
+	ucred credentials;
+	socklen_t size = sizeof(credentials);
+	if (getsockopt(fd_, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0 ||
+			credentials.uid != getuid()) {
+		LOG(ERROR, "Collector runs as another user path=%s", path.c_str());
+		close(fd_);
+		fd_ = -1;
+		return false;
+	}
+	LOG(INFO, "Connected to collector path=%s", path.c_str());
+	return true;
+}
+
+bool CollectorClient::send(const CollectorMessage& message, int fd) {
+	iovec iov = { const_cast<CollectorMessage*>(&message), sizeof(message) };
+	msghdr header;
+	std::memset(&header, 0, sizeof(header));
+	header.msg_iov = &iov;
+	header.msg_iovlen = 1;
+	char control[CMSG_SPACE(sizeof(int))];
+	if (fd >= 0) {
+		std::memset(control, 0, sizeof(control));
+		header.msg_control = control;
+		header.msg_controllen = sizeof(control);
+		cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	while (true) {
+		if (sendmsg(fd_, &header, MSG_NOSIGNAL) == (ssize_t)sizeof(message))
+			return true;
+		if (errno != EINTR)
+			break;
+	}
+	LOG(ERROR, "Failed to send collector message type=%u: %s", message.type,
+			strerror(errno));
+	return false;
+}
+
+bool CollectorClient::RegisterRing(const SharedRing& ring,
+		const format::FileHeader& header) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (fd_ < 0)
+		return false;
+	CollectorMessage message;
+	std::memset(&message, 0, sizeof(message));
+	message.type = kCollectorRing;
+	message.header = header;
+	return send(message, ring.GetFd());
+}
+
+bool CollectorClient::UpdateMap(uint64_t timestamp) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (fd_ < 0)
+		return false;
+	CollectorMessage message;
+	std::memset(&message, 0, sizeof(message));
+	message.type = kCollectorMap;
+	message.timestamp = timestamp;
+	if (!send(message, -1))
+		return false;
+	// Mappings must still be there when the collector reads them
+	pollfd reply = { fd_, POLLIN, 0 };
+	char ack = 0;
+	if (poll(&reply, 1, constants::kCollectorReplyTimeoutMs) != 1 ||
+			recv(fd_, &ack, sizeof(ack), 0) != sizeof(ack)) {
+		LOG(ERROR, "Collector did not answer memory map update");
+		return false;
+	}
+	return true;
+}
+
+void CollectorClient::Abandon() {
+	if (fd_ >= 0)
+		close(fd_);
+	fd_ = -1;
+}
+
+std::string CollectorSocketFromEnv() {
+	const char* env = getenv("SNOOP_COLLECTOR");
+	if (env && *env)
+		return env;
+	const char* runtime = getenv("XDG_RUNTIME_DIR");
+	if (runtime && *runtime)
+		return std::string(runtime) + "/" + constants::kCollectorSocket;
+	return std::string(constants::kCollectorSocketFallback) + "-" +
+		std::to_string(getuid()) + ".sock";
+}
+
+} // namespace snoop
@@ -0,0 +1,154 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __SHAREDRING_H__
+#define __SHAREDRING_H__
+
+// F_SEAL_SHRINK, F_SEAL_GROW
+#include <fcntl.h>
+// pid_t
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "constants.h"
+#include "format.h"
+
+namespace snoop {
+
+static const char kRingMagic[8] = { 'S', 'N', 'O', 'O', 'P', 'R', 'N', 'G' };
+// Seals every ring memfd carries, its size is fixed once registered
+static const int kRingSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+
+/**
+ * Start of a shared ring memfd, records follow at header_size. head is
+ * written by the traced thread only and tail by the collector only, both
+ * count records ever pushed / drained.
+ */
+struct RingHeader {
+	char magic[8];
+	uint32_t header_size;
+	// Records, power of 2
+	uint32_t capacity;
+	int32_t pid;
+	int32_t tid;
+	// Set when the thread exits, the collector drains and closes the trace
+	std::atomic<uint32_t> closed;
+	alignas(constants::kCacheLineSize) std::atomic<uint64_t> head;
+	alignas(constants::kCacheLineSize) std::atomic<uint64_t> tail;
+};
+
+// Messages on the collector socket (SOCK_SEQPACKET)
+enum CollectorMessageType : uint32_t {
+	// Ring memfd attached with SCM_RIGHTS, header is its trace file header
+	kCollectorRing = 0,
+	// Start a memory map epoch at timestamp, answered with one byte
+	kCollectorMap = 1,
+};
+
+struct CollectorMessage {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t timestamp;
+	format::FileHeader header;
+};
+
+/**
+ * Single producer ring in a memfd mapped by the traced thread and by
+ * snoop-collector. A full ring drops records and reports them with a
+ * kDropped marker once space frees up, the thread never waits.
+ */
+class SharedRing {
+ public:
+	// capacity must be a power of 2. Check Valid().
+	SharedRing(pid_t pid, pid_t tid, std::size_t capacity);
+	~SharedRing();
+	bool Valid() const { return header_ != nullptr; }
+	int GetFd() const { return fd_; }
+	void Send(const format::Record& record) {
+		if (head_ - tail_ < capacity_ && pending_drops_ == 0) {
+			records_[head_ & mask_] = record;
+			header_->head.store(++head_, std::memory_order_release);
+			return;
+		}
+		send_slow(record);
+	}
+	// Thread exited - the collector drains what is left
+	void Close();
+	// Forked child - the mapping still belongs to the parent's thread
+	void Abandon();
+	uint64_t DropCount() const { return drops_; }
+
+ private:
+	SharedRing(const SharedRing&) = delete;
+	void send_slow(const format::Record& record);
+	void push(const format::Record& record);
+	void unmap();
+
+ private:
+	int fd_;
+	std::size_t size_;
+	RingHeader* header_;
+	format::Record* records_;
+	uint64_t capacity_;
+	uint64_t mask_;
+	// head_ is ours, tail_ is the collector's as last read
+	uint64_t head_;
+	uint64_t tail_;
+	uint64_t pending_drops_;
+	format::Record first_lost_;
+	uint64_t drops_;
+};
+
+// Connection of a traced process to snoop-collector
+class CollectorClient {
+ public:
+	CollectorClient();
+	~CollectorClient();
+	// Fails unless the collector runs as the same user
+	bool Connect(const std::string& path);
+	bool RegisterRing(const SharedRing& ring, const format::FileHeader& header);
+	// Waits until the collector wrote the epoch
+	bool UpdateMap(uint64_t timestamp);
+	// Forked child - closes the inherited socket without locking
+	void Abandon();
+
+ private:
+	CollectorClient(const CollectorClient&) = delete;
+	bool send(const CollectorMessage& message, int fd);
+
+ private:
+	std::mutex mutex_;
+	int fd_;
+};
+
+// SNOOP_COLLECTOR socket path, constants::kCollectorSocket in
+// XDG_RUNTIME_DIR by default
+std::string CollectorSocketFromEnv();
+
+} // namespace snoop
+
+#endif // __SHAREDRING_H__
@@ -0,0 +1,182 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// open, ftruncate, posix_fallocate, mmap
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+// getenv
+#include <stdlib.h>
+// strcmp, strerror
+#include <string.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "asyncsink.h"
+#include "constants.h"
+#include "log.h"
+#include "sink.h"
+
+namespace snoop {
+
+StreamSink::StreamSink(const char* name) : size_(0) {
+	stream_.open(name, std::ios::out | std::ios::binary | std::ios::app);
+	if (!stream_)
+		LOG(ERROR, "Failed to open stream sink name=%s", name);
+	const std::streamoff pos = stream_.tellp();
+	if (pos > 0)
+		size_ = pos;
+}
+
+StreamSink::~StreamSink() {
+	stream_.close();
+}
+
+bool StreamSink::Write(const void* data, std::size_t size) {
+	stream_.write(reinterpret_cast<const char*>(data), size);
+	size_ += size;
+	return stream_.good();
+}
+
+uint64_t StreamSink::Size() const {
+	return size_;
+}
+
+MappedSink::MappedSink(const char* name, std::size_t window_size)
+	: name_(name), fd_(-1), window_size_(window_size), window_offset_(0),
+	  window_(nullptr), size_(0) {
+	const long page_size = sysconf(_SC_PAGESIZE);
+	// Window must be page aligned to map at page aligned offsets
+	window_size_ = (window_size_ + page_size - 1) / page_size * page_size;
+	fd_ = open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd_ < 0) {
+		LOG(ERROR, "Failed to open mapped sink name=%s err=%s", name, strerror(errno));
+		return;
+	}
+	struct stat st;
+	if (fstat(fd_, &st) == 0)
+		size_ = st.st_size;
+	if (!map_window(size_ / page_size * page_size))
+		fall_back();
+	LOG(INFO, "MappedSink name=%s window=%zu", name, window_size_);
+}
+
+MappedSink::~MappedSink() {
+	unmap_window();
+	if (fd_ >= 0) {
+		// Drop unused tail of the last window
+		if (ftruncate(fd_, size_) != 0)
+			LOG(ERROR, "Failed to truncate mapped sink err=%s", strerror(errno));
+		close(fd_);
+	}
+}
+
+bool MappedSink::map_window(uint64_t offset) {
+	unmap_window();
+	// Blocks are allocated now - a sparse tail would SIGBUS on a full disk
+	const int ret = posix_fallocate(fd_, offset, window_size_);
+	if (ret != 0) {
+		LOG(ERROR, "Failed to grow mapped sink err=%s", strerror(ret));
+		return false;
+	}
+	void* window = mmap(nullptr, window_size_, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd_, offset);
+	if (window == MAP_FAILED) {
+		LOG(ERROR, "Failed to map sink window err=%s", strerror(errno));
+		return false;
+	}
+	window_ = static_cast<char*>(window);
+	window_offset_ = offset;
+	return true;
+}
+
+void MappedSink::unmap_window() {
+	if (!window_)
+		return;
+	// Writeback is left to the kernel - no msync on the writer path
+	munmap(window_, window_size_);
+	window_ = nullptr;
+}
+
+void MappedSink::fall_back() {
+	unmap_window();
+	if (fd_ < 0)
+		return;
+	// Drop the allocated tail, the stream appends at size_
+	if (ftruncate(fd_, size_) != 0)
+		LOG(ERROR, "Failed to truncate mapped sink err=%s", strerror(errno));
+	close(fd_);
+	fd_ = -1;
+	LOG(WARNING, "Mapped sink name=%s falls back to stream", name_.c_str());
+	fallback_.reset(new StreamSink(name_.c_str()));
+}
+
+bool MappedSink::Write(const void* data, std::size_t size) {
+	if (fallback_)
+		return fallback_->Write(data, size);
+	const char* src = static_cast<const char*>(data);
+	while (size > 0) {
+		if (!window_)
+			return false;
+		const uint64_t window_end = window_offset_ + window_size_;
+		if (size_ == window_end) {
+			if (!map_window(window_end)) {
+				fall_back();
+				return fallback_ && fallback_->Write(src, size);
+			}
+			continue;
+		}
+		const std::size_t chunk = std::min<uint64_t>(size, window_end - size_);
+		std::memcpy(window_ + (size_ - window_offset_), src, chunk);
+		size_ += chunk;
+		src += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+uint64_t MappedSink::Size() const {
+	return fallback_ ? fallback_->Size() : size_;
+}
+
+std::unique_ptr<Sink> MakeSink(const char* name) {
+	const char* sink = getenv("SNOOP_SINK");
+	if (sink && strcmp(sink, "mmap") == 0) {
+		std::size_t window_size = constants::kMappedWindowSize;
+		if (const char* window_env = getenv("SNOOP_MMAP_WINDOW_MB"))
+			window_size = std::atol(window_env) << 20;
+		if (window_size == 0)
+			window_size = constants::kMappedWindowSize;
+		return std::unique_ptr<Sink>(new MappedSink(name, window_size));
+	}
+	if (sink && strcmp(sink, "async") == 0)
+		return MakeAsyncSink(name);
+	if (sink && strcmp(sink, "stream") != 0)
+		LOG(WARNING, "Unknown SNOOP_SINK=%s, using stream", sink);
+	return std::unique_ptr<Sink>(new StreamSink(name));
+}
+
+} // namespace snoop
@@ -0,0 +1,95 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __SINK_H__
+#define __SINK_H__
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+
+namespace snoop {
+
+// Destination of one trace file. Appends only.
+class Sink {
+ public:
+	virtual ~Sink() {};
+	virtual bool Write(const void* data, std::size_t size) = 0;
+	// Bytes in file, including data present before it was opened
+	virtual uint64_t Size() const = 0;
+};
+
+class StreamSink : public Sink {
+ public:
+	explicit StreamSink(const char* name);
+	~StreamSink();
+	// Sink
+	bool Write(const void* data, std::size_t size) override;
+	uint64_t Size() const override;
+ private:
+	std::ofstream stream_;
+	uint64_t size_;
+};
+
+/**
+ * Writes into MAP_SHARED windows of the file. Each window is allocated
+ * with posix_fallocate before it is mapped, so a write is a memcpy into
+ * page cache with no syscall and no stream lock, and a full disk fails the
+ * allocation instead of raising SIGBUS on a store. When a window cannot be
+ * allocated or mapped the rest of the trace goes through a StreamSink.
+ * Data survives a crash of the traced process (not of the host) - on a
+ * crash the file keeps the zero filled tail of the last window, which
+ * readers treat as end of trace.
+ */
+class MappedSink : public Sink {
+ public:
+	MappedSink(const char* name, std::size_t window_size);
+	~MappedSink();
+	// Sink
+	bool Write(const void* data, std::size_t size) override;
+	uint64_t Size() const override;
+ private:
+	bool map_window(uint64_t offset);
+	void unmap_window();
+	// Trims the file to size_ and appends through a StreamSink from now on
+	void fall_back();
+ private:
+	std::string name_;
+	std::unique_ptr<StreamSink> fallback_;
+	int fd_;
+	std::size_t window_size_;
+	// File offset of mapped window
+	uint64_t window_offset_;
+	char* window_;
+	// Logical end of file
+	uint64_t size_;
+};
+
+// SNOOP_SINK=stream (default), mmap or async (see asyncsink.h).
+// SNOOP_MMAP_WINDOW_MB sets mmap window size.
+std::unique_ptr<Sink> MakeSink(const char* name);
+
+} // namespace snoop
+
+#endif // __SINK_H__
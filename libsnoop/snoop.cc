@@ -23,6 +23,10 @@ SOFTWARE.
 */
 // getpid, gettid
 #include <sys/syscall.h>
+// PR_SET_PTRACER
+#include <sys/prctl.h>
+// socketpair
+#include <sys/socket.h>
 // open, read, write
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -30,9 +34,15 @@ SOFTWARE.
 
 // exit
 #include <unistd.h>
+// getenv
+#include <stdlib.h>
+// pthread_setaffinity_np
+#include <pthread.h>
+#include <sched.h>
 // strdup
 #include <string.h>
 
+#include <algorithm>
 #include <string>
 
 #include "tracer.h"
@@ -42,34 +52,7 @@ SOFTWARE.
 namespace {
 
 static const char* kExt = ".snoop";
-static const char* kMapExt = ".map";
-
-bool CopyUpdate(const std::string& src, const std::string& dst) {
-	static std::vector<std::string> lines = {};
-	if (lines.empty()) {
-		std::ifstream dst_str_r(dst);
-		std::string dst_line;
-		while (std::getline(dst_str_r, dst_line))
-			lines.push_back(dst_line);
-	}
-	std::ifstream src_str(src);
-	std::ofstream dst_str(dst, std::ios::app | std::ios::out);
-	std::string line;
-	while (std::getline(src_str, line)) {
-		bool exists = false;
-		for (auto old_line : lines) {
-			if (old_line == line) {
-				exists = true;
-				break;
-			}
-		}
-		if (!exists) {
-			lines.push_back(line);
-			dst_str << line << std::endl;
-		}
-	}
-	return true;
-}
+static const char* kProfileExt = ".profile";
 
 bool Copy(const char* src, const char* dst) {
 	int src_fd = open(src, O_RDONLY);
@@ -121,24 +104,43 @@ bool Copy(const char* src, const char* dst) {
 }
 
 pid_t SpawnTracer(pid_t pid) {
+	int control[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, control) == -1) {
+		LOG(ERROR, "Failed to create tracer control socket: %s", strerror(errno));
+		return 0;
+	}
 	pid_t tracer_pid = fork();
 	if (tracer_pid == 0) {
+		close(control[0]);
 #if defined(SNOOP_TRACER_USE_EXECVE)
+		// Control socket is inherited by the tracer binary
+		fcntl(control[1], F_SETFD, 0);
 		std::string name = "tracer";
 		std::string param1 = std::to_string(pid);
+		std::string param2 = std::to_string(control[1]);
 		std::vector<char *> params;
 		params.push_back(strdup(name.c_str()));
 		params.push_back(strdup(param1.c_str()));
+		params.push_back(strdup(param2.c_str()));
 		params.push_back(NULL);
 		execv("./tracer", params.data());
 #else
-		do_trace(pid);
-		std::exit(EXIT_SUCCESS);
+		do_trace(pid, control[1]);
+		// Forked inside ThreadManager construction - running exit handlers
+		// would re-enter it from the DSO destructor
+		_exit(EXIT_SUCCESS);
 #endif // TRACER_USE_EXECVE
 	} else if (tracer_pid > 0) {
+		close(control[1]);
 		LOG(INFO, "Tracer process started tracer_pid=%d pid=%d", tracer_pid, pid);
+		// Yama only lets ancestors attach - the tracer is our child
+		prctl(PR_SET_PTRACER, tracer_pid, 0, 0, 0);
+		AcceptTracer(control[0]);
+		close(control[0]);
 		return tracer_pid;
 	} else {
+		close(control[0]);
+		close(control[1]);
 		LOG(ERROR, "Fail to spawn tracer process for pid=%d", pid);
 		return 0;
 	}
@@ -148,6 +150,58 @@ std::string MemoryMapFileName(pid_t pid) {
 	return std::string("/proc/") + std::to_string(pid) + std::string("/maps");
 }
 
+std::vector<int> ParseCpuList(const std::string& list) {
+	std::vector<int> cpus;
+	std::size_t pos = 0;
+	while (pos < list.size()) {
+		std::size_t end = list.find(',', pos);
+		if (end == std::string::npos)
+			end = list.size();
+		const std::string item = list.substr(pos, end - pos);
+		const std::size_t dash = item.find('-');
+		try {
+			if (dash == std::string::npos) {
+				cpus.push_back(std::stoi(item));
+			} else {
+				const int first = std::stoi(item.substr(0, dash));
+				const int last = std::stoi(item.substr(dash + 1));
+				for (int cpu = first; cpu <= last; cpu++)
+					cpus.push_back(cpu);
+			}
+		} catch (const std::exception&) {
+			LOG(WARNING, "Ignoring malformed cpu list item=%s", item.c_str());
+		}
+		pos = end + 1;
+	}
+	return cpus;
+}
+
+std::vector<int> NodeCpuList(int node) {
+	std::ifstream cpulist(std::string("/sys/devices/system/node/node") +
+			std::to_string(node) + "/cpulist");
+	std::string line;
+	if (!std::getline(cpulist, line)) {
+		LOG(WARNING, "Failed to read cpus of numa node=%d", node);
+		return {};
+	}
+	return ParseCpuList(line);
+}
+
+bool PinThread(std::thread& thread, const std::vector<int>& cpus) {
+	if (cpus.empty())
+		return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (auto cpu : cpus)
+		CPU_SET(cpu, &set);
+	const int ret = pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+	if (ret != 0) {
+		LOG(WARNING, "Failed to pin thread err=%s", strerror(ret));
+		return false;
+	}
+	return true;
+}
+
 /**
  * Reentry of same thread in instrument function will lead to infinite
  * recursion. It means instrumentation of some call that was not
@@ -169,12 +223,21 @@ thread_local bool g_tl_reentry_guard = false;
 
 thread_local snoop::ThreadObserver g_tl_observer;
 
+// Set once hooks created the manager - programs merely linked against
+// libsnoop (snoop-collector, benchmarks) have nothing to flush at exit
+std::atomic_bool g_manager_created(false);
+
+void AtForkChild() {
+	snoop::ThreadManager::GetInstance().AfterFork();
+	g_tl_observer.AfterFork();
+}
+
 }; // namespace
 
 namespace snoop {
 
 bool DumpMemoryMapFile(pid_t pid) {
-	std::string name = std::to_string(pid) + kMapExt;
+	const std::string name = MemoryMap::FileName(pid);
 	if (!Copy(MemoryMapFileName(pid).c_str(), name.c_str())) {
 		LOG(ERROR, "Failed to copy memory map file");
 		return false;
@@ -182,30 +245,217 @@ bool DumpMemoryMapFile(pid_t pid) {
 	return true;
 }
 
-bool UpdateMemoryMapFile(pid_t pid) {
-	std::string name = std::to_string(pid) + kMapExt;
-	if (!CopyUpdate(MemoryMapFileName(pid), name)) {
-		LOG(ERROR, "Failed to copy memory map file");
+bool UpdateMemoryMapFile(pid_t pid, uint64_t timestamp) {
+	if (!MemoryMap::Get(pid).Update(timestamp)) {
+		LOG(ERROR, "Failed to update memory map file");
 		return false;
 	}
 	return true;
 }
 
-StreamingBucketHandler::StreamingBucketHandler(const char* name) {
-	stream_.open(name, std::ios::out | std::ios::binary | std::ios::app);
-	LOG(INFO, "StreamingBucketHandler name=%s", name);
+void PollModules() {
+	// snoop-collector links libsnoop too, its own modules are of no interest
+	if (g_exiting || !g_manager_created.load(std::memory_order_relaxed))
+		return;
+	const uint64_t now = clock::Now();
+	uint64_t since = 0;
+	bool loaded = false;
+	if (!ModuleTable::GetInstance().Poll(now, since, loaded))
+		return;
+	// A loaded module may have run since the previous poll, code of an
+	// unloaded one ran until it was noticed
+	ThreadManager::GetInstance().UpdateMemoryMap(loaded ? since : now);
+}
+
+StreamingBucketHandler::StreamingBucketHandler(std::unique_ptr<Sink> sink,
+		const format::FileHeader& header, format::Compression compression,
+		AddressMode address_mode, bool fold_repeats)
+	: sink_(std::move(sink)), map_(MemoryMap::Get(header.pid)),
+		timed_(header.clock_source != clock::kNone), epoch_(0),
+		address_mode_(address_mode), module_id_(0), module_changes_(0),
+		fold_repeats_(fold_repeats) {
+	if (compression != format::kCompressionNone)
+		encoder_.reset(new format::BlockEncoder(compression));
+	// Reused tid appends to existing file - header is written only once
+	if (sink_->Size() == 0)
+		write(&header, sizeof(header));
 }
 StreamingBucketHandler::~StreamingBucketHandler() {
-	stream_.close();
+}
+
+uint64_t StreamingBucketHandler::BytesWritten() const {
+	return bytes_.Get();
+}
+
+void StreamingBucketHandler::write(const void* data, std::size_t size) {
+	sink_->Write(data, size);
+	bytes_.Add(size);
+}
+
+void StreamingBucketHandler::write_modules() {
+	modules_.clear();
+	module_id_ = ModuleTable::GetInstance().Serialize(module_id_, modules_);
+	if (modules_.empty())
+		return;
+	format::BlockHeader header = format::MakeBlockHeader(0);
+	header.payload_size = modules_.size();
+	header.flags = format::kBlockModules;
+	write(&header, sizeof(header));
+	write(modules_.data(), modules_.size());
+}
+
+std::size_t StreamingBucketHandler::write_epoch(const format::Record* records,
+		std::size_t count) {
+	uint64_t next = UINT64_MAX;
+	const uint32_t epoch =
+		timed_ ? map_.EpochAt(records[0].timestamp, next) : map_.Epoch();
+	// Buckets rarely span a dlopen or dlclose
+	std::size_t span = count;
+	if (records[count - 1].timestamp >= next) {
+		span = 1;
+		while (span < count && records[span].timestamp < next)
+			span++;
+	}
+	if (epoch != epoch_) {
+		epoch_ = epoch;
+		const format::EpochEntry entry = { epoch, 0 };
+		format::BlockHeader header = format::MakeBlockHeader(0);
+		header.payload_size = sizeof(entry);
+		header.flags = format::kBlockEpoch;
+		write(&header, sizeof(header));
+		write(&entry, sizeof(entry));
+	}
+	return span;
+}
+
+void StreamingBucketHandler::write_records(const format::Record* records,
+		std::size_t count) {
+	format::BlockHeader header = format::MakeBlockHeader(count);
+	if (fold_repeats_ && format::FoldRepeats(records, count, folded_) < count) {
+		// record_count stays the expanded count
+		records = folded_.data();
+		count = folded_.size();
+		header.payload_size = count * sizeof(format::Record);
+		header.flags |= format::kBlockRepeat;
+	}
+	if (encoder_) {
+		header.flags |= encoder_->Encode(records, count);
+		header.payload_size = encoder_->Size();
+		write(&header, sizeof(header));
+		write(encoder_->Data(), header.payload_size);
+		return;
+	}
+	write(&header, sizeof(header));
+	write(records, header.payload_size);
 }
 
 void StreamingBucketHandler::OnMessageBucket(MessageBucket& bucket) {
 	if (bucket.empty()) {
 		return;
 	}
-	stream_.write(reinterpret_cast<const char*>(bucket.data()),
-								sizeof(uintptr_t) * bucket.size());
-	bucket.clear();
+	// Epoch of a module loaded since the last poll exists before records
+	// calling into it are written
+	PollModules();
+	// Records were translated by ModuleCache of the sending thread, so
+	// the table already holds every module they refer to. Module records
+	// are sent after ChangeCount moves.
+	const uint32_t module_changes = ModuleTable::GetInstance().ChangeCount();
+	if (address_mode_ == kAddressModule || module_changes != module_changes_) {
+		module_changes_ = module_changes;
+		write_modules();
+	}
+	const format::Record* records = bucket.data();
+	std::size_t count = bucket.size();
+	// Module addresses do not depend on the memory map
+	if (address_mode_ == kAddressModule) {
+		write_records(records, count);
+		return;
+	}
+	while (count > 0) {
+		const std::size_t span = write_epoch(records, count);
+		write_records(records, span);
+		records += span;
+		count -= span;
+	}
+}
+
+Writer::Writer(std::size_t index) : channel_count_(0), index_(index) {
+}
+
+void Writer::Notify() {
+	wakeup_.Signal();
+}
+
+void Writer::AddChannel(std::shared_ptr<Channel> channel) {
+	std::lock_guard<std::mutex> lock(channels_mutex_);
+	channels_.push_back(channel);
+	channel_count_.store(channels_.size(), std::memory_order_relaxed);
+	channel->RegisterConsumer(this);
+}
+
+bool Writer::RemoveChannel(std::shared_ptr<Channel> channel) {
+	std::lock_guard<std::mutex> lock(channels_mutex_);
+	auto channel_iterator =
+		std::find(channels_.begin(), channels_.end(), channel);
+	if (channel_iterator == channels_.end())
+		return false;
+	(*channel_iterator)->Finalize();
+	channels_.erase(channel_iterator);
+	channel_count_.store(channels_.size(), std::memory_order_relaxed);
+	return true;
+}
+
+std::size_t Writer::ChannelCount() const {
+	// Does not wait for a writer busy with disk I/O
+	return channel_count_.load(std::memory_order_relaxed);
+}
+
+bool Writer::snapshot(std::vector<std::shared_ptr<Channel>>& channels, bool wait) {
+	std::unique_lock<std::mutex> lock(channels_mutex_, std::defer_lock);
+	if (wait)
+		lock.lock();
+	else if (!lock.try_lock())
+		return false;
+	channels = channels_;
+	return true;
+}
+
+std::size_t Writer::Receive() {
+	// Drained outside of channels_mutex_ so a busy owner does not keep
+	// thieves out - TryReceive keeps each channel to one writer
+	static thread_local std::vector<std::shared_ptr<Channel>> channels;
+	snapshot(channels, true);
+	std::size_t count = 0;
+	for (auto& channel : channels)
+		count += channel->TryReceive();
+	channels.clear();
+	return count;
+}
+
+std::size_t Writer::Steal(Writer& victim) {
+	// Never wait for a shard being changed, only copied while locked
+	static thread_local std::vector<std::shared_ptr<Channel>> channels;
+	if (!victim.snapshot(channels, false))
+		return 0;
+	std::size_t count = 0;
+	for (auto& channel : channels) {
+		if (channel->Backlog() >= constants::kStealBacklog)
+			count += channel->TryReceive();
+	}
+	channels.clear();
+	return count;
+}
+
+void Writer::Finalize() {
+	std::lock_guard<std::mutex> lock(channels_mutex_);
+	for (auto& channel : channels_) {
+		LOG(INFO, "Finalize leftover channel name=%s", channel->GetName());
+		channel->Finalize();
+	}
+}
+
+void Writer::Wait() {
+	wakeup_.Wait(constants::kProcessingPollPeriodNs);
 }
 
 //static
@@ -214,10 +464,6 @@ ThreadManager& ThreadManager::GetInstance() {
 	return instance;
 }
 
-void ThreadManager::Notify() {
-	notify();
-}
-
 void ThreadManager::RegisterChannel(std::shared_ptr<Channel> channel) {
 	std::lock_guard<std::mutex> lock(internal_state_mutex_);
 	LOG(INFO, "Register channel name=%s pid=%d", channel->GetName(), pid_);
@@ -228,34 +474,53 @@ void ThreadManager::RegisterChannel(std::shared_ptr<Channel> channel) {
 		LOG(ERROR, "Failed to construct channel listener name");
 		return;
 	}
-	channels_.push_back(channel);
+	format::FileHeader header =
+		format::MakeFileHeader(pid_, channel->GetId(), calibration_);
+	if (address_mode_ == kAddressModule)
+		header.flags |= format::kFileModuleAddress;
+	LOG(INFO, "StreamingBucketHandler name=%s", name);
 	std::unique_ptr<StreamingBucketHandler> listener(
-			new StreamingBucketHandler(name));
+			new StreamingBucketHandler(MakeSink(name), header, compression_,
+				address_mode_, fold_repeats_));
 	channel->RegisterListener(std::move(listener));
-	channel->RegisterConsumer(this);
+	// Least loaded shard
+	Writer* target = writers_.front().get();
+	std::size_t target_count = target->ChannelCount();
+	for (auto& writer : writers_) {
+		const std::size_t count = writer->ChannelCount();
+		if (count < target_count) {
+			target = writer.get();
+			target_count = count;
+		}
+	}
+	target->AddChannel(channel);
 }
 
 void ThreadManager::UnregisterChannel(std::shared_ptr<Channel> channel) {
+	if (!channel)
+		return;
 	std::lock_guard<std::mutex> lock(internal_state_mutex_);
 	LOG(INFO, "Unregister channel name=%s pid=%d", channel->GetName(), pid_);
-	auto channel_iterator =
-		std::find(channels_.begin(), channels_.end(), channel);
-	if (channel_iterator != channels_.end()) {
-		(*channel_iterator)->Finalize();
-		channels_.erase(channel_iterator);
+	for (auto& writer : writers_) {
+		if (writer->RemoveChannel(channel)) {
+			format::StatsThread thread;
+			collect_stats(*channel, 0, thread);
+			format::Accumulate(stats_exited_, thread.counters);
+			threads_exited_++;
+			return;
+		}
 	}
 }
 
 void ThreadManager::ReceiveChannels() {
 	std::lock_guard<std::mutex> lock(internal_state_mutex_);
-	for (auto channel : channels_) {
-		channel->Receive();
-	}
+	for (auto& writer : writers_)
+		writer->Receive();
 }
 
 void ThreadManager::notify() {
-	std::lock_guard<std::mutex> lock(processing_mutex_);
-	processing_condition_.notify_one();
+	for (auto& writer : writers_)
+		writer->Notify();
 }
 
 void ThreadManager::close() {
@@ -267,23 +532,225 @@ bool ThreadManager::should_exit() {
 	return exit_flag_.load(std::memory_order_acquire);
 }
 
-ThreadManager::ThreadManager() : exit_flag_(false), pid_(getpid()) {
+void ThreadManager::process(Writer& writer) {
+	LOG(INFO, "Processing thread started writer=%zu", writer.GetIndex());
+	// Inline code the program instruments runs here too, partly under
+	// ModuleTable's lock - writers are never traced
+	g_tl_reentry_guard = true;
+	while(true) {
+		if (should_exit()) {
+			LOG(INFO, "Processing thread exiting pid=%d writer=%zu", pid_,
+					writer.GetIndex());
+			return;
+		}
+		// Objects loaded by threads making few calls are noticed here
+		if (writer.GetIndex() == 0)
+			PollModules();
+		std::size_t count = writer.Receive();
+		for (auto& victim : writers_) {
+			if (victim.get() != &writer)
+				count += writer.Steal(*victim);
+		}
+		if (stats_ && writer.GetIndex() == 0)
+			maybe_publish_stats();
+		// Keep going while there is work, own or stolen
+		if (count == 0)
+			writer.Wait();
+	}
+}
+
+void ThreadManager::maybe_publish_stats() {
+	const uint64_t now = clock::ReadClock(CLOCK_MONOTONIC);
+	if (now < stats_due_ns_)
+		return;
+	stats_due_ns_ = now + stats_config_.period_ns;
+	publish_stats();
+}
+
+void ThreadManager::publish_stats() {
+	// Counters are atomics - locks are held only to copy the channel lists,
+	// never while reading them or writing the page
+	std::vector<std::shared_ptr<Channel>> channels;
+	format::StatsCounters exited;
+	uint32_t threads_exited;
+	{
+		// Exited totals and live channels consistent with each other
+		std::lock_guard<std::mutex> lock(internal_state_mutex_);
+		exited = stats_exited_;
+		threads_exited = threads_exited_;
+		std::vector<std::shared_ptr<Channel>> shard;
+		for (auto& writer : writers_) {
+			writer->snapshot(shard, true);
+			channels.insert(channels.end(), shard.begin(), shard.end());
+		}
+	}
+	const uint64_t now = clock::ReadClock(CLOCK_MONOTONIC);
+	stats_->Update([&](format::StatsHeader& header, format::StatsThread* threads,
+				std::size_t capacity) {
+		header.update_ns = now;
+		header.threads_exited = threads_exited;
+		header.writers = writers_.size();
+		header.total = exited;
+		uint32_t count = 0;
+		for (auto& channel : channels) {
+			format::StatsThread thread;
+			collect_stats(*channel, now, thread);
+			format::Accumulate(header.total, thread.counters);
+			if (count < capacity)
+				threads[count++] = thread;
+		}
+		header.thread_count = count;
+	});
+}
+
+void ThreadManager::collect_stats(const Channel& channel, uint64_t now_ns,
+		format::StatsThread& thread) const {
+	std::memset(&thread, 0, sizeof(thread));
+	const ProducerStats& producer = channel.GetProducerStats();
+	const ConsumerStats& consumer = channel.GetConsumerStats();
+	thread.tid = channel.GetId();
+	thread.backlog = channel.Backlog();
+	thread.backlog_max = consumer.backlog_max.Get();
+	const uint64_t timestamp = consumer.timestamp.Get();
+	if (now_ns && thread.backlog && timestamp && calibration_.source != clock::kNone) {
+		const double written_ns = calibration_.ns_base +
+			((double)timestamp - (double)calibration_.tick_base) * calibration_.ns_per_tick;
+		if (written_ns < (double)now_ns)
+			thread.lag_ns = now_ns - (uint64_t)written_ns;
+	}
+	format::StatsCounters& counters = thread.counters;
+	counters.events = producer.events.Get();
+	counters.buckets = producer.buckets.Get();
+	counters.drops = producer.drops.Get();
+	counters.blocks = consumer.blocks.Get();
+	counters.bytes = channel.BytesWritten();
+	consumer.write_ns.CopyTo(counters.write_ns);
+	producer.send_ns.CopyTo(counters.send_ns);
+}
+
+void ThreadManager::start_writers() {
+	const char* writers_env = getenv("SNOOP_WRITERS");
+	long writers = writers_env ? std::atol(writers_env) : 1;
+	if (writers < 1 || writers > constants::kWritersMax) {
+		LOG(WARNING, "Invalid SNOOP_WRITERS=%s", writers_env);
+		writers = 1;
+	}
+	std::vector<int> cpus;
+	std::vector<int> nodes;
+	if (const char* cpus_env = getenv("SNOOP_WRITER_CPUS"))
+		cpus = ParseCpuList(cpus_env);
+	if (const char* nodes_env = getenv("SNOOP_WRITER_NODES"))
+		nodes = ParseCpuList(nodes_env);
+	// All writers exist before any thread starts - they steal from each other
+	for (long idx = 0; idx < writers; idx++)
+		writers_.emplace_back(new Writer(idx));
+	for (auto& writer : writers_) {
+		Writer* target = writer.get();
+		writer->thread_ = std::thread([this, target]() { process(*target); });
+		const std::size_t idx = writer->GetIndex();
+		if (!cpus.empty())
+			PinThread(writer->thread_, { cpus[idx % cpus.size()] });
+		else if (!nodes.empty())
+			PinThread(writer->thread_, NodeCpuList(nodes[idx % nodes.size()]));
+	}
+	LOG(INFO, "Started writers=%ld", writers);
+}
+
+ThreadManager::ThreadManager()
+	: exit_flag_(false), pid_(getpid()), profile_threads_(0), stats_due_ns_(0),
+		threads_exited_(0) {
+	std::memset(&stats_exited_, 0, sizeof(stats_exited_));
 	LOG(INFO, "Creating thread manager pid=%d", pid_);
+	clock::Initialize();
+	calibration_ = clock::Calibrate();
+	compression_ = format::CompressionFromEnv();
+	address_mode_ = AddressModeFromEnv();
+	fold_repeats_ = format::FoldRepeatsFromEnv();
+	mode_ = ModeFromEnv();
+	sampler_config_ = SamplerConfigFromEnv();
+	overflow_config_ = OverflowConfigFromEnv();
 #if defined(SNOOP_SPAWN_TRACER)
 	SpawnTracer(pid_);
 #endif
-	processing_thread_ = std::thread([this]() {
-		LOG(INFO, "Processing thread started");
-		std::unique_lock<std::mutex> lock(processing_mutex_);
-		while(true) {
-			processing_condition_.wait(lock);
-			if (should_exit()) {
-				LOG(INFO, "Processing thread exiting pid=%d", pid_);
-				return;
-			}
-			ReceiveChannels();
+	g_manager_created.store(true);
+	if (mode_ == kModeCollector && !start_collector()) {
+		LOG(ERROR, "Collector unavailable, tracing in process");
+		mode_ = kModeTrace;
+	}
+	// Objects loaded so far are not reported as loads
+	ModuleTable::GetInstance();
+	// First epoch covers everything recorded before the next dlopen
+	UpdateMemoryMap(0);
+	// Profile and flight modes do no I/O until exit or a trigger
+	if (mode_ == kModeProfile) {
+		profile_.reset(new ProfileTable());
+	} else if (mode_ == kModeFlight) {
+		flight_.reset(new FlightRecorder([this](uint32_t sequence,
+					const std::vector<std::shared_ptr<FlightRing>>& rings) {
+				dump_flight(sequence, rings);
+			}));
+	} else if (mode_ == kModeTrace) {
+		stats_config_ = StatsConfigFromEnv();
+		if (stats_config_.mode != kStatsOff) {
+			stats_.reset(new StatsPage());
+			if (!stats_->Open(stats_config_.mode, pid_))
+				stats_.reset();
 		}
-	});
+		start_writers();
+	}
+}
+
+bool ThreadManager::start_collector() {
+	collector_.reset(new CollectorClient());
+	if (!collector_->Connect(CollectorSocketFromEnv())) {
+		collector_.reset();
+		return false;
+	}
+	// The collector has no module table of this process
+	if (address_mode_ == kAddressModule) {
+		LOG(WARNING, "Collector traces use absolute addresses");
+		address_mode_ = kAddressAbsolute;
+	}
+	pthread_atfork(nullptr, nullptr, &AtForkChild);
+	return true;
+}
+
+void ThreadManager::AfterFork() {
+	pid_ = getpid();
+	if (!collector_)
+		return;
+	// A parent thread that is gone now may have held its lock
+	collector_->Abandon();
+	collector_.release();
+	collector_.reset(new CollectorClient());
+	if (!collector_->Connect(CollectorSocketFromEnv())) {
+		collector_.reset();
+		return;
+	}
+	UpdateMemoryMap(0);
+}
+
+std::unique_ptr<SharedRing> ThreadManager::CreateSharedRing(pid_t tid) {
+	std::unique_ptr<SharedRing> ring(
+			new SharedRing(pid_, tid, constants::kCollectorRingRecords));
+	if (!ring->Valid())
+		return nullptr;
+	const format::FileHeader header = format::MakeFileHeader(pid_, tid, calibration_);
+	if (!collector_ || !collector_->RegisterRing(*ring, header))
+		LOG(ERROR, "Ring not registered, records of tid=%d are lost", tid);
+	return ring;
+}
+
+void ThreadManager::UpdateMemoryMap(uint64_t timestamp) {
+#if defined(SNOOP_SPAWN_TRACER)
+	// The tracer owns the map file
+	(void)timestamp;
+#else
+	if (collector_)
+		collector_->UpdateMap(timestamp);
+	else
+		UpdateMemoryMapFile(getpid(), timestamp);
+#endif
 }
 
 ThreadManager::~ThreadManager() {
@@ -291,20 +758,145 @@ ThreadManager::~ThreadManager() {
 	snoop::ThreadManager::GetInstance().Deinitialize();
 }
 
+AddressMode ThreadManager::GetAddressMode() const {
+	return address_mode_;
+}
+
+Mode ThreadManager::GetMode() const {
+	return mode_;
+}
+
+const SamplerConfig& ThreadManager::GetSamplerConfig() const {
+	return sampler_config_;
+}
+
+const OverflowConfig& ThreadManager::GetOverflowConfig() const {
+	return overflow_config_;
+}
+
+void ThreadManager::RegisterProfile(ProfileTable* profile) {
+	std::lock_guard<std::mutex> lock(profiles_mutex_);
+	profiles_.push_back(profile);
+}
+
+void ThreadManager::ReleaseProfile(ProfileTable* profile) {
+	std::lock_guard<std::mutex> lock(profiles_mutex_);
+	auto profile_iterator = std::find(profiles_.begin(), profiles_.end(), profile);
+	if (profile_iterator == profiles_.end())
+		return;
+	profiles_.erase(profile_iterator);
+	profile->MergeInto(*profile_);
+	profile_threads_++;
+}
+
+std::shared_ptr<FlightRing> ThreadManager::CreateFlightRing(pid_t tid) {
+	return flight_->CreateRing(tid);
+}
+
+void ThreadManager::ReleaseFlightRing(std::shared_ptr<FlightRing> ring) {
+	std::lock_guard<std::mutex> lock(shutdown_mutex_);
+	if (flight_)
+		flight_->ReleaseRing(ring);
+}
+
+void ThreadManager::dump_flight(uint32_t sequence,
+		const std::vector<std::shared_ptr<FlightRing>>& rings) {
+	// Flight recorder thread, never traced - see process
+	g_tl_reentry_guard = true;
+	UpdateMemoryMap(clock::Now());
+	std::vector<format::Record> records;
+	std::unique_ptr<MessageBucket> bucket(new MessageBucket());
+	for (auto& ring : rings) {
+		ring->Snapshot(records);
+		char name[constants::kNameSizeMax];
+		const auto ret = std::snprintf(name, constants::kNameSizeMax,
+				"flight%u_%d_%d%s", sequence, ring->GetTid(), pid_, kExt);
+		if (ret < 0 || ret >= constants::kNameSizeMax) {
+			LOG(ERROR, "Failed to construct flight dump name");
+			continue;
+		}
+		format::FileHeader header =
+			format::MakeFileHeader(pid_, ring->GetTid(), calibration_);
+		if (address_mode_ == kAddressModule)
+			header.flags |= format::kFileModuleAddress;
+		StreamingBucketHandler handler(MakeSink(name), header, compression_,
+				address_mode_, fold_repeats_);
+		for (std::size_t first = 0; first < records.size();
+				first += bucket->capacity()) {
+			bucket->clear();
+			const std::size_t last =
+				std::min(records.size(), first + bucket->capacity());
+			for (std::size_t idx = first; idx < last; idx++)
+				bucket->push_back(records[idx]);
+			handler.OnMessageBucket(*bucket);
+		}
+		LOG(INFO, "Flight dump name=%s records=%zu", name, records.size());
+	}
+}
+
+bool ThreadManager::write_profile() {
+	std::lock_guard<std::mutex> lock(profiles_mutex_);
+	// Threads still running are merged as they are at this point
+	ProfileTable merged;
+	profile_->MergeInto(merged);
+	for (auto profile : profiles_)
+		profile->MergeInto(merged);
+	std::vector<format::ProfileEntry> entries;
+	merged.Entries(entries);
+	std::sort(entries.begin(), entries.end(),
+			[](const format::ProfileEntry& lhs, const format::ProfileEntry& rhs) {
+				return lhs.address < rhs.address;
+			});
+
+	format::ProfileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, format::kProfileMagic, sizeof(format::kProfileMagic));
+	header.version = format::kProfileVersion;
+	header.header_size = sizeof(header);
+	header.entry_size = sizeof(format::ProfileEntry);
+	header.thread_count = profile_threads_ + profiles_.size();
+	header.entry_count = entries.size();
+	header.pid = pid_;
+	header.clock_source = calibration_.source;
+	header.tick_base = calibration_.tick_base;
+	header.ns_base = calibration_.ns_base;
+	header.ns_per_tick = calibration_.ns_per_tick;
+
+	const std::string name = std::to_string(pid_) + kProfileExt;
+	std::ofstream out(name, std::ios::out | std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(entries.data()),
+			entries.size() * sizeof(format::ProfileEntry));
+	if (!out) {
+		LOG(ERROR, "Failed to write profile name=%s", name.c_str());
+		return false;
+	}
+	LOG(INFO, "Profile written name=%s functions=%zu threads=%u", name.c_str(),
+			entries.size(), header.thread_count);
+	return true;
+}
+
 void ThreadManager::Deinitialize() {
 	std::lock_guard<std::mutex> lock(shutdown_mutex_);
 	if (g_exiting)
 		return;
 	g_exiting = true;
-	if (!UpdateMemoryMapFile(pid_))
-		LOG(ERROR, "Failed to dump memory map file");
+	UpdateMemoryMap(clock::Now());
 	LOG(INFO, "Destroying thread manager pid=%d", pid_);
 	close();
-	processing_thread_.join();
-	for (auto& channel : channels_) {
-		LOG(INFO, "Finalize leftover channel name=%s", channel->GetName());
-		channel->Finalize();
+	for (auto& writer : writers_)
+		writer->thread_.join();
+	for (auto& writer : writers_)
+		writer->Finalize();
+	if (mode_ == kModeProfile)
+		write_profile();
+	// Final counters - a file page is kept, shm page is removed
+	if (stats_) {
+		publish_stats();
+		stats_.reset();
 	}
+	// Stops the dump thread - nothing is written at regular exit
+	flight_.reset();
 }
 
 
@@ -315,22 +907,151 @@ ThreadObserver::ThreadObserver() {
 
 ThreadObserver::~ThreadObserver() {
 	LOG(INFO, "Stop observing tid=%d", tid_);
+	if (sampler_ && (enter_channel_ || ring_ || shared_)) {
+		sampler_->Drain([this](uintptr_t address, uint32_t count) {
+			send_suppressed(address, count);
+		});
+	}
 	exiting_ = true;
+	if (profile_) {
+		ThreadManager::GetInstance().ReleaseProfile(profile_.get());
+		profile_.reset();
+	}
+	if (ring_) {
+		ThreadManager::GetInstance().ReleaseFlightRing(ring_);
+		ring_.reset();
+	}
+	if (shared_) {
+		shared_->Close();
+		shared_.reset();
+	}
 	ThreadManager::GetInstance().UnregisterChannel(enter_channel_);
 	enter_channel_.reset();
 }
 
+bool ThreadObserver::maybe_register() {
+	if (enter_channel_ || profile_ || ring_ || shared_)
+		return true;
+	ThreadManager& manager = ThreadManager::GetInstance();
+	if (manager.GetMode() == kModeProfile) {
+		profile_.reset(new ProfileTable());
+		manager.RegisterProfile(profile_.get());
+		return true;
+	}
+	if (manager.GetMode() == kModeFlight) {
+		ring_ = manager.CreateFlightRing(tid_);
+	} else if (manager.GetMode() == kModeCollector) {
+		shared_ = manager.CreateSharedRing(tid_);
+		if (!shared_)
+			return false;
+	} else {
+		std::shared_ptr<Channel> enter_channel(new Channel());
+		if (!enter_channel->SetName(constants::kEnterChannelName, tid_))
+			return false;
+		enter_channel->SetOverflow(manager.GetOverflowConfig());
+		enter_channel_ = enter_channel;
+	}
+	if (manager.GetAddressMode() == kAddressModule)
+		modules_.reset(new ModuleCache());
+	// Loads and unloads from before the thread started are not its own
+	changes_seen_ = ModuleTable::GetInstance().ChangeSequence();
+	if (manager.GetSamplerConfig().Enabled())
+		sampler_.reset(new Sampler(manager.GetSamplerConfig()));
+	if (enter_channel_)
+		manager.RegisterChannel(enter_channel_);
+	return true;
+}
+
 void ThreadObserver::Enter(uintptr_t enter_addr) {
-	if (exiting_)
+	if (exiting_ || !filter_.Allowed(enter_addr))
 		return;
-	if (!enter_channel_) {
-		auto enter_channel = std::make_shared<Channel>();
-		if (!enter_channel->SetName(constants::kEnterChannelName, tid_))
+	if (!maybe_register())
+		return;
+	if ((++calls_ & (constants::kModulePollCalls - 1)) == 0)
+		poll_modules();
+	if (profile_) {
+		profile_->Enter(enter_addr, clock::Now());
+		return;
+	}
+	if (sampler_) {
+		uint32_t suppressed = 0;
+		bool admitted = false;
+		// Too deep to pair the exit with this enter - not sampled
+		if (depth_ < recorded_.size()) {
+			admitted = sampler_->Admit(enter_addr, suppressed);
+			recorded_[depth_] = admitted;
+		}
+		if (!admitted) {
+			depth_++;
 			return;
-		enter_channel_ = enter_channel;
-		ThreadManager::GetInstance().RegisterChannel(enter_channel_);
+		}
+		if (suppressed > 0)
+			send_suppressed(enter_addr, suppressed);
+	}
+	const uintptr_t address = modules_ ? modules_->Translate(enter_addr) : enter_addr;
+	const format::Record record =
+		{ clock::Now(), address, format::kEnter, depth_++ };
+	send(record);
+}
+
+void ThreadObserver::Exit(uintptr_t exit_addr) {
+	if (exiting_ || !filter_.Allowed(exit_addr))
+		return;
+	if (profile_) {
+		profile_->Exit(exit_addr, clock::Now());
+		return;
+	}
+	if (!enter_channel_ && !ring_ && !shared_)
+		return;
+	// Unbalanced exit (entered before observing started)
+	const bool balanced = depth_ > 0;
+	if (balanced)
+		depth_--;
+	if (sampler_ && balanced &&
+			(depth_ >= recorded_.size() || !recorded_[depth_]))
+		return;
+	const uintptr_t address = modules_ ? modules_->Translate(exit_addr) : exit_addr;
+	const format::Record record =
+		{ clock::Now(), address, format::kExit, depth_ };
+	send(record);
+}
+
+void ThreadObserver::poll_modules() {
+	PollModules();
+	ModuleTable& table = ModuleTable::GetInstance();
+	if (profile_ || table.ChangeSequence() == changes_seen_)
+		return;
+	std::vector<ModuleTable::Change> changes;
+	changes_seen_ = table.Changes(changes_seen_, changes);
+	for (auto& change : changes) {
+		const format::Record record = { clock::Now(), change.base,
+			change.loaded ? format::kModuleLoad : format::kModuleUnload, change.id };
+		send(record);
 	}
-	enter_channel_->Send(enter_addr);
+}
+
+void ThreadObserver::send_suppressed(uintptr_t address, uint32_t count) {
+	const uintptr_t suppressed_addr = modules_ ? modules_->Translate(address) : address;
+	const format::Record record =
+		{ clock::Now(), suppressed_addr, format::kSuppressed, count };
+	send(record);
+}
+
+void ThreadObserver::AfterFork() {
+	tid_ = (pid_t)syscall(SYS_gettid);
+	if (shared_) {
+		shared_->Abandon();
+		shared_.reset();
+	}
+}
+
+void ThreadObserver::send(const format::Record& record) {
+	if (ring_)
+		ring_->Push(record);
+	else if (shared_)
+		shared_->Send(record);
+	else
+		enter_channel_->Send(record);
 }
 
 } // namespace snoop
@@ -343,11 +1064,18 @@ void __cyg_profile_func_enter(void *func,  void *caller) {
 	g_tl_observer.Enter((uintptr_t)func);
 	LEAVE();
 }
-void __cyg_profile_func_exit(void *func, void *caller) {}
+void __cyg_profile_func_exit(void *func, void *caller) {
+	LEAVE_ON_REENTRY();
+	if (snoop::g_exiting)
+		return;
+	g_tl_observer.Exit((uintptr_t)func);
+	LEAVE();
+}
 
 __attribute__((destructor)) void DsoDestructor() {
 	LOG(INFO, "DSO destructor");
-	snoop::ThreadManager::GetInstance().Deinitialize();
+	if (g_manager_created.load())
+		snoop::ThreadManager::GetInstance().Deinitialize();
 }
 
 }
@@ -31,49 +31,151 @@ SOFTWARE.
 #include <mutex>
 #include <memory>
 #include <thread>
-#include <condition_variable>
 #include <cstdint>
 #include <vector>
 #include <atomic>
+#include <bitset>
 
 #include "channel.h"
+#include "clock.h"
 #include "constants.h"
+#include "encoder.h"
+#include "filter.h"
+#include "flight.h"
+#include "format.h"
+#include "memorymap.h"
+#include "modules.h"
+#include "overflow.h"
+#include "profile.h"
+#include "sampler.h"
+#include "sharedring.h"
+#include "sink.h"
+#include "stats.h"
+#include "wakeup.h"
 
 namespace snoop {
 
 static bool g_exiting = false;
 
 bool DumpMemoryMapFile(pid_t pid);
-bool UpdateMemoryMapFile(pid_t pid);
+// New epoch of <pid>.map starting at timestamp, see MemoryMap
+bool UpdateMemoryMapFile(pid_t pid, uint64_t timestamp);
+// Polls the loader counters (dlpi_adds, dlpi_subs). When objects were
+// loaded or unloaded since the previous poll of any thread, starts a
+// memory map epoch and adds them to the ModuleTable change history. Called
+// by threads every kModulePollCalls calls, by the first writer on every
+// wakeup and by writers before each bucket, so the epoch exists before
+// records of a new module are written.
+void PollModules();
 
-using Channel = Channel<uintptr_t>;
+using Channel = Channel<format::Record>;
 using ChannelListener = Channel::ChannelListener;
 using ChannelConsumer = Channel::ChannelConsumer;
 using MessageBucket = Channel::MessageBucket;
 
 class StreamingBucketHandler : public ChannelListener {
  public:
-	StreamingBucketHandler(const char* name);
+	StreamingBucketHandler(std::unique_ptr<Sink> sink,
+			const format::FileHeader& header, format::Compression compression,
+			AddressMode address_mode, bool fold_repeats);
 	~StreamingBucketHandler();
 	// ChannelListener
 	void OnMessageBucket(MessageBucket& bucket) override;
+	uint64_t BytesWritten() const override;
  private:
-	std::ofstream stream_;
+	void write(const void* data, std::size_t size);
+	void write_modules();
+	// Writes an epoch block when the epoch of records changed, returns how
+	// many of them fall into it
+	std::size_t write_epoch(const format::Record* records, std::size_t count);
+	void write_records(const format::Record* records, std::size_t count);
+ private:
+	std::unique_ptr<Sink> sink_;
+	const MemoryMap& map_;
+	bool timed_;
+	// Last epoch block written, 0 for none
+	uint32_t epoch_;
+	StatsCounter bytes_;
+	std::unique_ptr<format::BlockEncoder> encoder_;
+	AddressMode address_mode_;
+	// Last module id present in this file
+	uint32_t module_id_;
+	// ModuleTable::ChangeCount when module_id_ was last brought up to date
+	uint32_t module_changes_;
+	std::vector<uint8_t> modules_;
+	bool fold_repeats_;
+	std::vector<format::Record> folded_;
 };
+/*
+ * Processing thread draining a shard of channels. Channels notify the
+ * writer they are assigned to.
+ */
+class Writer : public ChannelConsumer {
+ public:
+	explicit Writer(std::size_t index);
+	// ChannelConsumer
+	void Notify() override;
+	// Interface
+	void AddChannel(std::shared_ptr<Channel> channel);
+	bool RemoveChannel(std::shared_ptr<Channel> channel);
+	std::size_t ChannelCount() const;
+	// Returns number of buckets processed
+	std::size_t Receive();
+	std::size_t Steal(Writer& victim);
+	void Finalize();
+
+	void Wait();
+	std::size_t GetIndex() const { return index_; }
+
+ private:
+	// Copy of channels_, false when wait is false and the shard is locked
+	bool snapshot(std::vector<std::shared_ptr<Channel>>& channels, bool wait);
+
+ private:
+	std::mutex channels_mutex_;
+	std::vector<std::shared_ptr<Channel>> channels_;
+	std::atomic<std::size_t> channel_count_;
+	WakeupEvent wakeup_;
+	std::size_t index_;
+
+	friend class ThreadManager;
+	std::thread thread_;
+};
+
 /*
  * Assuming C++11 and up implies static initialisation thread safety.
  * Meyers Singleton is enough.
+ *
+ * SNOOP_WRITERS sets the number of writer threads (default 1).
+ * SNOOP_WRITER_CPUS ("0,2,8-11") pins writer N to the Nth CPU on the list,
+ * SNOOP_WRITER_NODES ("0,1") pins writer N to all CPUs of the Nth NUMA node.
  */
-class ThreadManager : public ChannelConsumer {
+class ThreadManager {
  public:
 	// Singleton
 	static ThreadManager& GetInstance();
-	// ChannelConsumer
-	void Notify() override;
 	// Interface
 	void RegisterChannel(std::shared_ptr<Channel> channel);
 	void UnregisterChannel(std::shared_ptr<Channel> channel);
 	void ReceiveChannels();
+	AddressMode GetAddressMode() const;
+	Mode GetMode() const;
+	const SamplerConfig& GetSamplerConfig() const;
+	const OverflowConfig& GetOverflowConfig() const;
+	// kModeProfile - tables of live threads are merged at shutdown,
+	// released ones right away
+	void RegisterProfile(ProfileTable* profile);
+	void ReleaseProfile(ProfileTable* profile);
+	// kModeFlight
+	std::shared_ptr<FlightRing> CreateFlightRing(pid_t tid);
+	void ReleaseFlightRing(std::shared_ptr<FlightRing> ring);
+	// kModeCollector - ring registered with the collector
+	std::unique_ptr<SharedRing> CreateSharedRing(pid_t tid);
+	// New epoch of the memory map, written by the collector in
+	// kModeCollector and by nobody when the tracer owns the map file
+	void UpdateMemoryMap(uint64_t timestamp);
+	// Forked child (kModeCollector) - connects to the collector again
+	void AfterFork();
 
 	void Deinitialize();
 
@@ -81,6 +183,17 @@ class ThreadManager : public ChannelConsumer {
 	void notify();
 	void close();
 	bool should_exit();
+	void process(Writer& writer);
+	void start_writers();
+	bool start_collector();
+	bool write_profile();
+	void dump_flight(uint32_t sequence,
+			const std::vector<std::shared_ptr<FlightRing>>& rings);
+	// Stats page - updated by the first writer
+	void maybe_publish_stats();
+	void publish_stats();
+	void collect_stats(const Channel& channel, uint64_t now_ns,
+			format::StatsThread& thread) const;
 
  private:
 	// Singleton
@@ -89,15 +202,36 @@ class ThreadManager : public ChannelConsumer {
 	~ThreadManager();
 
  private:
-	std::mutex processing_mutex_;
 	std::mutex internal_state_mutex_;
 	std::mutex shutdown_mutex_;
-	std::condition_variable processing_condition_;
-	std::vector<std::shared_ptr<Channel>> channels_;
-	std::thread processing_thread_;
+	std::vector<std::unique_ptr<Writer>> writers_;
 	std::atomic_bool exit_flag_;
 
 	pid_t pid_;
+	clock::Calibration calibration_;
+	format::Compression compression_;
+	AddressMode address_mode_;
+	bool fold_repeats_;
+	Mode mode_;
+	SamplerConfig sampler_config_;
+	OverflowConfig overflow_config_;
+
+	std::mutex profiles_mutex_;
+	std::vector<ProfileTable*> profiles_;
+	// Counters of exited threads
+	std::unique_ptr<ProfileTable> profile_;
+	uint32_t profile_threads_;
+
+	std::unique_ptr<FlightRecorder> flight_;
+
+	std::unique_ptr<CollectorClient> collector_;
+
+	StatsConfig stats_config_;
+	std::unique_ptr<StatsPage> stats_;
+	uint64_t stats_due_ns_;
+	// Counters of exited threads, guarded by internal_state_mutex_
+	format::StatsCounters stats_exited_;
+	uint32_t threads_exited_;
 };
 
 class ThreadObserver {
@@ -106,11 +240,41 @@ public:
 	~ThreadObserver();
 
 	void Enter(uintptr_t enter_addr);
+	void Exit(uintptr_t exit_addr);
+	// Forked child - drops the ring shared with the parent's thread
+	void AfterFork();
+
+private:
+	bool maybe_register();
+	// Sends kModuleLoad / kModuleUnload records of changes not seen yet
+	void poll_modules();
+	void send(const format::Record& record);
+	void send_suppressed(uintptr_t address, uint32_t count);
 
 private:
 	pid_t tid_;
+	// Checked before anything else, filtered calls never reach a channel
+	FilterCache filter_;
 	std::shared_ptr<Channel> enter_channel_;
+	// Set in kModeFlight instead of enter_channel_
+	std::shared_ptr<FlightRing> ring_;
+	// Set in kModeCollector instead of enter_channel_
+	std::unique_ptr<SharedRing> shared_;
+	// Set in kModeProfile instead of enter_channel_
+	std::unique_ptr<ProfileTable> profile_;
+	// Set in kAddressModule mode
+	std::unique_ptr<ModuleCache> modules_;
+	// Set when sampling is enabled
+	std::unique_ptr<Sampler> sampler_;
 	bool exiting_ = false;
+	uint32_t depth_ = 0;
+	uint32_t calls_ = 0;
+	// ModuleTable::ChangeSequence already sent
+	uint64_t changes_seen_ = 0;
+	// Sampling decision per nesting level, pairs exits with their enter.
+	// Calls not recorded still count into depth_, so recorded callees
+	// keep their real nesting level.
+	std::bitset<constants::kSamplerDepthMax> recorded_;
 };
 
 }; // namespace snoop
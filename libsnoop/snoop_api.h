@@ -0,0 +1,47 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __SNOOP_API_H__
+#define __SNOOP_API_H__
+
+/*
+ * Calls an instrumented application may make into libsnoop. Symbols are
+ * weak so the application also runs without libsnoop preloaded - check
+ * the function pointer before calling.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * SNOOP_MODE=flight: writes all thread rings and the memory map to
+ * flight<N>_<tid>_<pid>.snoop files. Blocks until written.
+ * Returns 0 on success, -1 if not in flight mode or on timeout.
+ */
+int snoop_flight_dump(void) __attribute__((weak));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SNOOP_API_H__
@@ -0,0 +1,136 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// open, ftruncate, mmap
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+// getenv
+#include <stdlib.h>
+// strcmp, strerror
+#include <string.h>
+
+#include <cstring>
+
+#include "constants.h"
+#include "log.h"
+#include "stats.h"
+
+namespace snoop {
+namespace format {
+
+void Accumulate(StatsCounters& total, const StatsCounters& counters) {
+	total.events += counters.events;
+	total.buckets += counters.buckets;
+	total.drops += counters.drops;
+	total.blocks += counters.blocks;
+	total.bytes += counters.bytes;
+	for (std::size_t idx = 0; idx < kStatsHistogramSize; idx++) {
+		total.write_ns[idx] += counters.write_ns[idx];
+		total.send_ns[idx] += counters.send_ns[idx];
+	}
+}
+
+} // namespace format
+
+StatsConfig StatsConfigFromEnv() {
+	StatsConfig config;
+	config.mode = kStatsOff;
+	config.period_ns = constants::kStatsPeriodNs;
+	const char* env = getenv("SNOOP_STATS");
+	if (!env)
+		return config;
+	if (strcmp(env, "shm") == 0)
+		config.mode = kStatsShm;
+	else if (strcmp(env, "file") == 0)
+		config.mode = kStatsFile;
+	else
+		LOG(WARNING, "Unknown SNOOP_STATS=%s", env);
+	const char* period = getenv("SNOOP_STATS_PERIOD_MS");
+	if (period && std::atol(period) > 0)
+		config.period_ns = (uint64_t)std::atol(period) * 1000000ull;
+	return config;
+}
+
+StatsPage::StatsPage()
+	: remove_(false), size_(0), header_(nullptr), threads_(nullptr) {
+}
+
+StatsPage::~StatsPage() {
+	if (header_)
+		munmap(header_, size_);
+	if (remove_)
+		unlink(name_.c_str());
+}
+
+bool StatsPage::Open(StatsMode mode, pid_t pid) {
+	if (mode == kStatsShm)
+		name_ = "/dev/shm/snoop-" + std::to_string(pid) + ".stats";
+	else
+		name_ = std::to_string(pid) + ".stats";
+	const int fd = open(name_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		LOG(ERROR, "Failed to open stats page name=%s err=%s", name_.c_str(),
+				strerror(errno));
+		return false;
+	}
+	remove_ = mode == kStatsShm;
+	size_ = sizeof(format::StatsHeader) +
+		constants::kStatsThreadsMax * sizeof(format::StatsThread);
+	void* page = MAP_FAILED;
+	if (ftruncate(fd, size_) == 0)
+		page = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		LOG(ERROR, "Failed to map stats page name=%s err=%s", name_.c_str(),
+				strerror(errno));
+		return false;
+	}
+	// Fresh file pages are zero filled
+	header_ = static_cast<format::StatsHeader*>(page);
+	threads_ = reinterpret_cast<format::StatsThread*>(header_ + 1);
+	std::memcpy(header_->magic, format::kStatsMagic, sizeof(format::kStatsMagic));
+	header_->version = format::kStatsVersion;
+	header_->header_size = sizeof(format::StatsHeader);
+	header_->thread_size = sizeof(format::StatsThread);
+	header_->thread_capacity = constants::kStatsThreadsMax;
+	header_->pid = pid;
+	LOG(INFO, "Stats page name=%s size=%zu", name_.c_str(), size_);
+	return true;
+}
+
+void StatsPage::begin() {
+	const uint64_t sequence = __atomic_load_n(&header_->sequence, __ATOMIC_RELAXED);
+	__atomic_store_n(&header_->sequence, sequence + 1, __ATOMIC_RELAXED);
+	// Odd sequence is visible before any of the fields change
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void StatsPage::end() {
+	const uint64_t sequence = __atomic_load_n(&header_->sequence, __ATOMIC_RELAXED);
+	__atomic_store_n(&header_->sequence, sequence + 1, __ATOMIC_RELEASE);
+}
+
+} // namespace snoop
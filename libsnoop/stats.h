@@ -0,0 +1,203 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __STATS_H__
+#define __STATS_H__
+
+// pid_t
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "constants.h"
+
+namespace snoop {
+namespace format {
+
+// Stats page layout (native endianness), rewritten in place while the
+// process runs:
+//
+//   StatsHeader
+//   StatsThread[thread_capacity], first thread_count are valid
+//
+// sequence is odd while the page is being updated - readers copy the page
+// and retry when sequence was odd or changed during the copy.
+static const char kStatsMagic[8] = { 'S', 'N', 'O', 'O', 'P', 'S', 'T', 'S' };
+static const uint32_t kStatsVersion = 1;
+// Histogram bucket i counts values in [2^i, 2^(i+1)) nanoseconds
+static const std::size_t kStatsHistogramSize = 32;
+
+struct StatsCounters {
+	// Records in published buckets
+	uint64_t events;
+	uint64_t buckets;
+	// Records lost to channel overflow
+	uint64_t drops;
+	// Buckets written out and bytes of trace file
+	uint64_t blocks;
+	uint64_t bytes;
+	// Encoding and writing one bucket
+	uint64_t write_ns[kStatsHistogramSize];
+	// Send calls that switch buckets or overflow, other calls only store
+	// the record
+	uint64_t send_ns[kStatsHistogramSize];
+};
+
+struct StatsHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t thread_size;
+	uint32_t thread_capacity;
+	uint64_t sequence;
+	// CLOCK_MONOTONIC of the last update
+	uint64_t update_ns;
+	int32_t pid;
+	uint32_t thread_count;
+	uint32_t threads_exited;
+	uint32_t writers;
+	// All threads, including exited ones and ones past thread_capacity
+	StatsCounters total;
+};
+
+struct StatsThread {
+	int32_t tid;
+	uint32_t reserved;
+	// Published buckets not written yet, now and at most
+	uint64_t backlog;
+	uint64_t backlog_max;
+	// Age of the newest record written while buckets wait, 0 when the
+	// writer is caught up or there is no clock
+	uint64_t lag_ns;
+	StatsCounters counters;
+};
+
+// total += counters
+void Accumulate(StatsCounters& total, const StatsCounters& counters);
+
+} // namespace format
+
+// Counter with one writing thread, readable from any thread
+class StatsCounter {
+ public:
+	StatsCounter() : value_(0) {}
+	void Add(uint64_t value) {
+		value_.store(value_.load(std::memory_order_relaxed) + value,
+				std::memory_order_relaxed);
+	}
+	void Max(uint64_t value) {
+		if (value > value_.load(std::memory_order_relaxed))
+			value_.store(value, std::memory_order_relaxed);
+	}
+	uint64_t Get() const {
+		return value_.load(std::memory_order_relaxed);
+	}
+ private:
+	std::atomic<uint64_t> value_;
+};
+
+// log2 histogram of nanoseconds with one writing thread
+class StatsHistogram {
+ public:
+	void Add(uint64_t ns) {
+		std::size_t idx = ns ? 63 - __builtin_clzll(ns) : 0;
+		if (idx >= format::kStatsHistogramSize)
+			idx = format::kStatsHistogramSize - 1;
+		counts_[idx].Add(1);
+	}
+	void CopyTo(uint64_t* out) const {
+		for (std::size_t idx = 0; idx < format::kStatsHistogramSize; idx++)
+			out[idx] = counts_[idx].Get();
+	}
+ private:
+	StatsCounter counts_[format::kStatsHistogramSize];
+};
+
+// Channel counters written by the sending thread
+struct alignas(constants::kCacheLineSize) ProducerStats {
+	StatsCounter events;
+	StatsCounter buckets;
+	StatsCounter drops;
+	StatsHistogram send_ns;
+};
+
+// Channel counters written by whichever writer drains the channel
+struct alignas(constants::kCacheLineSize) ConsumerStats {
+	StatsCounter blocks;
+	StatsCounter backlog_max;
+	// Timestamp of the newest record written
+	StatsCounter timestamp;
+	StatsHistogram write_ns;
+};
+
+enum StatsMode {
+	kStatsOff,
+	// /dev/shm/snoop-<pid>.stats, removed at exit
+	kStatsShm,
+	// <pid>.stats in the working directory, kept at exit
+	kStatsFile,
+};
+
+struct StatsConfig {
+	StatsMode mode;
+	uint64_t period_ns;
+};
+
+// SNOOP_STATS=shm|file and SNOOP_STATS_PERIOD_MS (100)
+StatsConfig StatsConfigFromEnv();
+
+/**
+ * Memory mapped stats page. One thread updates it, any process may map
+ * and read it.
+ */
+class StatsPage {
+ public:
+	StatsPage();
+	~StatsPage();
+	bool Open(StatsMode mode, pid_t pid);
+	// fill(header, threads, capacity) runs between the sequence updates
+	template <typename Fill>
+	void Update(Fill fill) {
+		begin();
+		fill(*header_, threads_, (std::size_t)header_->thread_capacity);
+		end();
+	}
+
+ private:
+	void begin();
+	void end();
+
+ private:
+	std::string name_;
+	bool remove_;
+	std::size_t size_;
+	format::StatsHeader* header_;
+	format::StatsThread* threads_;
+};
+
+} // namespace snoop
+
+#endif // __STATS_H__
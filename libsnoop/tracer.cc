@@ -22,27 +22,43 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include <sys/ptrace.h>
+#include <sys/prctl.h>
 #include <sys/wait.h>
 #include <sys/syscall.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
 // user_regs_struct
 #include <sys/user.h>
 #include <stdio.h>
-// strerror
+// getenv
+#include <stdlib.h>
+// strcmp, strerror
 #include <string.h>
+#include <stddef.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
 #ifdef __arm__
 #include <asm/ptrace.h>
 #include <elf.h>
 #endif
 
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "constants.h"
 #include "log.h"
 #include "tracer.h"
 #include "snoop.h"
 
 #define RET_ERR 1
 
-// TODO: Investigate PTRACE_O_TRACEFORK
-
 #ifdef __arm__
 struct iovec_abi {
 	void* handle;
@@ -50,8 +66,260 @@ struct iovec_abi {
 };
 #endif
 
-int do_trace(pid_t pid) {
-	LOG(INFO, "tracer started for pid=%d", pid);
+namespace {
+
+// Control socket messages, see AcceptTracer
+static const char kTracerGoSeccomp = 'g';
+static const char kTracerGoLegacy = 'l';
+static const char kTracerAttached = 'a';
+static const char kTracerFailed = 'x';
+static const char kFilterInstalled = 's';
+static const char kFilterFailed = 'n';
+
+#if defined(__x86_64__)
+#define SNOOP_AUDIT_ARCH AUDIT_ARCH_X86_64
+#elif defined(__i386__)
+#define SNOOP_AUDIT_ARCH AUDIT_ARCH_I386
+#elif defined(__aarch64__)
+#define SNOOP_AUDIT_ARCH AUDIT_ARCH_AARCH64
+#elif defined(__arm__)
+#define SNOOP_AUDIT_ARCH AUDIT_ARCH_ARM
+#endif
+
+// EXITKILL - a target left with the filter and no tracer would see its
+// mapping syscalls fail with ENOSYS, it is killed with the tracer instead
+static const long kSeizeOptions = PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD |
+	PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+	PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL;
+
+// SNOOP_TRACER=seccomp (opt in) or syscall (default)
+bool SeccompTracerFromEnv() {
+	const char* env = getenv("SNOOP_TRACER");
+	if (!env || strcmp(env, "syscall") == 0)
+		return false;
+	if (strcmp(env, "seccomp") == 0)
+		return true;
+	LOG(WARNING, "Unknown SNOOP_TRACER=%s", env);
+	return false;
+}
+
+// The target can not run without the seccomp tracer - keep terminal and
+// session signals meant for the target away from it
+void ProtectTracer() {
+	if (setsid() == -1)
+		LOG(WARNING, "setsid: %s", strerror(errno));
+	for (int signal : { SIGINT, SIGTERM, SIGHUP, SIGQUIT })
+		::signal(signal, SIG_IGN);
+}
+
+// Syscalls that change the memory map
+std::vector<long> MappingSyscalls() {
+	std::vector<long> syscalls;
+#ifdef SYS_mmap
+	syscalls.push_back(SYS_mmap);
+#endif
+#ifdef SYS_mmap2
+	syscalls.push_back(SYS_mmap2);
+#endif
+	syscalls.push_back(SYS_munmap);
+	syscalls.push_back(SYS_mprotect);
+	return syscalls;
+}
+
+bool SendByte(int fd, char value) {
+	return send(fd, &value, 1, MSG_NOSIGNAL) == 1;
+}
+
+// Returns 0 on timeout or error
+char ReceiveByte(int fd, int timeout_ms) {
+	struct pollfd poll_fd = { fd, POLLIN, 0 };
+	char value = 0;
+	if (poll(&poll_fd, 1, timeout_ms) != 1 || recv(fd, &value, 1, 0) != 1)
+		return 0;
+	return value;
+}
+
+pid_t ReadStatusField(pid_t tid, const char* field) {
+	std::ifstream status("/proc/" + std::to_string(tid) + "/status");
+	const std::string prefix = std::string(field) + ":";
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.compare(0, prefix.size(), prefix) == 0)
+			return (pid_t)std::atol(line.c_str() + prefix.size());
+	}
+	return 0;
+}
+
+bool SeccompTraceAvailable() {
+#if defined(SECCOMP_GET_ACTION_AVAIL) && defined(SNOOP_AUDIT_ARCH)
+	uint32_t action = SECCOMP_RET_TRACE;
+	return syscall(SYS_seccomp, SECCOMP_GET_ACTION_AVAIL, 0, &action) == 0;
+#else
+	return false;
+#endif
+}
+
+bool InstallMappingFilter() {
+#if defined(SNOOP_AUDIT_ARCH)
+	const std::vector<long> syscalls = MappingSyscalls();
+	const std::size_t count = syscalls.size();
+	std::vector<struct sock_filter> filter;
+	// Other ABIs (x32, compat) are not traced
+	filter.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)));
+	filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SNOOP_AUDIT_ARCH, 1, 0));
+	filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+	filter.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)));
+	// Each match jumps over the remaining compares and ALLOW to TRACE
+	for (std::size_t idx = 0; idx < count; idx++)
+		filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)syscalls[idx],
+					(uint8_t)(count - idx), 0));
+	filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+	filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+	struct sock_fprog program = { (unsigned short)filter.size(), filter.data() };
+
+	// Needed without CAP_SYS_ADMIN - setuid execs stop elevating, see tracer.h
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) {
+		LOG(ERROR, "prctl PR_SET_NO_NEW_PRIVS: %s", strerror(errno));
+		return false;
+	}
+	// TSYNC - threads started before the tracer was spawned get it too
+	const long ret = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER,
+			SECCOMP_FILTER_FLAG_TSYNC, &program);
+	if (ret != 0) {
+		LOG(ERROR, "seccomp SECCOMP_SET_MODE_FILTER ret=%ld: %s", ret, strerror(errno));
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Seizes every thread of pid. Threads cloned by seized ones are attached
+// by the kernel (PTRACE_O_TRACECLONE), others show up in the next pass.
+bool SeizeAll(pid_t pid, std::map<pid_t, pid_t>& tasks) {
+	const std::string task_dir = "/proc/" + std::to_string(pid) + "/task";
+	for (bool found = true; found;) {
+		found = false;
+		DIR* dir = opendir(task_dir.c_str());
+		if (!dir) {
+			LOG(ERROR, "opendir %s: %s", task_dir.c_str(), strerror(errno));
+			return false;
+		}
+		while (struct dirent* entry = readdir(dir)) {
+			const pid_t tid = (pid_t)std::atol(entry->d_name);
+			if (tid <= 0 || tasks.count(tid))
+				continue;
+			if (ptrace(PTRACE_SEIZE, tid, 0, kSeizeOptions) == -1) {
+				// Exited already, or auto attached as a clone of a seized thread
+				if (errno == ESRCH)
+					continue;
+				if (errno != EPERM || ReadStatusField(tid, "TracerPid") != getpid()) {
+					LOG(ERROR, "ptrace PTRACE_SEIZE tid=%d: %s", tid, strerror(errno));
+					closedir(dir);
+					return false;
+				}
+			}
+			tasks[tid] = pid;
+			found = true;
+		}
+		closedir(dir);
+	}
+	return true;
+}
+
+// True when the stop of tid is the exit of the traced syscall
+bool AtSyscallExit(pid_t tid) {
+#if defined(PTRACE_GET_SYSCALL_INFO)
+	struct __ptrace_syscall_info info;
+	if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0)
+		return info.op == PTRACE_SYSCALL_INFO_EXIT;
+#endif
+	// Older kernels only report the exit after a seccomp stop
+	return true;
+}
+
+/**
+ * Mapping syscalls stop in PTRACE_EVENT_SECCOMP on entry. The task is then
+ * resumed with PTRACE_SYSCALL to see the syscall return, where the memory
+ * map of its process is updated. Everything else runs without stopping.
+ */
+int trace_seccomp(pid_t pid, std::map<pid_t, pid_t>& tasks) {
+	std::set<pid_t> in_mapping;
+	while (!tasks.empty()) {
+		int status = 0;
+		const pid_t tid = waitpid(-1, &status, __WALL);
+		if (tid == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ECHILD)
+				break;
+			LOG(ERROR, "waitpid: %s", strerror(errno));
+			return RET_ERR;
+		}
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			tasks.erase(tid);
+			in_mapping.erase(tid);
+			continue;
+		}
+		if (!WIFSTOPPED(status))
+			continue;
+		// Clone reported by the new task before its parent's event
+		if (!tasks.count(tid))
+			tasks[tid] = ReadStatusField(tid, "Tgid");
+		const int event = status >> 16;
+		const int signal = WSTOPSIG(status);
+		int resume = PTRACE_CONT;
+		int inject = 0;
+		switch (event) {
+			case PTRACE_EVENT_SECCOMP:
+				in_mapping.insert(tid);
+				resume = PTRACE_SYSCALL;
+				break;
+			case PTRACE_EVENT_CLONE:
+			case PTRACE_EVENT_FORK:
+			case PTRACE_EVENT_VFORK: {
+				unsigned long child = 0;
+				if (ptrace(PTRACE_GETEVENTMSG, tid, 0, &child) == 0)
+					tasks[(pid_t)child] = event == PTRACE_EVENT_CLONE ? tasks[tid] : (pid_t)child;
+				break;
+			}
+			case PTRACE_EVENT_STOP:
+				// Group stop - stay stopped until SIGCONT. Otherwise it is
+				// the first stop of an auto attached task.
+				if (signal == SIGSTOP || signal == SIGTSTP || signal == SIGTTIN ||
+						signal == SIGTTOU) {
+					ptrace(PTRACE_LISTEN, tid, 0, 0);
+					continue;
+				}
+				break;
+			case PTRACE_EVENT_EXEC:
+				break;
+			default:
+				if (signal == (SIGTRAP | 0x80)) {
+					if (in_mapping.count(tid) && !AtSyscallExit(tid)) {
+						resume = PTRACE_SYSCALL;
+					} else if (in_mapping.erase(tid)) {
+						snoop::UpdateMemoryMapFile(tasks[tid], snoop::clock::Now());
+					}
+				} else {
+					// Signal delivery stop - pass it on
+					inject = signal;
+				}
+				break;
+		}
+		if (ptrace((enum __ptrace_request)resume, tid, 0, inject) == -1 && errno != ESRCH)
+			LOG(ERROR, "ptrace resume tid=%d: %s", tid, strerror(errno));
+	}
+	LOG(INFO, "tracer done pid=%d", pid);
+	return 0;
+}
+
+/**
+ * Stops on entry and exit of every syscall of the main thread. Used when
+ * seccomp can not trace.
+ */
+int trace_syscalls(pid_t pid) {
 	if (ptrace(PTRACE_ATTACH, pid, NULL, NULL) == -1) {
 		LOG(ERROR, "ptrace PTRACE_ATTACH: %s", strerror(errno));
 		return RET_ERR;
@@ -112,16 +380,65 @@ int do_trace(pid_t pid) {
 		long mmap_syscall = SYS_mmap2;
 #endif
 		if (syscall == mmap_syscall) {
-			snoop::UpdateMemoryMapFile(pid);
+			snoop::UpdateMemoryMapFile(pid, snoop::clock::Now());
 		}
 	}
 }
 
+} // namespace
+
+bool AcceptTracer(int control_fd) {
+	const bool requested = SeccompTracerFromEnv();
+	const bool seccomp = requested && SeccompTraceAvailable();
+	if (!SendByte(control_fd, seccomp ? kTracerGoSeccomp : kTracerGoLegacy)) {
+		LOG(ERROR, "Tracer handshake failed: %s", strerror(errno));
+		return false;
+	}
+	if (!seccomp) {
+		if (requested)
+			LOG(WARNING, "seccomp can not trace, tracer stops on every syscall");
+		return false;
+	}
+	const char reply = ReceiveByte(control_fd, constants::kTracerAttachTimeoutMs);
+	if (reply != kTracerAttached) {
+		LOG(ERROR, "Tracer did not attach reply=%d", reply);
+		return false;
+	}
+	const bool installed = InstallMappingFilter();
+	SendByte(control_fd, installed ? kFilterInstalled : kFilterFailed);
+	return installed;
+}
+
+int do_trace(pid_t pid, int control_fd) {
+	LOG(INFO, "tracer started for pid=%d control_fd=%d", pid, control_fd);
+	if (control_fd < 0)
+		return trace_syscalls(pid);
+	const char go = ReceiveByte(control_fd, -1);
+	if (go != kTracerGoSeccomp) {
+		close(control_fd);
+		return go == kTracerGoLegacy ? trace_syscalls(pid) : RET_ERR;
+	}
+	ProtectTracer();
+	std::map<pid_t, pid_t> tasks;
+	const bool attached = SeizeAll(pid, tasks);
+	SendByte(control_fd, attached ? kTracerAttached : kTracerFailed);
+	if (!attached) {
+		close(control_fd);
+		return RET_ERR;
+	}
+	if (ReceiveByte(control_fd, -1) != kFilterInstalled)
+		LOG(ERROR, "Mapping filter not installed - memory map updates are lost");
+	close(control_fd);
+	return trace_seccomp(pid, tasks);
+}
+
 int main(int argc, char** argv) {
 	if (argc < 2) {
 		LOG(ERROR, "expecting pid to trace as 1 argument");
 		return RET_ERR;
 	}
 	pid_t pid = std::stoi(std::string(argv[1]));
-	return do_trace(pid);
+	// Control socket is passed by SpawnTracer
+	const int control_fd = argc > 2 ? std::stoi(std::string(argv[2])) : -1;
+	return do_trace(pid, control_fd);
 }
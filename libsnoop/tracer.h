@@ -28,7 +28,30 @@ SOFTWARE.
 // memory map that is necessary to decode symbols from DSOs mapped at runtime
 // (example: dlopen)
 //
+// Objects loaded with dlopen are also tracked in process by libsnoop (see
+// PollModules). The tracer is still needed for code mapped by other means.
+//
+// With SNOOP_TRACER=seccomp and a control socket (see AcceptTracer) the
+// traced process installs a seccomp filter that returns SECCOMP_RET_TRACE
+// for mmap, mmap2, munmap and mprotect only, so other syscalls never stop.
+// All threads, and forked children (which inherit the filter), are traced.
+// By default, or when seccomp can not trace, the main thread stops on
+// every syscall.
+//
+// Seccomp mode changes the traced process for good:
+// - The filter can not be removed. Without a tracer the filtered syscalls
+//   fail with ENOSYS, so the tracer runs in its own session, ignores
+//   SIGINT, SIGTERM, SIGHUP and SIGQUIT, and the target is killed if the
+//   tracer dies anyway (PTRACE_O_EXITKILL).
+// - Installing it needs PR_SET_NO_NEW_PRIVS, inherited by children and
+//   kept across execve: setuid, setgid and file capability binaries run
+//   by the process no longer gain privileges.
+//
 // Warning: This method will not detect syscalls done between fork and ptrace
-// attach
-int do_trace(pid_t pid);
+// attach.
+int do_trace(pid_t pid, int control_fd);
+
+// Traced process side of the control socket, runs once the tracer process
+// is allowed to attach. Returns true when the mapping filter is installed.
+bool AcceptTracer(int control_fd);
 #endif // __TRACER_H__
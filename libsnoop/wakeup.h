@@ -0,0 +1,118 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __WAKEUP_H__
+#define __WAKEUP_H__
+
+// futex
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include <atomic>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SNOOP_CPU_RELAX() _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define SNOOP_CPU_RELAX() asm volatile("yield" ::: "memory")
+#else
+#define SNOOP_CPU_RELAX() asm volatile("" ::: "memory")
+#endif
+
+namespace snoop {
+
+/**
+ * Many producers, one waiter. Signal() is a single atomic increment unless
+ * the waiter is asleep in the kernel - only then it costs a FUTEX_WAKE.
+ *
+ * Waiter spins adaptively before sleeping: the spin budget grows while
+ * signals keep arriving during the spin and shrinks when they do not.
+ * Sleep is bounded so the waiter also polls periodically.
+ */
+class WakeupEvent {
+ public:
+	static const uint32_t kSpinMin = 16;
+	static const uint32_t kSpinMax = 16384;
+
+	WakeupEvent() : pending_(0), sleeping_(0), seen_(0), spin_(kSpinMin) {}
+
+	// Producers
+	void Signal() {
+		pending_.fetch_add(1, std::memory_order_seq_cst);
+		if (sleeping_.load(std::memory_order_seq_cst))
+			futex(FUTEX_WAKE_PRIVATE, 1, nullptr);
+	}
+	// Waiter. Returns true if signalled, false on timeout.
+	bool Wait(long timeout_ns) {
+		for (uint32_t spin = 0; spin < spin_; spin++) {
+			if (consume()) {
+				spin_ = spin_ < kSpinMax ? spin_ * 2 : kSpinMax;
+				return true;
+			}
+			SNOOP_CPU_RELAX();
+		}
+		spin_ = spin_ > kSpinMin ? spin_ / 2 : kSpinMin;
+		sleeping_.store(1, std::memory_order_seq_cst);
+		const uint32_t value = pending_.load(std::memory_order_seq_cst);
+		if (value == seen_) {
+			struct timespec timeout = { timeout_ns / 1000000000L,
+				timeout_ns % 1000000000L };
+			// Returns immediately (EAGAIN) if pending_ moved meanwhile
+			futex(FUTEX_WAIT_PRIVATE, value, &timeout);
+		}
+		sleeping_.store(0, std::memory_order_relaxed);
+		return consume();
+	}
+	uint32_t Pending() const {
+		return pending_.load(std::memory_order_relaxed) - seen_;
+	}
+
+ private:
+	bool consume() {
+		const uint32_t value = pending_.load(std::memory_order_acquire);
+		if (value == seen_)
+			return false;
+		seen_ = value;
+		return true;
+	}
+	long futex(int op, uint32_t value, const struct timespec* timeout) {
+		return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&pending_), op,
+				value, timeout, nullptr, 0);
+	}
+
+ private:
+	// Shared with producers
+	std::atomic<uint32_t> pending_;
+	std::atomic<uint32_t> sleeping_;
+	// Waiter only
+	uint32_t seen_;
+	uint32_t spin_;
+};
+
+} // namespace snoop
+
+#endif // __WAKEUP_H__
@@ -0,0 +1,174 @@
+#!/usr/bin/python3
+"""
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+"""
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+'''
+Stress harness - runs testapps/stress workloads with and without libsnoop
+and prints a JSON report of slowdown, drop rate, output size and peak RSS.
+
+  stress.py --out <build>/out [--duration-ms N] [--workloads a,b]
+            [--max-slowdown X] [--max-drop-rate Y] [--output report.json]
+
+SNOOP_* variables in the environment apply to the traced runs. With
+--max-slowdown or --max-drop-rate the exit status is 1 when a workload
+exceeds them, so the harness can gate overhead regressions.
+
+'''
+
+# name: (workload, threads, depth, fanout, rate calls/s per thread)
+kWorkloads = [
+    ("shallow", ("calls", 4, 1, 16, 0)),
+    ("deep", ("calls", 4, 12, 2, 0)),
+    ("paced", ("calls", 4, 4, 4, 200000)),
+    ("churn", ("churn", 2, 3, 4, 0)),
+    ("dlopen", ("dlopen", 2, 0, 16, 0)),
+]
+
+def outputBytes(directory):
+    return sum(os.path.getsize(os.path.join(directory, name))
+               for name in os.listdir(directory)
+               if name.endswith(".snoop") or name.endswith(".map"))
+
+def readDrops(directory, pid):
+    """ (events, drops) from the stats file, None when there is none """
+    path = os.path.join(directory, "%d.stats" % pid)
+    if not os.path.exists(path):
+        return None
+    from snoopstats import readStats
+    total = readStats(path).total
+    return total.events, total.drops
+
+def runOnce(binary, args, duration_ms, libsnoop):
+    """ Result of one workload run, parsed from its JSON line and rusage """
+    directory = tempfile.mkdtemp(prefix="snoop-stress-")
+    env = dict(os.environ)
+    if libsnoop:
+        env["LD_PRELOAD"] = libsnoop
+        env["SNOOP_STATS"] = "file"
+    else:
+        env.pop("LD_PRELOAD", None)
+    workload, threads, depth, fanout, rate = args
+    command = [binary, workload, str(threads), str(duration_ms), str(depth),
+               str(fanout), str(rate)]
+    try:
+        with open(os.path.join(directory, "stdout"), "w+") as stdout, \
+             open(os.path.join(directory, "stderr"), "w+") as stderr:
+            process = subprocess.Popen(command, cwd=directory, env=env,
+                                       stdout=stdout, stderr=stderr)
+            # wait4 instead of Popen.wait - rusage of this child only
+            _, status, usage = os.wait4(process.pid, 0)
+            process.returncode = os.waitstatus_to_exitcode(status)
+            stdout.seek(0)
+            lines = stdout.read().strip().splitlines()
+            stderr.seek(0)
+            errors = stderr.read().strip().splitlines()
+        if process.returncode != 0 or not lines:
+            raise RuntimeError("%s failed (%d): %s" % (" ".join(command),
+                               process.returncode, "; ".join(errors[-3:])))
+        result = json.loads(lines[-1])
+        result["cpu_ns"] = int((usage.ru_utime + usage.ru_stime) * 1e9)
+        result["max_rss_kb"] = usage.ru_maxrss
+        result["output_bytes"] = outputBytes(directory)
+        if libsnoop:
+            stats = readDrops(directory, process.pid)
+            result["events"], result["drops"] = stats if stats else (0, 0)
+        return result
+    finally:
+        shutil.rmtree(directory, ignore_errors=True)
+
+def perCall(result, key):
+    return result[key] / float(max(result["calls"], 1))
+
+def compare(name, args, baseline, traced):
+    events = traced["events"] + traced["drops"]
+    return {
+        "name": name,
+        "workload": args[0],
+        "threads": args[1],
+        "depth": args[2],
+        "fanout": args[3],
+        "rate": args[4],
+        "baseline": baseline,
+        "traced": traced,
+        # Process CPU time per call, writer threads included
+        "slowdown": perCall(traced, "cpu_ns") / max(perCall(baseline, "cpu_ns"), 1e-9),
+        "wall_slowdown": perCall(traced, "wall_ns") / max(perCall(baseline, "wall_ns"), 1e-9),
+        "drop_rate": traced["drops"] / float(events) if events else 0.0,
+        "output_bytes": traced["output_bytes"],
+        "peak_rss_kb": traced["max_rss_kb"],
+        "rss_overhead_kb": traced["max_rss_kb"] - baseline["max_rss_kb"],
+    }
+
+def main():
+    parser = argparse.ArgumentParser(description="libsnoop stress harness")
+    parser.add_argument("--out", required=True,
+                        help="build output directory with libsnoop.so and testapps/")
+    parser.add_argument("--duration-ms", type=int, default=1000)
+    parser.add_argument("--workloads", default=",".join(name for name, _ in kWorkloads))
+    parser.add_argument("--max-slowdown", type=float)
+    parser.add_argument("--max-drop-rate", type=float)
+    parser.add_argument("--output", help="write the report here instead of stdout")
+    options = parser.parse_args()
+
+    here = os.path.dirname(os.path.abspath(__file__))
+    sys.path.insert(0, os.path.join(here, "..", "snooper"))
+    binary = os.path.join(options.out, "testapps", "stress")
+    libsnoop = os.path.abspath(os.path.join(options.out, "libsnoop.so"))
+    selected = options.workloads.split(",")
+
+    results = []
+    for name, args in kWorkloads:
+        if name not in selected:
+            continue
+        baseline = runOnce(binary, args, options.duration_ms, None)
+        traced = runOnce(binary, args, options.duration_ms, libsnoop)
+        results.append(compare(name, args, baseline, traced))
+
+    failed = [result["name"] for result in results
+              if (options.max_slowdown is not None and result["slowdown"] > options.max_slowdown)
+              or (options.max_drop_rate is not None and result["drop_rate"] > options.max_drop_rate)]
+    report = {
+        "duration_ms": options.duration_ms,
+        "snoop_env": dict((key, value) for key, value in os.environ.items()
+                          if key.startswith("SNOOP_")),
+        "workloads": results,
+        "failed": failed,
+    }
+    text = json.dumps(report, indent=2, sort_keys=True)
+    if options.output:
+        with open(options.output, "w") as output:
+            output.write(text + "\n")
+    else:
+        print(text)
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
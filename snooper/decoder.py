@@ -39,6 +39,10 @@ import unittest
 
 import os
 
+from snoopformat import kModuleUnknown
+from snoopformat import readMemoryMap
+from symbolizer import Symbolizer
+
 kDsoSearchPath = os.getenv("SNOOP_DSO_SEARCH_PATH", "")
 kAddr2LineBin = os.getenv("SNOOP_ADDR2LINE_BIN", "addr2line")
 kMemoryMode = os.getenv("SNOOP_MEMORY_MODE", "x86_64")
@@ -72,11 +76,12 @@ class PathHelper():
         return ""
 
 class DecoderEntry():
-    __slots__ = ["begin", "end", "decoder"]
-    def __init__(self, begin, end, decoder):
+    __slots__ = ["begin", "end", "decoder", "mapping"]
+    def __init__(self, begin, end, decoder, mapping):
         self.begin = begin
         self.end = end
         self.decoder = decoder
+        self.mapping = mapping
 
 class DecoderQuery:
     __slots__ = ["inputs", "indexes"]
@@ -85,71 +90,86 @@ class DecoderQuery:
         self.indexes = indexes
 
 class DecoderManager():
+    """
+    Decodes absolute addresses with the memory map file. Addresses resolve
+    with the mappings of the epoch they were recorded in, so an address
+    reused after dlclose names the right module.
+    """
     def __init__(self, filename):
         self.snoopLibName = "libsnoop.so"
         self.filename = filename
         self.entries = []
+        # One addr2line per file, however often it was mapped
+        self.decoders = {}
+        # Epoch -> entries mapped then, sorted by begin
+        self.views = {}
 
-        with open(filename, 'r') as memoryMap:
-            for line in memoryMap:
-                line = line.strip('\n').split(' ')
-                # Check if executable memory
-                if 'x' in line[1]:
-                    self.makeEntry(line)
+        mappings, self.epoch = readMemoryMap(filename)
+        for mapping in mappings:
+            self.makeEntry(mapping)
 
-    def makeEntry(self, line):
-        addr_range = line[0].split('-')
-        if (os.path.basename(line[-1]) == self.snoopLibName):
-            return
-        helper = PathHelper(line[-1])
-        for path in kDsoSearchPath.split(':'):
-            helper.addPath(path)
-        helper.addPath(kDsoSearchPath)
-        helper.addPath(os.path.dirname(self.filename))
-        filename = helper.getFileName()
-        if (filename == ""):
-            print("Failed to make entry")
+    def makeEntry(self, mapping):
+        if (os.path.basename(mapping.path) == self.snoopLibName):
             return
-        decoder = Decoder(helper.getFileName())
-        self.entries.append(
-            DecoderEntry(int(addr_range[0],16), int(addr_range[1],16), decoder))
-
-    def findEntryIdxIterative(self, value):
-        for idx, entry in enumerate(self.entries):
-            if (value >= entry.begin and value <= entry.end):
-                return idx
-        return -1
-
-    def findEntryIdxBinarySearch(self, value):
+        decoder = self.decoders.get(mapping.path)
+        if decoder is None:
+            helper = PathHelper(mapping.path)
+            for path in kDsoSearchPath.split(':'):
+                helper.addPath(path)
+            helper.addPath(kDsoSearchPath)
+            helper.addPath(os.path.dirname(self.filename))
+            filename = helper.getFileName()
+            if (filename == ""):
+                print("Failed to make entry")
+                return
+            decoder = makeDecoder(filename)
+            self.decoders[mapping.path] = decoder
+        self.entries.append(DecoderEntry(mapping.begin, mapping.end, decoder, mapping))
+
+    def view(self, epoch):
+        if epoch not in self.views:
+            self.views[epoch] = sorted(
+                [entry for entry in self.entries if entry.mapping.mappedAt(epoch)],
+                key=lambda entry: entry.begin)
+        return self.views[epoch]
+
+    def findEntryBinarySearch(self, entries, value):
         first = 0
-        last = len(self.entries) - 1
+        last = len(entries) - 1
         while (first <= last):
             current = first + (last - first) // 2
-            if (value >= self.entries[current].begin and
-                value <= self.entries[current].end):
-                return current
-            if (value > self.entries[current].end):
+            if (value >= entries[current].begin and value < entries[current].end):
+                return entries[current]
+            if (value >= entries[current].end):
                 first = current + 1
             else:
                 last = current - 1
-        return -1
-
-    def findEntryIdx(self, value):
-        return self.findEntryIdxBinarySearch(value)
-
-    def decode(self, input_list):
-        queries = [DecoderQuery([],[]) for i in range(len(self.entries))]
+        return None
+
+    def findEntry(self, value, epoch):
+        entry = self.findEntryBinarySearch(self.view(epoch), value)
+        if entry is not None:
+            return entry
+        # Mapped between map updates - latest mapping of the address
+        for entry in reversed(self.entries):
+            if (value >= entry.begin and value < entry.end):
+                return entry
+        return None
+
+    def decode(self, input_list, epoch=None):
+        """ epoch None (or 0) resolves with the latest mappings """
+        if not epoch:
+            epoch = self.epoch
+        queries = {}
         for input_idx, input_addr in enumerate(input_list):
             input_value = int(input_addr, 16)
-            entry_idx = self.findEntryIdx(input_value)
-            if (entry_idx >= 0):
-                offset = self.entries[entry_idx].begin
-                if (kMemoryMode == "arm" and offset == kArmBinOffset):
-                    offset = 0
-                queries[entry_idx].inputs.append(hex(input_value - offset))
-                queries[entry_idx].indexes.append(input_idx)
-        for query_idx, query in enumerate(queries):
-            output_list = self.entries[query_idx].decoder.decode(query.inputs)
+            entry = self.findEntry(input_value, epoch)
+            if entry is not None:
+                query = queries.setdefault(id(entry), (entry, DecoderQuery([], [])))[1]
+                query.inputs.append(entry.decoder.fromMapping(input_value, entry.mapping))
+                query.indexes.append(input_idx)
+        for entry, query in queries.values():
+            output_list = entry.decoder.decode(query.inputs)
             for idx, output in zip(query.indexes, output_list):
                 input_list[idx] = output
         return input_list
@@ -158,26 +178,133 @@ class DecoderManager():
         print("DecoderManager(filename: " + self.filename + ")")
         for entry in self.entries:
             print("\tDecoderEntry(" + str(entry.begin) + "-" + str(entry.end) +
-                  " -> "  + entry.decoder.getName())
+                  " -> "  + entry.decoder.getName() + " epoch " +
+                  str(entry.mapping.added) + ")")
 
     def close(self):
-        for entry in self.entries:
-            entry.decoder.close()
+        for decoder in self.decoders.values():
+            decoder.close()
+
+class ModuleDecoderManager():
+    """
+    Decodes (module id, offset) pairs of module address traces using the
+    module table stored in the trace - no memory map file needed.
+    """
+    def __init__(self, filename, modules):
+        self.snoopLibName = "libsnoop.so"
+        self.filename = filename
+        self.decoders = {}
+        for module in modules.values():
+            self.makeDecoder(module)
+
+    def makeDecoder(self, module):
+        if (os.path.basename(module.name) == self.snoopLibName):
+            return
+        helper = PathHelper(module.name)
+        for path in kDsoSearchPath.split(':'):
+            helper.addPath(path)
+        helper.addPath(os.path.dirname(self.filename))
+        filename = helper.getFileName()
+        if (filename == ""):
+            print("Failed to make decoder for module " + module.name)
+            return
+        # Offsets are virtual addresses, not .text relative
+        self.decoders[module.id] = makeDecoder(filename, section=False)
+
+    def decode(self, input_list):
+        """ input_list holds (module id, offset) pairs """
+        queries = {}
+        output_list = [None] * len(input_list)
+        for input_idx, (module_id, offset) in enumerate(input_list):
+            if module_id == kModuleUnknown:
+                # Recorded outside of known modules, offset is absolute
+                output_list[input_idx] = b"0x%x" % offset
+                continue
+            if module_id not in self.decoders:
+                continue
+            query = queries.setdefault(module_id, DecoderQuery([], []))
+            query.inputs.append(hex(offset))
+            query.indexes.append(input_idx)
+        for module_id, query in queries.items():
+            for idx, output in zip(query.indexes,
+                                   self.decoders[module_id].decode(query.inputs)):
+                output_list[idx] = output
+        return output_list
+
+    def debugPrint(self):
+        print("ModuleDecoderManager(filename: " + self.filename + ")")
+        for module_id, decoder in self.decoders.items():
+            print("\tModule(" + str(module_id) + " -> " + decoder.getName() + ")")
+
+    def close(self):
+        for decoder in self.decoders.values():
+            decoder.close()
 '''
 Sync Interface
 
 '''
 
+def makeDecoder(filename, section=True):
+    """
+    libsnoopsym when it loads and reads the file, an addr2line process
+    otherwise. section=True decoders take addresses relative to a mapping
+    (see fromMapping), section=False ones virtual addresses of the file.
+    """
+    decoder = NativeDecoder(filename, section)
+    if decoder.valid():
+        return decoder
+    return Decoder(filename, section)
+
+class NativeDecoder():
+    """ Resolves in process with libsnoopsym, see symbolizer.py """
+    def __init__(self, filename, section=True):
+        self.filename = filename
+        self.section = section
+        self.symbolizer = Symbolizer(filename)
+        self.mutex = QMutex()
+
+    def valid(self):
+        return self.symbolizer.valid()
+
+    def fromMapping(self, value, mapping):
+        # File offset, whatever the mapping's place in the file
+        return hex(value - mapping.begin + mapping.offset)
+
+    def decode(self, input_list):
+        values = [int(data, 16) for data in input_list]
+        self.mutex.lock()
+        if self.section:
+            names = self.symbolizer.resolveOffsets(values)
+        else:
+            names = self.symbolizer.resolve(values)
+        self.mutex.unlock()
+        return [name if name is not None else b"??" for name in names]
+
+    def close(self):
+        self.mutex.lock()
+        self.symbolizer.close()
+        self.mutex.unlock()
+
+    def getName(self):
+        return self.filename
+
 class Decoder():
-    def __init__(self, filename):
+    """ Resolves through an addr2line process (SNOOP_ADDR2LINE_BIN) """
+    def __init__(self, filename, section=True):
         self.filename = filename
-        if isDSO(filename):
+        if section and isDSO(filename):
             command = [kAddr2LineBin, '--section=.text', '-f', '-C', '-e', filename]
         else:
             command = [kAddr2LineBin, '-f', '-C', '-e', filename]
         self.decoder = Popen(command, stdin=PIPE, stdout=PIPE)
         self.mutex = QMutex()
 
+    def fromMapping(self, value, mapping):
+        offset = mapping.begin
+        if (kMemoryMode == "arm" and offset == kArmBinOffset):
+            offset = 0
+        return hex(value - offset)
+
     def decode(self, input_list):
         self.mutex.lock()
         output_list = []
@@ -36,10 +36,17 @@ from PyQt5.QtCore import pyqtSignal
 from PyQt5.QtCore import pyqtSlot
 
 from decoder import DecoderManager
+from decoder import ModuleDecoderManager
+from snoopformat import SnoopTrace
+from snoopformat import kExit
+from snoopformat import kSuppressed
+from snoopformat import kDropped
+from snoopformat import kModuleLoad
+from snoopformat import kModuleUnload
+from snoopformat import splitModuleAddress
+from snoopindex import openIndex
 
 
-kAddressByteCount = int(os.getenv("SNOOP_ADDRESS_BYTE_COUNT", 8))
-
 logging.basicConfig(
     format="%(asctime)-15s [%(levelname)s] %(funcName)s: %(message)s",
     level=logging.DEBUG)
@@ -53,8 +60,6 @@ def dec(entry):
 class SnoopFile():
     def __init__(self):
         self.pos = 0
-        # Number of bytes in address
-        self.entry_size = kAddressByteCount
         # TODO
         self.cache = {}
         self.me = self.__class__.__name__
@@ -62,24 +67,81 @@ class SnoopFile():
     def open(self, filename):
         logging.debug("(%s) %s", self.me, filename)
 
-        self.snoop_file = open(filename, "rb")
-        self.snoop_file.seek(0, 2)
-        self.size = int(self.snoop_file.tell() / self.entry_size)
-        self.snoop_file.seek(0, 1)
-
-        mapFileName = self.mapFileForSnoop(filename)
-
-        self.decoder_manager = DecoderManager(mapFileName)
+        self.trace = SnoopTrace(filename)
+        self.size = self.trace.size
+        # Search index, opened on first search
+        self.index = None
+        # Rows show time relative to first event
+        self.origin_ns = None
+        if self.trace.isTimed() and self.size > 0:
+            self.origin_ns = self.trace.toNs(self.trace.read(0, 1)[0].timestamp)
+
+        if self.trace.hasModules():
+            self.decoder_manager = ModuleDecoderManager(filename, self.trace.modules)
+        else:
+            mapFileName = self.mapFileForSnoop(filename)
+            self.decoder_manager = DecoderManager(mapFileName)
         self.decoder_manager.debugPrint()
 
     def seek(self, pos):
         logging.debug("(%s) %d", self.me, pos)
         assert pos <= self.size, "out of bounds seek pos"
-        self.snoop_file.seek(pos * self.entry_size)
         self.pos = pos
 
     def readToMatch(self, phrase, amount):
         logging.debug("(%s) %s pos %d size %d", self.me, phrase, self.pos, self.size)
+        if self.index is None:
+            self.index = openIndex(self.trace)
+        if self.index is None:
+            return self.scanToMatch(phrase, amount)
+        old_pos = self.pos
+        blocks = [self.trace.blocks[ordinal]
+                  for ordinal in self.index.find(phrase, self.decodeKeys)]
+
+        # Candidate blocks from current pos to EOF, then from beginning
+        match = None
+        for lower, upper in ((old_pos, self.size), (0, old_pos)):
+            for block in blocks:
+                match = self.matchInBlock(block, phrase, lower, upper)
+                if match is not None:
+                    break
+            if match is not None:
+                break
+        if match is None:
+            self.seek(old_pos)
+            return [], self.pos
+        self.seek(min(match, max(0, self.size - amount)))
+        return self.read(amount), self.pos
+
+    def matchInBlock(self, block, phrase, lower, upper):
+        """ Position of the first row in [lower, upper) of block containing phrase """
+        begin = max(block.first, lower)
+        end = min(block.first + block.count, upper)
+        if begin >= end:
+            return None
+        self.seek(begin)
+        for idx, out in enumerate(self.read(end - begin)):
+            if phrase in dec(out):
+                return begin + idx
+        return None
+
+    def decodeKeys(self, keys):
+        """ Names of the (epoch, address) keys of the search index """
+        if self.trace.hasModules():
+            return self.decoder_manager.decode(
+                [splitModuleAddress(address) for epoch, address in keys])
+        groups = {}
+        for idx, (epoch, address) in enumerate(keys):
+            groups.setdefault(epoch, []).append(idx)
+        names = [None] * len(keys)
+        for epoch, indexes in groups.items():
+            output = self.decoder_manager.decode(["%x" % keys[idx][1] for idx in indexes], epoch)
+            for idx, name in zip(indexes, output):
+                names[idx] = name
+        return names
+
+    def scanToMatch(self, phrase, amount):
+        """ Search decoding every row, for traces without blocks """
         old_pos = self.pos
 
         # Search from current pos to EOF
@@ -107,21 +169,51 @@ class SnoopFile():
 
     def read(self, size):
         logging.debug("(%s) pos=%d size=%u total_size=%u", self.me, self.pos, size, self.size)
-        entry_size = self.entry_size
-        raw_in = self.snoop_file.read(size * entry_size)
-        raw_len = len(raw_in)
-        dec_in = []
-        assert raw_len % entry_size == 0, "malformed snoop file read"
-        for cnt in [i * entry_size for i in range(raw_len // entry_size)]:
-            entry = raw_in[cnt : cnt + entry_size][::-1].hex()
-            dec_in.append(entry)
-        dec_out = self.decoder_manager.decode(dec_in)
-        self.pos += raw_len // entry_size
+        events = self.trace.read(self.pos, size)
+        if self.trace.hasModules():
+            dec_in = [splitModuleAddress(event.address) for event in events]
+            dec_out = self.decoder_manager.decode(dec_in)
+        else:
+            dec_in = ["%x" % event.address for event in events]
+            dec_out = self.decodeByEpoch(dec_in)
+        for idx, event in enumerate(events):
+            name = dec_out[idx] if isinstance(dec_out[idx], bytes) else b"??"
+            if event.type == kSuppressed:
+                # depth is the count of calls left out by sampling
+                row = b"## " + name + b" x%d not recorded" % event.depth
+            elif event.type == kDropped:
+                # Gap in the trace, the tracer could not keep up
+                row = b"## %d events lost" % event.depth
+            elif event.type in (kModuleLoad, kModuleUnload):
+                module = self.trace.modules.get(event.depth)
+                path = module.name.encode() if module else b"??"
+                verb = b"loaded" if event.type == kModuleLoad else b"unloaded"
+                row = b"## %s %s at 0x%x" % (verb, path, event.address)
+            else:
+                arrow = b"<- " if event.type == kExit else b"-> "
+                row = b"  " * event.depth + arrow + name
+            if self.origin_ns is not None:
+                delta_us = (self.trace.toNs(event.timestamp) - self.origin_ns) / 1000.0
+                row = b"[%14.3f us] " % delta_us + row
+            dec_out[idx] = row
+        self.pos += len(events)
+        return dec_out
+
+    def decodeByEpoch(self, dec_in):
+        # Addresses resolve with the memory map of the block they came in
+        groups = {}
+        for idx in range(len(dec_in)):
+            groups.setdefault(self.trace.epochAt(self.pos + idx), []).append(idx)
+        dec_out = [None] * len(dec_in)
+        for epoch, indexes in groups.items():
+            output = self.decoder_manager.decode([dec_in[idx] for idx in indexes], epoch)
+            for idx, name in zip(indexes, output):
+                dec_out[idx] = name
         return dec_out
 
     def close(self):
         logging.debug("(%s)", self.me)
-        self.snoop_file.close()
+        self.trace.close()
         self.decoder_manager.close()
 
     def mapFileForSnoop(self, filename):
@@ -0,0 +1,603 @@
+#!/usr/bin/python3
+"""
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+"""
+import struct
+import zlib
+import os
+
+import glob
+import shutil
+import subprocess
+import tempfile
+import unittest
+
+kAddressByteCount = int(os.getenv("SNOOP_ADDRESS_BYTE_COUNT", 8))
+
+kMagic = b"SNOOP\0\0\0"
+kBlockMagic = 0x4b4c4253
+
+# Mirrors libsnoop/format.h (native endianness, little endian assumed)
+kFileHeader = struct.Struct("<8sIIIIiiIIQQd")
+kBlockHeader = struct.Struct("<IIII")
+kModuleEntry = struct.Struct("<IIQ")
+kEpochEntry = struct.Struct("<II")
+
+# FileFlags
+kFileModuleAddress = 1 << 0
+# See format::kModuleUnknown and format::kModuleAbsolute
+kModuleUnknown = 0
+kModuleAbsolute = 1 << 63
+
+class FileHeader():
+    __slots__ = ["version", "header_size", "address_size", "record_size",
+                 "pid", "tid", "clock_source", "flags", "tick_base", "ns_base",
+                 "ns_per_tick"]
+    def __init__(self, raw):
+        (magic, self.version, self.header_size, self.address_size,
+         self.record_size, self.pid, self.tid, self.clock_source, self.flags,
+         self.tick_base, self.ns_base, self.ns_per_tick) = kFileHeader.unpack(raw)
+
+    def toNs(self, ticks):
+        return self.ns_base + (ticks - self.tick_base) * self.ns_per_tick
+
+class Block():
+    __slots__ = ["offset", "first", "count", "payload_size", "flags", "epoch"]
+    def __init__(self, offset, first, count, payload_size, flags, epoch=0):
+        # File offset of payload
+        self.offset = offset
+        # Index of first event in trace
+        self.first = first
+        self.count = count
+        self.payload_size = payload_size
+        self.flags = flags
+        # Memory map epoch, 0 when the file names none
+        self.epoch = epoch
+
+# RecordType
+kEnter = 0
+kExit = 1
+# depth holds count of calls not recorded by sampling
+kSuppressed = 2
+# Previous address events repeat depth more times, ending at timestamp
+kRepeat = 3
+# depth holds count of events lost to overflow just before this one
+kDropped = 4
+# Module depth loaded / unloaded, address is its load bias
+kModuleLoad = 5
+kModuleUnload = 6
+
+# BlockFlags
+kBlockDelta = 1 << 0
+kBlockZlib = 1 << 1
+kBlockModules = 1 << 2
+kBlockRepeat = 1 << 3
+kBlockEpoch = 1 << 4
+# See format::BlockEncoder
+kTypeBits = 4
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+def readVarint(raw, pos):
+    result = 0
+    shift = 0
+    while True:
+        byte = raw[pos]
+        pos += 1
+        result |= (byte & 0x7f) << shift
+        if byte < 0x80:
+            return result, pos
+        shift += 7
+
+def decodeDelta(raw, count, address_mask):
+    """ count None decodes until raw is exhausted """
+    events = []
+    pos = 0
+    address = 0
+    timestamp = 0
+    depth = 0
+    while pos < len(raw) if count is None else len(events) < count:
+        value, pos = readVarint(raw, pos)
+        address = (address + unzigzag(value)) & address_mask
+        value, pos = readVarint(raw, pos)
+        timestamp = (timestamp + unzigzag(value)) & 0xffffffffffffffff
+        value, pos = readVarint(raw, pos)
+        depth += unzigzag(value >> kTypeBits)
+        events.append(Event(timestamp, address, value & ((1 << kTypeBits) - 1), depth))
+    return events
+
+class Module():
+    __slots__ = ["id", "name", "base"]
+    def __init__(self, id, name, base):
+        self.id = id
+        self.name = name
+        # Load bias, offsets are ELF virtual addresses
+        self.base = base
+
+def decodeModules(raw):
+    modules = []
+    pos = 0
+    while pos + kModuleEntry.size <= len(raw):
+        id, name_size, base = kModuleEntry.unpack_from(raw, pos)
+        pos += kModuleEntry.size
+        name = raw[pos : pos + name_size].decode("utf-8", "replace")
+        pos += (name_size + 7) & ~7
+        modules.append(Module(id, name, base))
+    return modules
+
+class Mapping():
+    __slots__ = ["begin", "end", "offset", "path", "added", "removed"]
+    def __init__(self, begin, end, path, added, offset=0):
+        self.begin = begin
+        self.end = end
+        # File offset mapped at begin
+        self.offset = offset
+        self.path = path
+        # Epochs the mapping was added in and removed in (None while mapped)
+        self.added = added
+        self.removed = None
+
+    def mappedAt(self, epoch):
+        return self.added <= epoch and (self.removed is None or self.removed > epoch)
+
+def readMemoryMap(filename):
+    """
+    Executable mappings of a .map file (see MemoryMap). Plain copies of
+    /proc/pid/maps read as a single epoch 0. Returns (mappings, last epoch).
+    """
+    mappings = []
+    epoch = 0
+    with open(filename, "r") as memoryMap:
+        for line in memoryMap:
+            line = line.rstrip("\n")
+            if line.startswith("# epoch "):
+                epoch = int(line.split()[2])
+                continue
+            removed = line.startswith("- ")
+            if removed:
+                line = line[2:]
+            fields = line.split()
+            # Anonymous mappings have no path
+            if len(fields) < 6 or "x" not in fields[1]:
+                continue
+            begin, end = [int(value, 16) for value in fields[0].split("-")]
+            path = line[line.index(fields[5], len(" ".join(fields[:5]))):]
+            if not removed:
+                mappings.append(Mapping(begin, end, path, epoch, int(fields[2], 16)))
+                continue
+            for mapping in reversed(mappings):
+                if (mapping.begin == begin and mapping.end == end and
+                        mapping.path == path and mapping.removed is None):
+                    mapping.removed = epoch
+                    break
+    return mappings, epoch
+
+def splitModuleAddress(address):
+    """ (module id, offset) of an address in kFileModuleAddress files,
+    (kModuleUnknown, absolute address) outside of known modules """
+    if address & kModuleAbsolute:
+        return kModuleUnknown, address & ~kModuleAbsolute
+    return address >> 32, address & 0xffffffff
+
+def expandRepeats(events):
+    """ Replaces kRepeat events with the repetitions they stand for """
+    expanded = []
+    for event in events:
+        if event.type != kRepeat:
+            expanded.append(event)
+            continue
+        period = expanded[-event.address:]
+        copies = event.depth
+        # Only the end of the run is known - spread repetitions evenly
+        step = (event.timestamp - period[-1].timestamp) / copies if copies else 0
+        for copy in range(1, copies + 1):
+            shift = int(round(step * copy))
+            for original in period:
+                expanded.append(Event(original.timestamp + shift, original.address,
+                                      original.type, original.depth))
+    return expanded
+
+class Event():
+    __slots__ = ["timestamp", "address", "type", "depth"]
+    def __init__(self, timestamp, address, type=kEnter, depth=0):
+        self.timestamp = timestamp
+        self.address = address
+        self.type = type
+        self.depth = depth
+
+class Span():
+    __slots__ = ["address", "depth", "begin", "end"]
+    def __init__(self, address, depth, begin, end):
+        self.address = address
+        self.depth = depth
+        # Timestamps, None when enter or exit is outside of given events
+        self.begin = begin
+        self.end = end
+
+def buildSpans(events):
+    """ Rebuild nested calls from enter/exit events (ordered by begin) """
+    spans = []
+    stack = []
+    for event in events:
+        if event.type == kEnter:
+            stack.append(len(spans))
+            spans.append(Span(event.address, event.depth, event.timestamp, None))
+        elif event.type == kExit:
+            # Unwind to the matching enter - exits may be unbalanced when
+            # tracing started or events were lost inside a call
+            while stack and spans[stack[-1]].depth > event.depth:
+                stack.pop()
+            if stack and spans[stack[-1]].depth == event.depth:
+                spans[stack.pop()].end = event.timestamp
+            else:
+                spans.append(Span(event.address, event.depth, None, event.timestamp))
+    return spans
+
+'''
+Reader for .snoop files
+
+v2 files start with FileHeader and carry block framed timestamped records.
+v1 files are a bare sequence of addresses (SNOOP_ADDRESS_BYTE_COUNT wide).
+'''
+
+class SnoopTrace():
+    def __init__(self, filename):
+        self.filename = filename
+        self.file = open(filename, "rb")
+        self.header = None
+        self.blocks = []
+        # Module id -> Module, for kFileModuleAddress files
+        self.modules = {}
+        self.size = 0
+        magic = self.file.read(len(kMagic))
+        if magic == kMagic:
+            self.file.seek(0)
+            self.header = FileHeader(self.file.read(kFileHeader.size))
+            self.buildIndex(self.header.header_size)
+        else:
+            self.file.seek(0, 2)
+            self.size = self.file.tell() // kAddressByteCount
+
+    def hasModules(self):
+        return self.header is not None and (self.header.flags & kFileModuleAddress) != 0
+
+    def isTimed(self):
+        return self.header is not None and self.header.clock_source != 0
+
+    def buildIndex(self, offset):
+        first = 0
+        epoch = 0
+        while True:
+            self.file.seek(offset)
+            raw = self.file.read(kBlockHeader.size)
+            if len(raw) < kBlockHeader.size:
+                break
+            magic, count, payload_size, flags = kBlockHeader.unpack(raw)
+            # Zero filled tail left by mmap sink of a crashed process
+            if magic == 0:
+                break
+            if magic != kBlockMagic:
+                print("Malformed block at offset " + str(offset))
+                break
+            offset += kBlockHeader.size
+            if flags & kBlockModules:
+                for module in decodeModules(self.file.read(payload_size)):
+                    self.modules[module.id] = module
+                offset += payload_size
+                continue
+            if flags & kBlockEpoch:
+                epoch = kEpochEntry.unpack(self.file.read(kEpochEntry.size))[0]
+                offset += payload_size
+                continue
+            self.blocks.append(Block(offset, first, count, payload_size, flags, epoch))
+            first += count
+            offset += payload_size
+        self.size = first
+
+    def findBlockIdx(self, pos):
+        first = 0
+        last = len(self.blocks) - 1
+        while (first <= last):
+            current = first + (last - first) // 2
+            block = self.blocks[current]
+            if (pos >= block.first and pos < block.first + block.count):
+                return current
+            if (pos >= block.first + block.count):
+                first = current + 1
+            else:
+                last = current - 1
+        return -1
+
+    def decodeBlock(self, block):
+        self.file.seek(block.offset)
+        raw = self.file.read(block.payload_size)
+        record_size = self.header.record_size
+        address_size = self.header.address_size
+        if block.flags & kBlockZlib:
+            raw = zlib.decompress(raw)
+        repeat = (block.flags & kBlockRepeat) != 0
+        if block.flags & kBlockDelta:
+            events = decodeDelta(raw, None if repeat else block.count,
+                                 (1 << (8 * address_size)) - 1)
+            return expandRepeats(events) if repeat else events
+        address_fmt = "<Q" if address_size == 8 else "<I"
+        # type and depth follow the address (see format::Record)
+        extra_offset = 8 + max(address_size, 8)
+        has_extra = record_size >= extra_offset + 8
+        events = []
+        stored = len(raw) // record_size if repeat else block.count
+        for cnt in range(stored):
+            base = cnt * record_size
+            timestamp = struct.unpack_from("<Q", raw, base)[0]
+            address = struct.unpack_from(address_fmt, raw, base + 8)[0]
+            if has_extra:
+                type, depth = struct.unpack_from("<II", raw, base + extra_offset)
+                events.append(Event(timestamp, address, type, depth))
+            else:
+                events.append(Event(timestamp, address))
+        return expandRepeats(events) if repeat else events
+
+    def readV1(self, pos, count):
+        self.file.seek(pos * kAddressByteCount)
+        raw = self.file.read(count * kAddressByteCount)
+        address_fmt = "<Q" if kAddressByteCount == 8 else "<I"
+        return [Event(None, struct.unpack_from(address_fmt, raw, cnt)[0])
+                for cnt in range(0, len(raw) - len(raw) % kAddressByteCount,
+                                 kAddressByteCount)]
+
+    def read(self, pos, count):
+        if self.header is None:
+            return self.readV1(pos, count)
+        events = []
+        block_idx = self.findBlockIdx(pos)
+        while block_idx >= 0 and block_idx < len(self.blocks) and count > 0:
+            block = self.blocks[block_idx]
+            decoded = self.decodeBlock(block)
+            begin = pos - block.first
+            chunk = decoded[begin : begin + count]
+            events += chunk
+            pos += len(chunk)
+            count -= len(chunk)
+            block_idx += 1
+        return events
+
+    def epochAt(self, pos):
+        """ Memory map epoch of event at pos, 0 when unknown """
+        block_idx = self.findBlockIdx(pos)
+        return self.blocks[block_idx].epoch if block_idx >= 0 else 0
+
+    def toNs(self, timestamp):
+        if not self.isTimed() or timestamp is None:
+            return None
+        return self.header.toNs(timestamp)
+
+    def close(self):
+        self.file.close()
+
+'''
+Unit Testing
+
+'''
+class SnoopTraceTestCase(unittest.TestCase):
+    kTestFile = "snoopformat_test.snoop"
+    kMapFile = "snoopformat_test.map"
+
+    def setUp(self):
+        with open(self.kTestFile, "wb") as out:
+            out.write(kFileHeader.pack(kMagic, 2, kFileHeader.size, 8, 24,
+                                       1, 2, 1, 0, 100, 1000, 0.5))
+            for block in range(3):
+                out.write(kBlockHeader.pack(kBlockMagic, 4, 4 * 24, 0))
+                for cnt in range(4):
+                    idx = block * 4 + cnt
+                    out.write(struct.pack("<QQII", 100 + idx * 2, 0x1000 + idx,
+                                          idx % 2, 0))
+
+    def test_read(self):
+        trace = SnoopTrace(self.kTestFile)
+        self.assertEqual(trace.size, 12)
+        events = trace.read(3, 6)
+        self.assertEqual([e.address for e in events], list(range(0x1003, 0x1009)))
+        self.assertEqual(trace.toNs(events[0].timestamp), 1003)
+        self.assertEqual(len(trace.read(10, 5)), 2)
+        self.assertEqual(events[1].type, kEnter)
+        trace.close()
+
+    def test_modules(self):
+        name = b"/usr/lib/libtest1.so"
+        with open(self.kTestFile, "wb") as out:
+            out.write(kFileHeader.pack(kMagic, 2, kFileHeader.size, 8, 24,
+                                       1, 2, 0, kFileModuleAddress, 0, 0, 0.0))
+            entry = kModuleEntry.pack(3, len(name), 0x7f0000000000) + name
+            entry += b"\0" * (-len(entry) % 8)
+            out.write(kBlockHeader.pack(kBlockMagic, 0, len(entry), kBlockModules))
+            out.write(entry)
+            out.write(kBlockHeader.pack(kBlockMagic, 2, 48, 0))
+            out.write(struct.pack("<QQII", 0, 3 << 32 | 0x1234, kEnter, 0))
+            out.write(struct.pack("<QQII", 1, kModuleAbsolute | 0x7ffd12345678,
+                                  kEnter, 1))
+        trace = SnoopTrace(self.kTestFile)
+        self.assertTrue(trace.hasModules())
+        self.assertEqual(trace.size, 2)
+        self.assertEqual(trace.modules[3].name, name.decode())
+        events = trace.read(0, 2)
+        self.assertEqual(splitModuleAddress(events[0].address), (3, 0x1234))
+        self.assertEqual(splitModuleAddress(events[1].address),
+                         (kModuleUnknown, 0x7ffd12345678))
+        trace.close()
+
+    def test_epochs(self):
+        with open(self.kTestFile, "wb") as out:
+            out.write(kFileHeader.pack(kMagic, 2, kFileHeader.size, 8, 24,
+                                       1, 2, 1, 0, 0, 0, 1.0))
+            for epoch in [1, 3]:
+                out.write(kBlockHeader.pack(kBlockMagic, 0, kEpochEntry.size,
+                                            kBlockEpoch))
+                out.write(kEpochEntry.pack(epoch, 0))
+                out.write(kBlockHeader.pack(kBlockMagic, 2, 2 * 24, 0))
+                for cnt in range(2):
+                    out.write(struct.pack("<QQII", epoch * 10 + cnt, 0x1000, kEnter, 0))
+        trace = SnoopTrace(self.kTestFile)
+        self.assertEqual(trace.size, 4)
+        self.assertEqual([trace.epochAt(pos) for pos in range(4)], [1, 1, 3, 3])
+        trace.close()
+
+    def test_memory_map(self):
+        with open(self.kMapFile, "w") as out:
+            out.write("# epoch 1 0\n"
+                      "1000-2000 r-xp 00001000 fe:00 1    /bin/app\n"
+                      "3000-4000 r-xp 00001000 fe:00 2    /lib/libold.so\n"
+                      "5000-6000 rw-p 00000000 00:00 0\n"
+                      "# epoch 2 50\n"
+                      "- 3000-4000 r-xp 00001000 fe:00 2    /lib/libold.so\n"
+                      "# epoch 3 80\n"
+                      "3000-4000 r-xp 00001000 fe:00 3    /lib/my lib.so\n")
+        mappings, last = readMemoryMap(self.kMapFile)
+        self.assertEqual(last, 3)
+        self.assertEqual([m.path for m in mappings],
+                         ["/bin/app", "/lib/libold.so", "/lib/my lib.so"])
+        self.assertEqual(mappings[0].offset, 0x1000)
+        self.assertEqual([m.path for m in mappings if m.mappedAt(1)],
+                         ["/bin/app", "/lib/libold.so"])
+        self.assertEqual([m.path for m in mappings if m.mappedAt(2)], ["/bin/app"])
+        self.assertEqual([m.path for m in mappings if m.mappedAt(3)],
+                         ["/bin/app", "/lib/my lib.so"])
+        os.remove(self.kMapFile)
+
+    # testapps/encode_block output, BlockEncoder payload of these records
+    kDeltaBlock = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                               "testdata", "delta_block.bin")
+    kDeltaRecords = [(0x5000, 10, kEnter, 0), (0x4000, 15, kEnter, 1),
+                     (0x4000, 12, kExit, 1), (0x7f3a9c5e1234, 0x123456789a, kEnter, 300),
+                     (2 << 32 | 0x1200, 0x123456789b, kSuppressed, 2),
+                     (kModuleAbsolute | 0x7ffd1000, 0x8000000000000010, kExit, 0)]
+
+    def test_delta(self):
+        with open(self.kDeltaBlock, "rb") as block:
+            raw = block.read()
+        for data in [raw, zlib.compress(raw)]:
+            if data != raw:
+                data = zlib.decompress(data)
+            events = decodeDelta(data, None, (1 << 64) - 1)
+            self.assertEqual([(e.address, e.timestamp, e.type, e.depth) for e in events],
+                             self.kDeltaRecords)
+
+    def test_repeat(self):
+        records = [(0xa, 10, kEnter, 0), (0xa, 12, kExit, 0),
+                   (0xb, 14, kEnter, 0), (0xb, 16, kExit, 0),
+                   (2, 36, kRepeat, 5), (0xc, 40, kEnter, 0)]
+        with open(self.kTestFile, "wb") as out:
+            out.write(kFileHeader.pack(kMagic, 2, kFileHeader.size, 8, 24,
+                                       1, 2, 1, 0, 0, 0, 1.0))
+            out.write(kBlockHeader.pack(kBlockMagic, 15, len(records) * 24,
+                                        kBlockRepeat))
+            for address, timestamp, type, depth in records:
+                out.write(struct.pack("<QQII", timestamp, address, type, depth))
+        trace = SnoopTrace(self.kTestFile)
+        self.assertEqual(trace.size, 15)
+        events = trace.read(0, 15)
+        self.assertEqual([e.address for e in events],
+                         [0xa, 0xa, 0xb, 0xb] + [0xb, 0xb] * 5 + [0xc])
+        self.assertEqual([e.timestamp for e in events[3:6]], [16, 18, 20])
+        self.assertEqual(trace.read(13, 2)[1].address, 0xc)
+        trace.close()
+
+    def test_spans(self):
+        events = [Event(1, 0xa, kEnter, 0), Event(2, 0xb, kEnter, 1),
+                  Event(3, 0xb, kExit, 1), Event(4, 0xc, kEnter, 1),
+                  Event(6, 0xa, kExit, 0), Event(7, 0xd, kExit, 0)]
+        spans = buildSpans(events)
+        self.assertEqual([(s.address, s.depth, s.begin, s.end) for s in spans],
+                         [(0xa, 0, 1, 6), (0xb, 1, 2, 3), (0xc, 1, 4, None),
+                          (0xd, 0, None, 7)])
+
+    def tearDown(self):
+        os.remove(self.kTestFile)
+
+class TestAppTestCase(unittest.TestCase):
+    """ Traces of testapps, SNOOP_TESTAPPS names the out/testapps dir """
+    kCalls = 100
+
+    def setUp(self):
+        self.apps = os.getenv("SNOOP_TESTAPPS")
+        if not self.apps:
+            self.skipTest("testapps not found, set SNOOP_TESTAPPS")
+        self.output = tempfile.mkdtemp()
+
+    def trace(self, app, **env):
+        """ Events and modules of the main thread of app """
+        env = dict(os.environ, **env)
+        env["LD_PRELOAD"] = os.path.join(self.apps, "..", "libsnoop.so")
+        subprocess.check_call([os.path.join(os.path.abspath(self.apps), app)],
+                              cwd=self.output, env=env, stdout=subprocess.DEVNULL)
+        pid = os.path.basename(glob.glob(os.path.join(self.output, "*.map"))[0])
+        name = os.path.join(self.output, "funcenter_%s_%s.snoop" %
+                            ((pid[:-len(".map")],) * 2))
+        # Threads without a single traced call leave no file
+        if not os.path.exists(name):
+            return [], {}
+        trace = SnoopTrace(name)
+        events = trace.read(0, trace.size)
+        modules = dict(trace.modules)
+        trace.close()
+        return events, modules
+
+    def test_dlswap_modules(self):
+        events, modules = self.trace("test_dlswap", SNOOP_ADDRESS="module")
+        names = [os.path.basename(modules[splitModuleAddress(e.address)[0]].name)
+                 for e in events if e.type == kEnter]
+        libraries = [name for name in names if name.startswith("libtest")]
+        # Calls after the poll are told apart from the unloaded libtest1
+        self.assertEqual(libraries[:self.kCalls], ["libtest1.so"] * self.kCalls)
+        self.assertEqual(libraries[-self.kCalls:], ["libtest2.so"] * self.kCalls)
+
+    def test_dlswap_include(self):
+        # The executable is traced as well, so writers run and poll modules
+        events, modules = self.trace("test_dlswap", SNOOP_ADDRESS="module",
+                                     SNOOP_INCLUDE="libtest2,test_dlswap")
+        names = [os.path.basename(modules[splitModuleAddress(e.address)[0]].name)
+                 for e in events if e.type == kEnter]
+        # Loaded into the range of the excluded libtest1 after startup
+        self.assertNotIn("libtest1.so", names)
+        self.assertGreaterEqual(names.count("libtest2.so"), self.kCalls)
+
+    def test_flightring(self):
+        # Not traced, the ring is exercised directly
+        subprocess.check_call([os.path.join(self.apps, "test_flightring")],
+                              stdout=subprocess.DEVNULL)
+
+    def test_encode_block(self):
+        # Checked in output stays what BlockEncoder produces
+        app = os.path.join(self.apps, "encode_block")
+        with open(SnoopTraceTestCase.kDeltaBlock, "rb") as block:
+            raw = block.read()
+        self.assertEqual(subprocess.check_output([app, "delta"]), raw)
+        self.assertEqual(zlib.decompress(subprocess.check_output([app, "zlib"])), raw)
+
+    def tearDown(self):
+        if hasattr(self, "output"):
+            shutil.rmtree(self.output)
+
+if __name__ == '__main__':
+    unittest.main()
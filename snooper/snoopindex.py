@@ -0,0 +1,250 @@
+#!/usr/bin/python3
+"""
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+"""
+import struct
+import sys
+import os
+
+import unittest
+
+from snoopformat import SnoopTrace
+from snoopformat import kEnter
+from snoopformat import kExit
+from snoopformat import kSuppressed
+from snoopformat import kBlockHeader
+from snoopformat import kBlockMagic
+from snoopformat import kFileHeader
+from snoopformat import kMagic
+
+'''
+Sidecar search index of a .snoop trace, <trace>.idx
+
+  snoopindex.py <trace.snoop>...
+
+For every distinct (epoch, address) of the function events in the trace it
+keeps the ordinals of the record blocks holding it (a postings list). A
+search decodes the distinct addresses once and reads only the blocks of
+those whose names match, instead of decoding the whole trace. Built by the
+command above or by the viewer on its first search, rebuilt when the trace
+changed since.
+
+'''
+
+kIndexMagic = b"SNOOPIDX"
+kIndexVersion = 1
+kIndexExt = ".idx"
+
+# magic, version, block count, other count, entry count, trace size, trace mtime ns
+kIndexHeader = struct.Struct("<8sIIIIQQ")
+# address, epoch, posting count, postings file offset
+kIndexEntry = struct.Struct("<QIIQ")
+kPosting = struct.Struct("<I")
+
+# Events named after the function at their address
+kFunctionTypes = (kEnter, kExit, kSuppressed)
+# Row text around a function name (see SnoopFile.read)
+kRowPrefixes = (b"", b"-> ", b"<- ", b"## ")
+
+def indexPath(filename):
+    return filename + kIndexExt
+
+def traceStamp(filename):
+    status = os.stat(filename)
+    return status.st_size, status.st_mtime_ns
+
+class SnoopIndex():
+    def __init__(self, keys, other, postings):
+        # Sorted (epoch, address) of the entries
+        self.keys = keys
+        # Ordinals of blocks with rows not named after a function - events
+        # lost, modules loaded and calls left out by sampling
+        self.other = other
+        # postings(entry idx) -> block ordinals of the entry
+        self.postings = postings
+        # Decoded keys, filled by the first search
+        self.names = None
+
+    def find(self, phrase, resolve):
+        """
+        Sorted ordinals of the blocks that may hold a row containing
+        phrase. resolve(keys) decodes keys to names (bytes).
+        """
+        if self.names is None:
+            self.names = resolve(self.keys)
+        needle = phrase.encode()
+        blocks = set(self.other)
+        for idx, name in enumerate(self.names):
+            name = name if isinstance(name, bytes) else b"??"
+            if any(needle in prefix + name for prefix in kRowPrefixes):
+                blocks.update(self.postings(idx))
+        return sorted(blocks)
+
+def buildIndex(trace):
+    """ Index of a SnoopTrace, written next to the trace when possible """
+    postings = {}
+    other = []
+    for ordinal, block in enumerate(trace.blocks):
+        keys = set()
+        named = True
+        for event in trace.decodeBlock(block):
+            if event.type in kFunctionTypes:
+                keys.add((block.epoch, event.address))
+            named = named and event.type in (kEnter, kExit)
+        for key in keys:
+            postings.setdefault(key, []).append(ordinal)
+        if not named:
+            other.append(ordinal)
+    keys = sorted(postings)
+    lists = [postings[key] for key in keys]
+    try:
+        writeIndex(trace, keys, other, lists)
+    except (IOError, OSError) as error:
+        print("Index not saved: " + str(error))
+    return SnoopIndex(keys, other, lambda idx: lists[idx])
+
+def writeIndex(trace, keys, other, lists):
+    size, mtime_ns = traceStamp(trace.filename)
+    filename = indexPath(trace.filename)
+    temporary = filename + ".%d" % os.getpid()
+    with open(temporary, "wb") as out:
+        out.write(kIndexHeader.pack(kIndexMagic, kIndexVersion, len(trace.blocks),
+                                    len(other), len(keys), size, mtime_ns))
+        out.write(struct.pack("<%dI" % len(other), *other))
+        offset = (kIndexHeader.size + len(other) * kPosting.size +
+                  len(keys) * kIndexEntry.size)
+        for (epoch, address), blocks in zip(keys, lists):
+            out.write(kIndexEntry.pack(address, epoch, len(blocks), offset))
+            offset += len(blocks) * kPosting.size
+        for blocks in lists:
+            out.write(struct.pack("<%dI" % len(blocks), *blocks))
+    # Readers only ever see complete files
+    os.replace(temporary, filename)
+
+def loadIndex(trace):
+    """ Index of a SnoopTrace from its sidecar file, None if missing or stale """
+    filename = indexPath(trace.filename)
+    try:
+        with open(filename, "rb") as index:
+            raw = index.read(kIndexHeader.size)
+            if len(raw) < kIndexHeader.size:
+                return None
+            (magic, version, block_count, other_count, entry_count, size,
+             mtime_ns) = kIndexHeader.unpack(raw)
+            if (magic != kIndexMagic or version != kIndexVersion or
+                    block_count != len(trace.blocks) or
+                    (size, mtime_ns) != traceStamp(trace.filename)):
+                return None
+            other = list(struct.unpack("<%dI" % other_count,
+                                       index.read(other_count * kPosting.size)))
+            raw = index.read(entry_count * kIndexEntry.size)
+    except (IOError, OSError, struct.error):
+        return None
+    if len(raw) != entry_count * kIndexEntry.size:
+        return None
+    keys = []
+    locations = []
+    for address, epoch, count, offset in kIndexEntry.iter_unpack(raw):
+        keys.append((epoch, address))
+        locations.append((count, offset))
+
+    def postings(idx):
+        count, offset = locations[idx]
+        with open(filename, "rb") as index:
+            index.seek(offset)
+            return struct.unpack("<%dI" % count, index.read(count * kPosting.size))
+    return SnoopIndex(keys, other, postings)
+
+def openIndex(trace):
+    """ Loaded sidecar index of a SnoopTrace, built when missing or stale """
+    if trace.header is None:
+        # Headerless traces have no blocks to index
+        return None
+    index = loadIndex(trace)
+    return index if index is not None else buildIndex(trace)
+
+'''
+Unit Testing
+
+'''
+class SnoopIndexTestCase(unittest.TestCase):
+    kTestFile = "snoopindex_test.snoop"
+
+    def setUp(self):
+        # Block n calls 0x1000 + n, block 2 also 0x1000 and loses events
+        with open(self.kTestFile, "wb") as out:
+            out.write(kFileHeader.pack(kMagic, 2, kFileHeader.size, 8, 24,
+                                       1, 2, 1, 0, 0, 0, 1.0))
+            for block in range(4):
+                events = [(0x1000 + block, kEnter), (0x1000 + block, kExit)]
+                if block == 2:
+                    events += [(0x1000, kEnter), (0, 4)]
+                out.write(kBlockHeader.pack(kBlockMagic, len(events), len(events) * 24, 0))
+                for address, type in events:
+                    out.write(struct.pack("<QQII", 0, address, type, 0))
+
+    def resolve(self, keys):
+        self.resolved += 1
+        return [b"fn%x" % address for epoch, address in keys]
+
+    def test_find(self):
+        self.resolved = 0
+        for build in (True, False):
+            trace = SnoopTrace(self.kTestFile)
+            index = buildIndex(trace) if build else loadIndex(trace)
+            self.assertIsNotNone(index)
+            self.assertEqual(index.keys, [(0, 0x1000 + n) for n in range(4)])
+            self.assertEqual(index.find("fn1000", self.resolve), [0, 2])
+            self.assertEqual(index.find("-> fn1003", self.resolve), [2, 3])
+            self.assertEqual(index.find("nothing", self.resolve), [2])
+            trace.close()
+        # Names are decoded once per index
+        self.assertEqual(self.resolved, 2)
+
+    def test_stale(self):
+        trace = SnoopTrace(self.kTestFile)
+        buildIndex(trace)
+        trace.close()
+        with open(self.kTestFile, "ab") as out:
+            out.write(kBlockHeader.pack(kBlockMagic, 1, 24, 0))
+            out.write(struct.pack("<QQII", 0, 0x2000, kEnter, 0))
+        trace = SnoopTrace(self.kTestFile)
+        self.assertIsNone(loadIndex(trace))
+        self.assertEqual(len(openIndex(trace).keys), 5)
+        trace.close()
+
+    def tearDown(self):
+        for filename in (self.kTestFile, indexPath(self.kTestFile)):
+            if os.path.exists(filename):
+                os.remove(filename)
+
+if __name__ == '__main__':
+    if len(sys.argv) > 1:
+        for filename in sys.argv[1:]:
+            trace = SnoopTrace(filename)
+            index = buildIndex(trace)
+            print("%s: %d blocks %d addresses" %
+                  (indexPath(filename), len(trace.blocks), len(index.keys)))
+            trace.close()
+    else:
+        unittest.main()
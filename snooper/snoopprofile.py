@@ -0,0 +1,126 @@
+#!/usr/bin/python3
+"""
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+"""
+import struct
+import sys
+import os
+
+import unittest
+
+'''
+Reader for <pid>.profile files written in SNOOP_MODE=profile
+
+'''
+
+kProfileMagic = b"SNOOPPRF"
+
+# Mirrors libsnoop/profile.h
+kProfileHeader = struct.Struct("<8sIIIIQiIQQd")
+kProfileEntry = struct.Struct("<QQQQ")
+
+class ProfileEntry():
+    __slots__ = ["address", "calls", "inclusive", "exclusive"]
+    def __init__(self, address, calls, inclusive, exclusive):
+        self.address = address
+        self.calls = calls
+        # Clock ticks, see SnoopProfile.toNs
+        self.inclusive = inclusive
+        self.exclusive = exclusive
+
+class SnoopProfile():
+    def __init__(self, filename):
+        self.filename = filename
+        with open(filename, "rb") as profile:
+            raw = profile.read()
+        (magic, self.version, header_size, entry_size, self.thread_count,
+         entry_count, self.pid, self.clock_source, self.tick_base, self.ns_base,
+         self.ns_per_tick) = kProfileHeader.unpack_from(raw)
+        if magic != kProfileMagic:
+            raise ValueError("Not a snoop profile " + filename)
+        self.entries = []
+        for idx in range(entry_count):
+            pos = header_size + idx * entry_size
+            self.entries.append(ProfileEntry(*kProfileEntry.unpack_from(raw, pos)))
+
+    def isTimed(self):
+        return self.clock_source != 0
+
+    def toNs(self, ticks):
+        """ Duration in nanoseconds """
+        return ticks * self.ns_per_tick
+
+def mapFileForProfile(filename):
+    return os.path.join(os.path.dirname(filename),
+                        os.path.basename(filename).split('.')[0] + ".map")
+
+def report(filename, limit):
+    profile = SnoopProfile(filename)
+    entries = sorted(profile.entries, key=lambda e: (e.exclusive, e.calls),
+                     reverse=True)[:limit]
+    names = ["%x" % entry.address for entry in entries]
+    try:
+        # Symbols need addr2line and the map file dumped next to profile
+        from decoder import DecoderManager
+        manager = DecoderManager(mapFileForProfile(filename))
+        names = [name.decode("utf-8") if isinstance(name, bytes) else name
+                 for name in manager.decode(names)]
+        manager.close()
+    except (ImportError, OSError) as error:
+        print("Symbols unavailable: " + str(error))
+    print("pid %d threads %d functions %d" %
+          (profile.pid, profile.thread_count, len(profile.entries)))
+    print("%12s %14s %14s  %s" % ("calls", "incl us", "excl us", "function"))
+    for entry, name in zip(entries, names):
+        print("%12d %14.3f %14.3f  %s" % (entry.calls,
+              profile.toNs(entry.inclusive) / 1000.0,
+              profile.toNs(entry.exclusive) / 1000.0, name))
+
+'''
+Unit Testing
+
+'''
+class SnoopProfileTestCase(unittest.TestCase):
+    kTestFile = "snoopprofile_test.profile"
+
+    def test_read(self):
+        with open(self.kTestFile, "wb") as out:
+            out.write(kProfileHeader.pack(kProfileMagic, 1, kProfileHeader.size,
+                                          kProfileEntry.size, 2, 2, 7, 1, 0, 0, 0.5))
+            out.write(kProfileEntry.pack(0x1000, 3, 300, 100))
+            out.write(kProfileEntry.pack(0x2000, 1, 200, 200))
+        profile = SnoopProfile(self.kTestFile)
+        self.assertEqual(profile.thread_count, 2)
+        self.assertEqual([(e.address, e.calls) for e in profile.entries],
+                         [(0x1000, 3), (0x2000, 1)])
+        self.assertEqual(profile.toNs(profile.entries[0].inclusive), 150)
+
+    def tearDown(self):
+        if os.path.exists(self.kTestFile):
+            os.remove(self.kTestFile)
+
+if __name__ == '__main__':
+    if len(sys.argv) > 1 and sys.argv[1].endswith(".profile"):
+        report(sys.argv[1], int(sys.argv[2]) if len(sys.argv) > 2 else 30)
+    else:
+        unittest.main()
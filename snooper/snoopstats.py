@@ -0,0 +1,175 @@
+#!/usr/bin/python3
+"""
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+"""
+import struct
+import sys
+import os
+import time
+
+import unittest
+
+'''
+Reader for the stats page of a process traced with SNOOP_STATS=shm|file
+
+  snoopstats.py <pid | path> [interval seconds]
+
+'''
+
+kStatsMagic = b"SNOOPSTS"
+kHistogramSize = 32
+
+# Mirrors libsnoop/stats.h
+kStatsCounters = struct.Struct("<5Q%dQ%dQ" % (kHistogramSize, kHistogramSize))
+kStatsHeader = struct.Struct("<8sIIIIQQiIII" + kStatsCounters.format[1:])
+kStatsThread = struct.Struct("<iIQQQ" + kStatsCounters.format[1:])
+
+class Counters():
+    __slots__ = ["events", "buckets", "drops", "blocks", "bytes", "write_ns", "send_ns"]
+    def __init__(self, values):
+        (self.events, self.buckets, self.drops, self.blocks,
+         self.bytes) = values[:5]
+        # log2 histograms, [i] counts values in [2^i, 2^(i+1)) ns
+        self.write_ns = list(values[5:5 + kHistogramSize])
+        self.send_ns = list(values[5 + kHistogramSize:])
+
+class ThreadStats():
+    def __init__(self, values):
+        self.tid, _, self.backlog, self.backlog_max, self.lag_ns = values[:5]
+        self.counters = Counters(values[5:])
+
+class SnoopStats():
+    def __init__(self, raw):
+        values = kStatsHeader.unpack_from(raw)
+        (magic, self.version, header_size, thread_size, self.thread_capacity,
+         self.sequence, self.update_ns, self.pid, thread_count,
+         self.threads_exited, self.writers) = values[:11]
+        if magic != kStatsMagic:
+            raise ValueError("Not a snoop stats page")
+        self.total = Counters(values[11:])
+        self.threads = [ThreadStats(kStatsThread.unpack_from(raw, header_size + idx * thread_size))
+                        for idx in range(min(thread_count, self.thread_capacity))]
+
+def statsPath(target):
+    if target.isdigit():
+        return "/dev/shm/snoop-%s.stats" % target
+    return target
+
+def readStats(path, retries=100):
+    """ Consistent copy of the page - retries while the writer updates it """
+    for _ in range(retries):
+        with open(path, "rb") as page:
+            raw = page.read()
+        sequence = struct.unpack_from("<Q", raw, 24)[0]
+        with open(path, "rb") as page:
+            again = struct.unpack_from("<Q", page.read(32), 24)[0]
+        if sequence % 2 == 0 and sequence == again:
+            return SnoopStats(raw)
+        time.sleep(0.001)
+    raise IOError("Stats page keeps changing " + path)
+
+def percentile(histogram, fraction):
+    """ Upper bound in ns of the bucket holding the fraction-th value """
+    total = sum(histogram)
+    if total == 0:
+        return 0
+    seen = 0
+    for idx, count in enumerate(histogram):
+        seen += count
+        if seen >= fraction * total:
+            return 1 << (idx + 1)
+    return 1 << kHistogramSize
+
+def report(stats):
+    total = stats.total
+    print("pid %d writers %d threads %d exited %d" %
+          (stats.pid, stats.writers, len(stats.threads), stats.threads_exited))
+    print("events %d buckets %d drops %d written %d bytes %d" %
+          (total.events, total.buckets, total.drops, total.blocks, total.bytes))
+    print("write p50 <%dns p99 <%dns  send p50 <%dns p99 <%dns" %
+          (percentile(total.write_ns, 0.5), percentile(total.write_ns, 0.99),
+           percentile(total.send_ns, 0.5), percentile(total.send_ns, 0.99)))
+    print("%8s %12s %10s %8s %8s %12s %12s" %
+          ("tid", "events", "drops", "backlog", "max", "lag us", "send p99"))
+    for thread in stats.threads:
+        counters = thread.counters
+        print("%8d %12d %10d %8d %8d %12.1f %10dns" %
+              (thread.tid, counters.events, counters.drops, thread.backlog,
+               thread.backlog_max, thread.lag_ns / 1000.0,
+               percentile(counters.send_ns, 0.99)))
+
+'''
+Unit Testing
+
+'''
+class SnoopStatsTestCase(unittest.TestCase):
+    kTestFile = "snoopstats_test.stats"
+
+    def counters(self, events, drops):
+        write_ns = [0] * kHistogramSize
+        write_ns[10] = 3
+        send_ns = [0] * kHistogramSize
+        send_ns[4] = 99
+        send_ns[12] = 1
+        return [events, events // 1024, drops, events // 1024, events * 24] + write_ns + send_ns
+
+    def test_read(self):
+        with open(self.kTestFile, "wb") as out:
+            out.write(kStatsHeader.pack(kStatsMagic, 1, kStatsHeader.size, kStatsThread.size,
+                                        2, 4, 0, 7, 1, 3, 1, *self.counters(4096, 5)))
+            out.write(kStatsThread.pack(8, 0, 2, 9, 1500, *self.counters(2048, 5)))
+            out.write(kStatsThread.pack(*([0] * 5 + self.counters(0, 0))))
+        stats = readStats(self.kTestFile)
+        self.assertEqual((stats.pid, stats.threads_exited, stats.writers), (7, 3, 1))
+        self.assertEqual(stats.total.drops, 5)
+        self.assertEqual(len(stats.threads), 1)
+        self.assertEqual((stats.threads[0].tid, stats.threads[0].backlog_max), (8, 9))
+        self.assertEqual(percentile(stats.total.send_ns, 0.5), 32)
+        self.assertEqual(percentile(stats.total.send_ns, 0.999), 8192)
+
+    def test_path(self):
+        self.assertEqual(statsPath("42"), "/dev/shm/snoop-42.stats")
+        self.assertEqual(statsPath("x/42.stats"), "x/42.stats")
+
+    def tearDown(self):
+        if os.path.exists(self.kTestFile):
+            os.remove(self.kTestFile)
+
+if __name__ == '__main__':
+    if len(sys.argv) > 1:
+        path = statsPath(sys.argv[1])
+        interval = float(sys.argv[2]) if len(sys.argv) > 2 else 0
+        while True:
+            try:
+                stats = readStats(path)
+            except (IOError, OSError) as error:
+                # shm pages are removed when the process exits
+                print(str(error))
+                break
+            report(stats)
+            if interval <= 0:
+                break
+            time.sleep(interval)
+            print("")
+    else:
+        unittest.main()
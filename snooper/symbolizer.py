@@ -0,0 +1,178 @@
+#!/usr/bin/python3
+"""
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+"""
+import ctypes
+import os
+import shutil
+import subprocess
+import tempfile
+
+import unittest
+
+'''
+Bindings of libsnoopsym (symbolizer/symbolizer_api.h)
+
+'''
+
+# Empty disables the native symbolizer, the decoder falls back to addr2line
+kSymbolizerLib = os.getenv("SNOOP_SYMBOLIZER_LIB", "libsnoopsym.so")
+
+_library = None
+_loaded = False
+
+def loadLibrary():
+    """ libsnoopsym through the dynamic loader search path, None if missing """
+    global _library, _loaded
+    if _loaded:
+        return _library
+    _loaded = True
+    if not kSymbolizerLib:
+        return None
+    try:
+        library = ctypes.CDLL(kSymbolizerLib)
+    except OSError:
+        return None
+    library.snoop_symbolizer_open.argtypes = [ctypes.c_char_p]
+    library.snoop_symbolizer_open.restype = ctypes.c_void_p
+    library.snoop_symbolizer_close.argtypes = [ctypes.c_void_p]
+    library.snoop_symbolizer_close.restype = None
+    for resolve in (library.snoop_symbolizer_resolve,
+                    library.snoop_symbolizer_resolve_offsets):
+        resolve.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint64),
+                            ctypes.c_size_t, ctypes.POINTER(ctypes.c_char_p)]
+        resolve.restype = ctypes.c_size_t
+    _library = library
+    return _library
+
+class Symbolizer():
+    """
+    Function names of one ELF file. resolve takes virtual addresses of the
+    file, resolveOffsets file offsets. Names are bytes, None where no
+    function covers the address. Not thread safe. Tables are cached by
+    build-id in SNOOP_SYMBOL_CACHE (default ~/.cache/snoop).
+    """
+    def __init__(self, filename):
+        self.library = loadLibrary()
+        self.handle = None
+        if self.library is not None:
+            self.handle = self.library.snoop_symbolizer_open(filename.encode())
+
+    def valid(self):
+        return bool(self.handle)
+
+    def resolve(self, addresses):
+        return self.call(self.library.snoop_symbolizer_resolve, addresses)
+
+    def resolveOffsets(self, offsets):
+        return self.call(self.library.snoop_symbolizer_resolve_offsets, offsets)
+
+    def call(self, function, values):
+        count = len(values)
+        names = (ctypes.c_char_p * count)()
+        function(self.handle, (ctypes.c_uint64 * count)(*values), count, names)
+        return list(names)
+
+    def close(self):
+        if self.handle:
+            self.library.snoop_symbolizer_close(self.handle)
+            self.handle = None
+
+'''
+Unit Testing
+
+'''
+class SymbolizerTestCase(unittest.TestCase):
+    def setUp(self):
+        if loadLibrary() is None:
+            self.skipTest("libsnoopsym not found, set SNOOP_SYMBOLIZER_LIB")
+
+    def ownSymbol(self):
+        """ (library path, file offset) of an exported function """
+        address = ctypes.cast(loadLibrary().snoop_symbolizer_open, ctypes.c_void_p).value
+        with open("/proc/self/maps", "r") as maps:
+            for line in maps:
+                fields = line.split()
+                begin, end = [int(value, 16) for value in fields[0].split("-")]
+                if begin <= address < end and len(fields) > 5:
+                    return fields[5], address - begin + int(fields[2], 16)
+
+    def test_own_symbol(self):
+        path, offset = self.ownSymbol()
+        symbolizer = Symbolizer(path)
+        self.assertTrue(symbolizer.valid())
+        self.assertEqual(symbolizer.resolveOffsets([offset, 0]),
+                         [b"snoop_symbolizer_open", None])
+        symbolizer.close()
+
+    def test_cache(self):
+        path, offset = self.ownSymbol()
+        cache = tempfile.mkdtemp()
+        os.environ["SNOOP_SYMBOL_CACHE"] = cache
+        try:
+            # Written by the first open, mapped by the second
+            for files in (0, 1):
+                self.assertEqual(len(os.listdir(cache)), files)
+                symbolizer = Symbolizer(path)
+                self.assertEqual(symbolizer.resolveOffsets([offset]),
+                                 [b"snoop_symbolizer_open"])
+                symbolizer.close()
+            # A damaged cache file is ignored
+            name = os.path.join(cache, os.listdir(cache)[0])
+            with open(name, "r+b") as damaged:
+                damaged.truncate(16)
+            symbolizer = Symbolizer(path)
+            self.assertEqual(symbolizer.resolveOffsets([offset]),
+                             [b"snoop_symbolizer_open"])
+            symbolizer.close()
+        finally:
+            del os.environ["SNOOP_SYMBOL_CACHE"]
+            shutil.rmtree(cache)
+
+    def test_stripped_twin(self):
+        # A stripped copy of the same build must not hide .symtab names
+        if not shutil.which("strip") or not shutil.which("nm"):
+            self.skipTest("binutils not found")
+        path, offset = self.ownSymbol()
+        symbols = subprocess.check_output(["nm", "--defined-only", path])
+        local = [int(line.split()[0], 16) for line in symbols.decode().splitlines()
+                 if line.split()[1:2] == ["t"]][0]
+        directory = tempfile.mkdtemp()
+        cache = os.path.join(directory, "cache")
+        stripped = os.path.join(directory, "stripped.so")
+        os.environ["SNOOP_SYMBOL_CACHE"] = cache
+        try:
+            subprocess.check_call(["strip", "-o", stripped, path])
+            for filename, found in ((stripped, False), (path, True), (stripped, True)):
+                symbolizer = Symbolizer(filename)
+                self.assertEqual(symbolizer.resolve([local])[0] is not None, found)
+                symbolizer.close()
+        finally:
+            del os.environ["SNOOP_SYMBOL_CACHE"]
+            shutil.rmtree(directory)
+
+    def test_invalid(self):
+        self.assertFalse(Symbolizer("/proc/self/maps").valid())
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,75 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// snoop-symbolize [-o] <elf file> [address...]
+//
+// Prints the function name of each hex address, "??" when there is none.
+// Addresses are virtual addresses of the file, file offsets with -o (what
+// a .map line's begin and offset give). Without address arguments they are
+// read from stdin one per line, answered line by line - usable as a pipe
+// in place of addr2line -f.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "log.h"
+#include "symbolizer.h"
+
+namespace {
+
+void Print(snoop::Symbolizer& symbolizer, bool offsets, const std::string& input) {
+	uint64_t address = std::strtoull(input.c_str(), nullptr, 16);
+	const char* name = nullptr;
+	if (!offsets || symbolizer.AddressOf(address, address))
+		name = symbolizer.Resolve(address);
+	std::puts(name ? name : "??");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	int arg = 1;
+	const bool offsets = argc > arg && std::strcmp(argv[arg], "-o") == 0;
+	if (offsets)
+		arg++;
+	if (argc <= arg) {
+		LOG(ERROR, "usage: %s [-o] <elf file> [address...]", argv[0]);
+		return EXIT_FAILURE;
+	}
+	snoop::Symbolizer symbolizer;
+	if (!symbolizer.Open(argv[arg++]))
+		return EXIT_FAILURE;
+	if (argc > arg) {
+		for (; arg < argc; arg++)
+			Print(symbolizer, offsets, argv[arg]);
+		return EXIT_SUCCESS;
+	}
+	std::string line;
+	while (std::getline(std::cin, line)) {
+		Print(symbolizer, offsets, line);
+		std::fflush(stdout);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "log.h"
+#include "symbolcache.h"
+
+namespace {
+
+static const char* kCacheExt = ".sym";
+static const char* kCacheSubdir = "/snoop";
+
+}; // namespace
+
+namespace snoop {
+
+std::string SymbolCacheFromEnv() {
+	const char* env = getenv("SNOOP_SYMBOL_CACHE");
+	if (env)
+		return env;
+	env = getenv("XDG_CACHE_HOME");
+	if (env && *env)
+		return std::string(env) + kCacheSubdir;
+	env = getenv("HOME");
+	if (env && *env)
+		return std::string(env) + "/.cache" + kCacheSubdir;
+	return "";
+}
+
+std::string SymbolCacheName(const std::string& dir, const std::string& build_id) {
+	return dir + "/" + build_id + kCacheExt;
+}
+
+bool MakeSymbolCacheDir(const std::string& dir) {
+	for (std::size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1)) {
+		const std::string path = dir.substr(0, pos);
+		if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+			LOG(WARNING, "Failed to create symbol cache dir=%s: %s", path.c_str(),
+					strerror(errno));
+			return false;
+		}
+		if (pos == std::string::npos)
+			return true;
+	}
+}
+
+} // namespace snoop
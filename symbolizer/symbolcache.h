@@ -0,0 +1,78 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __SYMBOLCACHE_H__
+#define __SYMBOLCACHE_H__
+
+#include <cstdint>
+#include <string>
+
+namespace snoop {
+
+/**
+ * Symbol tables of ELF files cached on disk by build-id, one
+ * <build-id>.sym file each, so files of a build are parsed once for all
+ * traces of it. Laid out to be used mapped as is:
+ *
+ *   SymbolCacheHeader
+ *   uint64_t begins[count]       sorted function start addresses
+ *   uint64_t ends[count]
+ *   uint32_t names[count]        offsets into strings
+ *   char strings[strings_size]   demangled names, NUL terminated
+ *
+ * Files without a build-id are not cached. Copies of a build may differ in
+ * what strip left of their symbol tables, the header records what a table
+ * was built from and a file with more replaces it.
+ */
+static const char kSymbolCacheMagic[8] = { 'S', 'N', 'O', 'O', 'P', 'S', 'Y', 'M' };
+static const uint32_t kSymbolCacheVersion = 2;
+
+enum SymbolCacheFlags : uint32_t {
+	// Built from a file with .symtab, not from .dynsym alone
+	kSymbolCacheSymtab = 1 << 0,
+};
+
+struct SymbolCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t count;
+	uint64_t strings_size;
+	// SymbolCacheFlags
+	uint32_t flags;
+	uint32_t reserved;
+	// .symtab and .dynsym entries of the file
+	uint64_t symbols;
+};
+
+// SNOOP_SYMBOL_CACHE, $XDG_CACHE_HOME/snoop or $HOME/.cache/snoop when
+// unset. Empty (SNOOP_SYMBOL_CACHE=) disables the cache.
+std::string SymbolCacheFromEnv();
+// Cache file of a hex build-id in dir
+std::string SymbolCacheName(const std::string& dir, const std::string& build_id);
+// Creates dir and its parents
+bool MakeSymbolCacheDir(const std::string& dir);
+
+} // namespace snoop
+
+#endif // __SYMBOLCACHE_H__
@@ -0,0 +1,442 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <cxxabi.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+
+#include "log.h"
+#include "symbolcache.h"
+#include "symbolizer.h"
+#include "symbolizer_api.h"
+
+namespace {
+
+struct Elf32 {
+	typedef Elf32_Ehdr Ehdr;
+	typedef Elf32_Phdr Phdr;
+	typedef Elf32_Shdr Shdr;
+	typedef Elf32_Sym Sym;
+};
+
+struct Elf64 {
+	typedef Elf64_Ehdr Ehdr;
+	typedef Elf64_Phdr Phdr;
+	typedef Elf64_Shdr Shdr;
+	typedef Elf64_Sym Sym;
+};
+
+// Symbols at the same address - sized, global and .symtab names win
+enum Rank : uint8_t { kRankUnsized = 1 << 2, kRankLocal = 1 << 1, kRankDynamic = 1 << 0 };
+
+bool InImage(uint64_t offset, uint64_t size, std::size_t image_size) {
+	return offset <= image_size && size <= image_size - offset;
+}
+
+// Names of C++ symbols demangled, others as they are
+std::string Demangle(const char* mangled) {
+	int status = 0;
+	std::unique_ptr<char, decltype(&std::free)> name(
+			abi::__cxa_demangle(mangled, nullptr, nullptr, &status), &std::free);
+	return status == 0 && name ? name.get() : mangled;
+}
+
+// Hex NT_GNU_BUILD_ID of a PT_NOTE segment, empty if there is none
+std::string BuildId(const char* notes, std::size_t size, std::size_t align) {
+	static const char* kHex = "0123456789abcdef";
+	const auto aligned = [align](std::size_t value) {
+		return (value + align - 1) & ~(align - 1);
+	};
+	std::size_t pos = 0;
+	while (pos + sizeof(Elf64_Nhdr) <= size) {
+		Elf64_Nhdr note;
+		std::memcpy(&note, notes + pos, sizeof(note));
+		const std::size_t name = pos + sizeof(note);
+		const std::size_t desc = name + aligned(note.n_namesz);
+		if (desc > size || note.n_descsz > size - desc)
+			break;
+		if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == sizeof(ELF_NOTE_GNU) &&
+				std::memcmp(notes + name, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU)) == 0) {
+			std::string id;
+			for (std::size_t idx = 0; idx < note.n_descsz; idx++) {
+				const unsigned char byte = notes[desc + idx];
+				id.push_back(kHex[byte >> 4]);
+				id.push_back(kHex[byte & 0xf]);
+			}
+			return id;
+		}
+		pos = desc + aligned(note.n_descsz);
+	}
+	return "";
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static const unsigned char kHostData = ELFDATA2LSB;
+#else
+static const unsigned char kHostData = ELFDATA2MSB;
+#endif
+
+}; // namespace
+
+namespace snoop {
+
+Symbolizer::Symbolizer()
+	: count_(0), begins_(nullptr), ends_(nullptr), names_(nullptr), strings_(nullptr),
+		strings_size_(0), mapped_(nullptr), mapped_size_(0) {
+}
+
+Symbolizer::~Symbolizer() {
+	if (mapped_)
+		munmap(mapped_, mapped_size_);
+}
+
+bool Symbolizer::Open(const std::string& path) {
+	path_ = path;
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		LOG(ERROR, "Failed to open path=%s: %s", path.c_str(), strerror(errno));
+		return false;
+	}
+	struct stat status;
+	if (fstat(fd, &status) != 0 || (std::size_t)status.st_size < EI_NIDENT) {
+		LOG(ERROR, "Not an ELF file path=%s", path.c_str());
+		close(fd);
+		return false;
+	}
+	const std::size_t size = status.st_size;
+	void* image = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		LOG(ERROR, "Failed to map path=%s: %s", path.c_str(), strerror(errno));
+		return false;
+	}
+	const unsigned char* ident = static_cast<const unsigned char*>(image);
+	bool loaded = false;
+	if (std::memcmp(ident, ELFMAG, SELFMAG) != 0 || ident[EI_DATA] != kHostData) {
+		LOG(ERROR, "Not a native ELF file path=%s", path.c_str());
+	} else if (ident[EI_CLASS] == ELFCLASS64) {
+		loaded = load<Elf64>(static_cast<const char*>(image), size);
+	} else if (ident[EI_CLASS] == ELFCLASS32) {
+		loaded = load<Elf32>(static_cast<const char*>(image), size);
+	}
+	munmap(image, size);
+	LOG(INFO, "Symbolizer path=%s symbols=%lu cached=%d", path.c_str(),
+			(unsigned long)Size(), Cached());
+	return loaded;
+}
+
+template<class Elf> bool Symbolizer::load(const char* image, std::size_t size) {
+	typedef typename Elf::Ehdr Ehdr;
+	typedef typename Elf::Phdr Phdr;
+	typedef typename Elf::Shdr Shdr;
+	if (size < sizeof(Ehdr)) {
+		LOG(ERROR, "Truncated ELF file path=%s", path_.c_str());
+		return false;
+	}
+	Ehdr ehdr;
+	std::memcpy(&ehdr, image, sizeof(ehdr));
+	if (!InImage(ehdr.e_phoff, (uint64_t)ehdr.e_phnum * sizeof(Phdr), size) ||
+			!InImage(ehdr.e_shoff, (uint64_t)ehdr.e_shnum * sizeof(Shdr), size) ||
+			(ehdr.e_phnum && ehdr.e_phentsize != sizeof(Phdr)) ||
+			(ehdr.e_shnum && ehdr.e_shentsize != sizeof(Shdr))) {
+		LOG(ERROR, "Malformed ELF headers path=%s", path_.c_str());
+		return false;
+	}
+	std::string build_id;
+	for (std::size_t idx = 0; idx < ehdr.e_phnum; idx++) {
+		Phdr phdr;
+		std::memcpy(&phdr, image + ehdr.e_phoff + idx * sizeof(Phdr), sizeof(phdr));
+		if (phdr.p_type == PT_LOAD)
+			segments_.push_back(Segment{phdr.p_offset, phdr.p_filesz, phdr.p_vaddr});
+		if (phdr.p_type == PT_NOTE && build_id.empty() &&
+				InImage(phdr.p_offset, phdr.p_filesz, size))
+			build_id = BuildId(image + phdr.p_offset, phdr.p_filesz,
+					phdr.p_align == 8 ? 8 : 4);
+	}
+	std::vector<Shdr> sections(ehdr.e_shnum);
+	if (ehdr.e_shnum)
+		std::memcpy(sections.data(), image + ehdr.e_shoff, ehdr.e_shnum * sizeof(Shdr));
+	Source source = { 0, 0 };
+	for (const Shdr& section : sections) {
+		if (section.sh_type == SHT_SYMTAB)
+			source.flags |= kSymbolCacheSymtab;
+		if (section.sh_type == SHT_SYMTAB || section.sh_type == SHT_DYNSYM)
+			source.symbols += section.sh_size / sizeof(typename Elf::Sym);
+	}
+	const std::string dir = build_id.empty() ? "" : SymbolCacheFromEnv();
+	const std::string cache = dir.empty() ? "" : SymbolCacheName(dir, build_id);
+	if (!cache.empty() && map_cache(cache, source))
+		return true;
+	// Thumb functions have the low bit set
+	const uint64_t mask = ehdr.e_machine == EM_ARM ? ~(uint64_t)1 : ~(uint64_t)0;
+	std::vector<Symbol> symbols;
+	for (const Shdr& section : sections) {
+		if ((section.sh_type != SHT_SYMTAB && section.sh_type != SHT_DYNSYM) ||
+				section.sh_link >= sections.size())
+			continue;
+		add_symbols<Elf>(image, size, section, sections[section.sh_link],
+				section.sh_type == SHT_DYNSYM ? kRankDynamic : 0, mask, symbols);
+	}
+	sort_symbols(symbols);
+	use_table();
+	if (!cache.empty())
+		write_cache(dir, cache, source);
+	return true;
+}
+
+bool Symbolizer::map_cache(const std::string& name, const Source& source) {
+	const int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat status;
+	void* base = MAP_FAILED;
+	if (fstat(fd, &status) == 0 && (std::size_t)status.st_size >= sizeof(SymbolCacheHeader))
+		base = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		LOG(WARNING, "Failed to map symbol cache name=%s", name.c_str());
+		return false;
+	}
+	const std::size_t size = status.st_size;
+	const SymbolCacheHeader* header = static_cast<const SymbolCacheHeader*>(base);
+	const char* data = static_cast<const char*>(base);
+	const uint64_t count = header->count;
+	const std::size_t entry = 2 * sizeof(uint64_t) + sizeof(uint32_t);
+	if (std::memcmp(header->magic, kSymbolCacheMagic, sizeof(kSymbolCacheMagic)) != 0 ||
+			header->version != kSymbolCacheVersion ||
+			header->header_size < sizeof(SymbolCacheHeader) || header->header_size % 8 ||
+			count > size / entry || header->strings_size == 0 ||
+			header->header_size + count * entry + header->strings_size != size ||
+			data[size - 1] != '\0') {
+		LOG(WARNING, "Invalid symbol cache name=%s", name.c_str());
+		munmap(base, size);
+		return false;
+	}
+	// Written from a stripped copy of the same build
+	const uint32_t symtab = source.flags & kSymbolCacheSymtab;
+	const uint32_t cached_symtab = header->flags & kSymbolCacheSymtab;
+	if (symtab > cached_symtab ||
+			(symtab == cached_symtab && source.symbols > header->symbols)) {
+		LOG(INFO, "Symbol cache has fewer symbols than path=%s", path_.c_str());
+		munmap(base, size);
+		return false;
+	}
+	mapped_ = base;
+	mapped_size_ = size;
+	count_ = count;
+	begins_ = reinterpret_cast<const uint64_t*>(data + header->header_size);
+	ends_ = begins_ + count;
+	names_ = reinterpret_cast<const uint32_t*>(ends_ + count);
+	strings_ = reinterpret_cast<const char*>(names_ + count);
+	strings_size_ = header->strings_size;
+	return true;
+}
+
+void Symbolizer::write_cache(const std::string& dir, const std::string& name,
+		const Source& source) const {
+	// Demangled once here instead of on every lookup of every later open
+	std::string strings;
+	std::vector<uint32_t> names(count_);
+	for (std::size_t idx = 0; idx < count_; idx++) {
+		const std::string demangled = Demangle(strings_ + names_[idx]);
+		if (strings.size() + demangled.size() + 1 > std::numeric_limits<uint32_t>::max())
+			return;
+		names[idx] = strings.size();
+		strings.append(demangled);
+		strings.push_back('\0');
+	}
+	if (strings.empty())
+		strings.push_back('\0');
+	if (!MakeSymbolCacheDir(dir))
+		return;
+	SymbolCacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, kSymbolCacheMagic, sizeof(kSymbolCacheMagic));
+	header.version = kSymbolCacheVersion;
+	header.header_size = sizeof(header);
+	header.count = count_;
+	header.strings_size = strings.size();
+	header.flags = source.flags;
+	header.symbols = source.symbols;
+	// Readers only ever see complete files
+	const std::string temporary = name + "." + std::to_string(getpid());
+	std::ofstream stream(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+	stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	stream.write(reinterpret_cast<const char*>(begins_), count_ * sizeof(uint64_t));
+	stream.write(reinterpret_cast<const char*>(ends_), count_ * sizeof(uint64_t));
+	stream.write(reinterpret_cast<const char*>(names.data()), count_ * sizeof(uint32_t));
+	stream.write(strings.data(), strings.size());
+	stream.close();
+	if (!stream || rename(temporary.c_str(), name.c_str()) != 0) {
+		LOG(WARNING, "Failed to write symbol cache name=%s", name.c_str());
+		unlink(temporary.c_str());
+	}
+}
+
+void Symbolizer::use_table() {
+	count_ = table_.begins.size();
+	begins_ = table_.begins.data();
+	ends_ = table_.ends.data();
+	names_ = table_.names.data();
+	strings_ = table_.strings.c_str();
+	strings_size_ = table_.strings.size();
+	demangled_.assign(count_, nullptr);
+}
+
+template<class Elf> void Symbolizer::add_symbols(const char* image, std::size_t size,
+		const typename Elf::Shdr& table, const typename Elf::Shdr& strings,
+		uint8_t rank, uint64_t mask, std::vector<Symbol>& symbols) {
+	typedef typename Elf::Sym Sym;
+	if (!InImage(table.sh_offset, table.sh_size, size) ||
+			!InImage(strings.sh_offset, strings.sh_size, size) ||
+			strings.sh_size == 0) {
+		LOG(WARNING, "Symbol table out of file path=%s", path_.c_str());
+		return;
+	}
+	const char* names = image + strings.sh_offset;
+	const std::size_t count = table.sh_size / sizeof(Sym);
+	for (std::size_t idx = 0; idx < count; idx++) {
+		Sym sym;
+		std::memcpy(&sym, image + table.sh_offset + idx * sizeof(Sym), sizeof(sym));
+		const unsigned type = ELF64_ST_TYPE(sym.st_info);
+		if ((type != STT_FUNC && type != STT_GNU_IFUNC) || sym.st_shndx == SHN_UNDEF ||
+				sym.st_value == 0 || sym.st_name == 0 || sym.st_name >= strings.sh_size)
+			continue;
+		const char* name = names + sym.st_name;
+		const std::size_t length = strnlen(name, strings.sh_size - sym.st_name);
+		if (table_.strings.size() + length + 1 > std::numeric_limits<uint32_t>::max())
+			break;
+		uint8_t sym_rank = rank;
+		if (sym.st_size == 0)
+			sym_rank |= kRankUnsized;
+		if (ELF64_ST_BIND(sym.st_info) == STB_LOCAL)
+			sym_rank |= kRankLocal;
+		symbols.push_back(Symbol{sym.st_value & mask, sym.st_size,
+				(uint32_t)table_.strings.size(), sym_rank});
+		table_.strings.append(name, length);
+		table_.strings.push_back('\0');
+	}
+}
+
+void Symbolizer::sort_symbols(std::vector<Symbol>& symbols) {
+	std::sort(symbols.begin(), symbols.end(), [](const Symbol& a, const Symbol& b) {
+			return a.begin != b.begin ? a.begin < b.begin : a.rank < b.rank;
+	});
+	std::vector<uint64_t>& begins = table_.begins;
+	std::vector<uint64_t>& ends = table_.ends;
+	begins.reserve(symbols.size());
+	ends.reserve(symbols.size());
+	table_.names.reserve(symbols.size());
+	for (std::size_t idx = 0; idx < symbols.size(); idx++) {
+		const Symbol& symbol = symbols[idx];
+		// Aliases - the first one ranks best
+		if (!begins.empty() && begins.back() == symbol.begin)
+			continue;
+		begins.push_back(symbol.begin);
+		table_.names.push_back(symbol.name);
+		ends.push_back(symbol.begin + symbol.size);
+	}
+	// Unsized symbols reach the next symbol
+	for (std::size_t idx = 0; idx < begins.size(); idx++) {
+		if (ends[idx] != begins[idx])
+			continue;
+		ends[idx] = idx + 1 < begins.size() ? begins[idx + 1] :
+			std::numeric_limits<uint64_t>::max();
+	}
+}
+
+const char* Symbolizer::Resolve(uint64_t address) {
+	const uint64_t* it = std::upper_bound(begins_, begins_ + count_, address);
+	if (it == begins_)
+		return nullptr;
+	const std::size_t idx = it - begins_ - 1;
+	if (address >= ends_[idx] || names_[idx] >= strings_size_)
+		return nullptr;
+	if (demangled_.empty())
+		return strings_ + names_[idx];
+	if (!demangled_[idx]) {
+		demangled_names_.push_back(Demangle(strings_ + names_[idx]));
+		demangled_[idx] = demangled_names_.back().c_str();
+	}
+	return demangled_[idx];
+}
+
+bool Symbolizer::AddressOf(uint64_t offset, uint64_t& address) const {
+	for (const Segment& segment : segments_) {
+		if (offset >= segment.offset && offset - segment.offset < segment.size) {
+			address = segment.address + (offset - segment.offset);
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace snoop
+
+struct snoop_symbolizer {
+	snoop::Symbolizer symbolizer;
+};
+
+snoop_symbolizer* snoop_symbolizer_open(const char* path) {
+	std::unique_ptr<snoop_symbolizer> symbolizer(new snoop_symbolizer());
+	if (!path || !symbolizer->symbolizer.Open(path))
+		return nullptr;
+	return symbolizer.release();
+}
+
+void snoop_symbolizer_close(snoop_symbolizer* symbolizer) {
+	delete symbolizer;
+}
+
+size_t snoop_symbolizer_resolve(snoop_symbolizer* symbolizer,
+		const uint64_t* addresses, size_t count, const char** names) {
+	size_t found = 0;
+	for (size_t idx = 0; idx < count; idx++) {
+		names[idx] = symbolizer->symbolizer.Resolve(addresses[idx]);
+		found += names[idx] != nullptr;
+	}
+	return found;
+}
+
+size_t snoop_symbolizer_resolve_offsets(snoop_symbolizer* symbolizer,
+		const uint64_t* offsets, size_t count, const char** names) {
+	size_t found = 0;
+	for (size_t idx = 0; idx < count; idx++) {
+		uint64_t address = 0;
+		names[idx] = symbolizer->symbolizer.AddressOf(offsets[idx], address) ?
+			symbolizer->symbolizer.Resolve(address) : nullptr;
+		found += names[idx] != nullptr;
+	}
+	return found;
+}
@@ -0,0 +1,122 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __SYMBOLIZER_H__
+#define __SYMBOLIZER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace snoop {
+
+/**
+ * Function symbols of one ELF file (.symtab and .dynsym) in address order,
+ * replacing an addr2line process per file. Lookups are binary searches over
+ * a plain array of start addresses, names are demangled on first lookup and
+ * kept. Only function names are resolved - no DWARF line information.
+ *
+ * Tables of files with a build-id are written to the symbol cache (see
+ * symbolcache.h) and mapped from there on later opens, skipping the
+ * symbol tables and demangling - unless the file has more symbols than the
+ * cached table was built from.
+ *
+ * Not thread safe, lookups fill the demangling cache.
+ */
+class Symbolizer {
+ public:
+	Symbolizer();
+	~Symbolizer();
+	bool Open(const std::string& path);
+
+	// Name of the function containing a virtual address, nullptr if none.
+	// Valid for the lifetime of the symbolizer.
+	const char* Resolve(uint64_t address);
+	// Virtual address of a file offset in a loaded segment - what a
+	// /proc/pid/maps mapping begin + offset translates to
+	bool AddressOf(uint64_t offset, uint64_t& address) const;
+
+	std::size_t Size() const { return count_; }
+	bool Cached() const { return mapped_ != nullptr; }
+
+ private:
+	struct Segment {
+		uint64_t offset;
+		uint64_t size;
+		uint64_t address;
+	};
+	struct Symbol {
+		uint64_t begin;
+		uint64_t size;
+		uint32_t name;
+		uint8_t rank;
+	};
+	// Symbol tables a table is built from, see SymbolCacheHeader
+	struct Source {
+		uint32_t flags;
+		uint64_t symbols;
+	};
+
+	Symbolizer(const Symbolizer&) = delete;
+	template<class Elf> bool load(const char* image, std::size_t size);
+	bool map_cache(const std::string& name, const Source& source);
+	void write_cache(const std::string& dir, const std::string& name,
+			const Source& source) const;
+	void use_table();
+	template<class Elf> void add_symbols(const char* image, std::size_t size,
+			const typename Elf::Shdr& table, const typename Elf::Shdr& strings,
+			uint8_t rank, uint64_t mask, std::vector<Symbol>& symbols);
+	void sort_symbols(std::vector<Symbol>& symbols);
+
+ private:
+	struct Table {
+		std::vector<uint64_t> begins;
+		std::vector<uint64_t> ends;
+		std::vector<uint32_t> names;
+		// Mangled names, NUL separated
+		std::string strings;
+	};
+
+	std::string path_;
+	// Parallel arrays in begins_ order, searched through begins_ only -
+	// in table_ or in the mapped cache file
+	std::size_t count_;
+	const uint64_t* begins_;
+	const uint64_t* ends_;
+	const uint32_t* names_;
+	const char* strings_;
+	std::size_t strings_size_;
+	Table table_;
+	void* mapped_;
+	std::size_t mapped_size_;
+	// Empty for cached tables, their names are demangled already
+	std::vector<const char*> demangled_;
+	std::deque<std::string> demangled_names_;
+	std::vector<Segment> segments_;
+};
+
+} // namespace snoop
+
+#endif // __SYMBOLIZER_H__
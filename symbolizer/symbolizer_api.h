@@ -0,0 +1,59 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __SYMBOLIZER_API_H__
+#define __SYMBOLIZER_API_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * C interface of libsnoopsym for bindings (snooper/symbolizer.py). Names
+ * stay valid until the symbolizer is closed, a symbolizer must not be used
+ * by two threads at once.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct snoop_symbolizer snoop_symbolizer;
+
+/* NULL when the file is not a readable ELF file */
+snoop_symbolizer* snoop_symbolizer_open(const char* path);
+void snoop_symbolizer_close(snoop_symbolizer* symbolizer);
+
+/*
+ * Names of the functions at count virtual addresses, NULL where there is
+ * none. Returns the count of names found.
+ */
+size_t snoop_symbolizer_resolve(snoop_symbolizer* symbolizer,
+		const uint64_t* addresses, size_t count, const char** names);
+/* As snoop_symbolizer_resolve, for file offsets instead of addresses */
+size_t snoop_symbolizer_resolve_offsets(snoop_symbolizer* symbolizer,
+		const uint64_t* offsets, size_t count, const char** names);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SYMBOLIZER_API_H__
@@ -0,0 +1,63 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Writes the BlockEncoder payload of a fixed bucket to stdout. The delta
+// output is checked in as snooper/testdata/delta_block.bin, which the
+// snoopformat decoder tests read.
+//
+//   encode_block [delta|zlib]
+#include <cstdio>
+#include <cstring>
+
+#include "../libsnoop/encoder.h"
+
+namespace {
+
+using snoop::format::Record;
+
+// Negative and multi byte deltas in every field, an unknown address of a
+// module address file and a timestamp wrapping past 2^63
+const Record kRecords[] = {
+	{ 10, 0x5000, snoop::format::kEnter, 0 },
+	{ 15, 0x4000, snoop::format::kEnter, 1 },
+	{ 12, 0x4000, snoop::format::kExit, 1 },
+	{ 0x123456789a, 0x7f3a9c5e1234, snoop::format::kEnter, 300 },
+	{ 0x123456789b, snoop::format::PackModuleAddress(2, 0x1200),
+		snoop::format::kSuppressed, 2 },
+	{ 0x8000000000000010ull, snoop::format::PackAbsoluteAddress(0x7ffd1000),
+		snoop::format::kExit, 0 },
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	const bool zlib = argc > 1 && std::strcmp(argv[1], "zlib") == 0;
+	snoop::format::BlockEncoder encoder(zlib ? snoop::format::kCompressionZlib :
+			snoop::format::kCompressionDelta);
+	const uint32_t flags = encoder.Encode(kRecords,
+			sizeof(kRecords) / sizeof(kRecords[0]));
+	if (zlib && !(flags & snoop::format::kBlockZlib))
+		return 1;
+	return std::fwrite(encoder.Data(), 1, encoder.Size(), stdout) ==
+		encoder.Size() ? 0 : 1;
+}
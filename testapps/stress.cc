@@ -0,0 +1,191 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Synthetic workload for scripts/stress.py. Built instrumented like the
+// other testapps, runs the same way with and without libsnoop preloaded.
+//
+//   stress <workload> [threads] [duration_ms] [depth] [fanout] [rate]
+//
+//   calls   threads walk call trees of depth levels and fanout callees,
+//           rate calls per second per thread (0 - as fast as possible)
+//   churn   threads keep starting short lived threads walking one tree
+//   dlopen  threads keep loading libtest1.so, calling it and unloading it
+//
+// Prints one JSON line with the calls made.
+#include <dlfcn.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef int (*testapi1_t)(int);
+
+struct Config {
+	const char* workload;
+	long threads;
+	long duration_ms;
+	long depth;
+	long fanout;
+	long rate;
+};
+
+std::atomic<uint64_t> g_calls(0);
+// Keeps the calls from being optimised out
+volatile int g_sink;
+
+uint64_t NowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void SleepUntil(uint64_t deadline_ns) {
+	const uint64_t now = NowNs();
+	if (deadline_ns <= now)
+		return;
+	struct timespec ts;
+	ts.tv_sec = (deadline_ns - now) / 1000000000ull;
+	ts.tv_nsec = (deadline_ns - now) % 1000000000ull;
+	nanosleep(&ts, nullptr);
+}
+
+int __attribute__((noinline)) Leaf(int value) {
+	return value * 3 + 1;
+}
+
+// Returns calls made, itself included
+uint64_t __attribute__((noinline)) Tree(long depth, long fanout, int& sink) {
+	if (depth == 0) {
+		sink += Leaf(sink);
+		return 2;
+	}
+	uint64_t calls = 1;
+	for (long idx = 0; idx < fanout; idx++)
+		calls += Tree(depth - 1, fanout, sink);
+	return calls;
+}
+
+void Calls(const Config& config, uint64_t end_ns) {
+	const uint64_t begin = NowNs();
+	uint64_t calls = 0;
+	int sink = 0;
+	while (NowNs() < end_ns) {
+		calls += Tree(config.depth, config.fanout, sink);
+		if (config.rate > 0)
+			SleepUntil(begin + calls * 1000000000ull / config.rate);
+	}
+	g_calls += calls;
+	g_sink = sink;
+}
+
+void Churn(const Config& config, uint64_t end_ns) {
+	while (NowNs() < end_ns) {
+		std::thread worker([&config]() {
+			int sink = 0;
+			g_calls += Tree(config.depth, config.fanout, sink);
+			g_sink = sink;
+		});
+		worker.join();
+	}
+}
+
+std::string PluginPath() {
+	char path[PATH_MAX];
+	const ssize_t size = readlink("/proc/self/exe", path, sizeof(path) - 1);
+	if (size <= 0)
+		return "./libtest1.so";
+	path[size] = '\0';
+	std::string dir(path);
+	return dir.substr(0, dir.rfind('/')) + "/libtest1.so";
+}
+
+void Dlopen(const Config& config, uint64_t end_ns) {
+	const std::string plugin = PluginPath();
+	uint64_t calls = 0;
+	while (NowNs() < end_ns) {
+		void* handle = dlopen(plugin.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if (!handle) {
+			std::fprintf(stderr, "dlopen %s: %s\n", plugin.c_str(), dlerror());
+			return;
+		}
+		testapi1_t testapi1 = (testapi1_t)dlsym(handle, "TestApi1");
+		for (long idx = 0; testapi1 && idx < config.fanout; idx++)
+			calls += testapi1((int)idx) > 0;
+		dlclose(handle);
+	}
+	g_calls += calls;
+}
+
+long Arg(int argc, char** argv, int idx, long fallback) {
+	return argc > idx ? std::atol(argv[idx]) : fallback;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s calls|churn|dlopen [threads] [duration_ms] "
+				"[depth] [fanout] [rate]\n", argv[0]);
+		return 1;
+	}
+	Config config;
+	config.workload = argv[1];
+	config.threads = Arg(argc, argv, 2, 4);
+	config.duration_ms = Arg(argc, argv, 3, 1000);
+	config.depth = Arg(argc, argv, 4, 4);
+	config.fanout = Arg(argc, argv, 5, 4);
+	config.rate = Arg(argc, argv, 6, 0);
+
+	void (*run)(const Config&, uint64_t) = nullptr;
+	if (std::strcmp(config.workload, "calls") == 0)
+		run = Calls;
+	else if (std::strcmp(config.workload, "churn") == 0)
+		run = Churn;
+	else if (std::strcmp(config.workload, "dlopen") == 0)
+		run = Dlopen;
+	if (!run) {
+		std::fprintf(stderr, "unknown workload %s\n", config.workload);
+		return 1;
+	}
+
+	const uint64_t begin = NowNs();
+	const uint64_t end = begin + config.duration_ms * 1000000ull;
+	std::vector<std::thread> threads;
+	for (long idx = 0; idx < config.threads; idx++)
+		threads.emplace_back([&]() { run(config, end); });
+	for (auto& thread : threads)
+		thread.join();
+	std::printf("{\"workload\": \"%s\", \"threads\": %ld, \"calls\": %llu, "
+			"\"wall_ns\": %llu}\n", config.workload, config.threads,
+			(unsigned long long)g_calls.load(), (unsigned long long)(NowNs() - begin));
+	return 0;
+}
@@ -0,0 +1,77 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Replaces libtest1 with libtest2, which the loader usually maps at the
+// same base, and calls into it before and after the writer polled modules.
+// Every call after the poll must be recorded as libtest2 - also with
+// SNOOP_INCLUDE=libtest2.
+#include <dlfcn.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+
+typedef int (*testapi_t)(int);
+
+static const int kCalls = 100;
+
+void* Load(const std::string& path, const char* symbol, testapi_t& api) {
+	void* handle = dlopen(path.c_str(), RTLD_NOW);
+	if (!handle) {
+		std::cerr << "dlopen failed: " << dlerror() << std::endl;
+		return nullptr;
+	}
+	api = (testapi_t) dlsym(handle, symbol);
+	Dl_info info;
+	if (api && dladdr((void*)api, &info))
+		std::cout << path << " base=" << info.dli_fbase << std::endl;
+	return handle;
+}
+
+int main(int argc, char** argv) {
+	// Libraries are next to the executable, traces go to the working directory
+	std::string dir = argv[0];
+	dir = dir.find('/') == std::string::npos ? "." : dir.substr(0, dir.rfind('/'));
+	testapi_t api = nullptr;
+	void* handle = Load(dir + "/libtest1.so", "TestApi1", api);
+	if (!handle || !api)
+		return -1;
+	int sum = 0;
+	for (int idx = 0; idx < kCalls; idx++)
+		sum += api(idx);
+	dlclose(handle);
+
+	handle = Load(dir + "/libtest2.so", "TestApi2", api);
+	if (!handle || !api)
+		return -1;
+	// Loops stay in main, no record from the executable comes between
+	// the calls into the library
+	for (int idx = 0; idx < kCalls; idx++)
+		sum += api(idx);
+	// The writer polls modules at least once in the meantime
+	usleep(300000);
+	for (int idx = 0; idx < kCalls; idx++)
+		sum += api(idx);
+	dlclose(handle);
+	std::cout << "sum=" << sum << std::endl;
+	return 0;
+}
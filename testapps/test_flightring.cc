@@ -0,0 +1,86 @@
+/*
+MIT License
+
+Copyright (c) 2019 Marcin Harasimczuk
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Pushes records into a small FlightRing while another thread keeps taking
+// snapshots of it. Every snapshot must hold consecutive, untorn records -
+// each record carries its sequence number in all of its fields.
+//
+//   test_flightring [snapshots]
+//
+// Prints the snapshots taken and exits with 1 on the first bad one.
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "../libsnoop/flight.h"
+
+namespace {
+
+const std::size_t kCapacity = 8;
+
+bool Check(const std::vector<snoop::format::Record>& records) {
+	for (std::size_t idx = 0; idx < records.size(); idx++) {
+		const snoop::format::Record& record = records[idx];
+		const uint64_t sequence = record.timestamp;
+		if (record.address != (uintptr_t)sequence ||
+				record.type != (uint32_t)sequence ||
+				record.depth != (uint32_t)(sequence >> 32)) {
+			std::printf("torn record %zu sequence=%lu\n", idx, sequence);
+			return false;
+		}
+		if (idx && sequence != records[idx - 1].timestamp + 1) {
+			std::printf("gap at record %zu sequence=%lu\n", idx, sequence);
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	const long snapshots = argc > 1 ? std::atol(argv[1]) : 1000000;
+	snoop::FlightRing ring(0, kCapacity);
+	std::atomic_bool done(false);
+	std::thread pusher([&]() {
+		for (uint64_t sequence = 0; !done.load(std::memory_order_relaxed);
+				sequence++) {
+			const snoop::format::Record record = { sequence, (uintptr_t)sequence,
+				(uint32_t)sequence, (uint32_t)(sequence >> 32) };
+			ring.Push(record);
+		}
+	});
+	std::vector<snoop::format::Record> records;
+	long taken = 0;
+	bool good = true;
+	for (; taken < snapshots && good; taken++) {
+		ring.Snapshot(records);
+		good = Check(records);
+	}
+	done.store(true, std::memory_order_relaxed);
+	pusher.join();
+	std::printf("snapshots=%ld\n", taken);
+	return good ? 0 : 1;
+}